@@ -0,0 +1,82 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Bump allocator that hands out memory from large blocks
+// Nothing is freed on its own, everything goes at once with Reset or when the arena is destroyed
+// Only meant for trivially copyable data, no constructors or destructors are run
+class Arena
+{
+public:
+	explicit Arena(size_t blockSize = 1 << 20) : blockSize(blockSize) {}
+
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+
+	// Returns uninitialized memory, aligned to at least a cache line
+	void* Allocate(size_t size, size_t alignment = kCacheLine)
+	{
+		// Compared rather than passed to std::max, which would need kCacheLine defined outside the class
+		if (alignment < kCacheLine) alignment = kCacheLine;
+		if (!blocks.empty())
+		{
+			void* memory = TryAllocate(blocks.back(), size, alignment);
+			if (memory != nullptr) return memory;
+		}
+
+		// Oversized requests get a block of their own
+		Block block;
+		block.size = std::max(blockSize, size + alignment);
+		block.data.reset(new char[block.size]);
+		block.used = 0;
+		blocks.push_back(std::move(block));
+		bytesReserved += blocks.back().size;
+		return TryAllocate(blocks.back(), size, alignment);
+	}
+
+	template <typename T>
+	T* AllocateArray(size_t count)
+	{
+		return static_cast<T*>(Allocate(count * sizeof(T), alignof(T)));
+	}
+
+	// Free every allocation at once
+	void Reset()
+	{
+		blocks.clear();
+		bytesUsed = 0;
+		bytesReserved = 0;
+	}
+
+	size_t BytesUsed() const { return bytesUsed; }
+	size_t BytesReserved() const { return bytesReserved; }
+
+	static constexpr size_t kCacheLine = 64;
+
+private:
+	struct Block
+	{
+		std::unique_ptr<char[]> data;
+		size_t size = 0;
+		size_t used = 0;
+	};
+
+	void* TryAllocate(Block& block, size_t size, size_t alignment)
+	{
+		uintptr_t base = reinterpret_cast<uintptr_t>(block.data.get());
+		uintptr_t start = (base + block.used + alignment - 1) & ~(static_cast<uintptr_t>(alignment) - 1);
+		size_t end = static_cast<size_t>(start - base) + size;
+		if (end > block.size) return nullptr;
+		bytesUsed += end - block.used;
+		block.used = end;
+		return reinterpret_cast<void*>(start);
+	}
+
+	size_t blockSize;
+	size_t bytesUsed = 0;
+	size_t bytesReserved = 0;
+	std::vector<Block> blocks;
+};
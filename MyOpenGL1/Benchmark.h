@@ -0,0 +1,991 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Bvh.h"
+#include "CollisionSystem.h"
+#include "Curve.h"
+#include "CurveBatch.h"
+#include "Frustum.h"
+#include "EntityStore.h"
+#include "InstanceBatches.h"
+#include "Level.h"
+#include "MeshNormals.h"
+#include "MeshRegistry.h"
+#include "MappedFile.h"
+#include "ObjectFileLoader.h"
+#include "Surface.h"
+#include "TaskGraph.h"
+#include "TerrainStreamer.h"
+#include "Types.h"
+#include "World.h"
+
+// Command line benchmarks, run with --bench-<name> instead of opening a window
+// and the headless run, which times the real world with no window for tracking regressions
+class Benchmark
+{
+public:
+	// Swallows everything written to it, used to keep loader logging out of the measurements
+	class NullBuffer : public std::streambuf
+	{
+	protected:
+		int overflow(int c) override { return c; }
+		std::streamsize xsputn(const char*, std::streamsize n) override { return n; }
+	};
+
+	static double SecondsSince(std::chrono::high_resolution_clock::time_point start)
+	{
+		return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	// Compare the stream based .obj reader against the memory mapped one
+	static void ObjectFileLoading(const std::string& fileName, int iterations)
+	{
+		MappedFile file;
+		if (!file.Open(fileName))
+		{
+			std::cout << "Could not open file " << fileName << std::endl;
+			return;
+		}
+		double megabytes = file.Size() / (1024.0 * 1024.0);
+		file.Close();
+
+		std::vector<Vertex> vertices;
+		std::vector<int> indices;
+		ObjectFileReadSettings settings;
+		settings.bQuiet = true;
+		settings.nThreads = 1;
+		settings.bUseCache = false;
+		// Compare like for like with the stream reader, which never shares vertices
+		settings.bDeduplicate = false;
+
+		NullBuffer nullBuffer;
+		std::streambuf* coutBuffer = std::cout.rdbuf(&nullBuffer);
+
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < iterations; i++)
+		{
+			vertices.clear();
+			indices.clear();
+			ReadObjectFileLegacy(fileName, vertices, indices);
+		}
+		double legacySeconds = SecondsSince(start) / iterations;
+		size_t legacyVertices = vertices.size();
+
+		start = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < iterations; i++)
+		{
+			vertices.clear();
+			indices.clear();
+			ReadObjectFile(fileName, vertices, indices, settings);
+		}
+		double mappedSeconds = SecondsSince(start) / iterations;
+
+		std::cout.rdbuf(coutBuffer);
+
+		std::cout << fileName << ": " << megabytes << " MB, " << vertices.size() << " verts, " << iterations << " iterations" << std::endl;
+		std::cout << "Stream reader: " << legacySeconds * 1000.0 << " ms, " << megabytes / legacySeconds << " MB/s" << std::endl;
+		std::cout << "Mapped reader: " << mappedSeconds * 1000.0 << " ms, " << megabytes / mappedSeconds << " MB/s" << std::endl;
+		std::cout << "Speedup: " << legacySeconds / mappedSeconds << "x" << std::endl;
+		if (legacyVertices != vertices.size())
+			std::cout << "WARNING: readers disagree on vertex count (" << legacyVertices << " vs " << vertices.size() << ")" << std::endl;
+
+		// Chunked parsing, scaling from one thread to every core
+		std::vector<Vertex> serialVertices = vertices;
+		int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+		settings.minChunkSize = 1;
+		for (int nThreads = 1; nThreads <= maxThreads; nThreads = (nThreads * 2 > maxThreads && nThreads < maxThreads) ? maxThreads : nThreads * 2)
+		{
+			settings.nThreads = nThreads;
+			start = std::chrono::high_resolution_clock::now();
+			for (int i = 0; i < iterations; i++)
+			{
+				vertices.clear();
+				indices.clear();
+				ReadObjectFile(fileName, vertices, indices, settings);
+			}
+			double seconds = SecondsSince(start) / iterations;
+			bool bIdentical = vertices.size() == serialVertices.size() && memcmp(vertices.data(), serialVertices.data(), vertices.size() * sizeof(Vertex)) == 0;
+			std::cout << nThreads << " threads: " << seconds * 1000.0 << " ms, " << megabytes / seconds << " MB/s, "
+				<< mappedSeconds / seconds << "x" << (bIdentical ? "" : " (OUTPUT DIFFERS)") << std::endl;
+		}
+
+		// Indexed output with shared vertices
+		settings.nThreads = 0;
+		settings.minChunkSize = ObjectFileReadSettings().minChunkSize;
+		settings.bDeduplicate = true;
+		ObjectFileReturnInfo info;
+		start = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < iterations; i++)
+		{
+			vertices.clear();
+			indices.clear();
+			info = ReadObjectFile(fileName, vertices, indices, settings);
+		}
+		double dedupSeconds = SecondsSince(start) / iterations;
+		std::cout << "Deduplicated: " << dedupSeconds * 1000.0 << " ms, " << info.nUniqueVertices << " of " << info.nCorners
+			<< " vertices (" << info.DedupRatio() << "x smaller vertex buffer)" << std::endl;
+
+		// Cooked binary cache, the first load writes it and the rest only map and copy it
+		settings.bUseCache = true;
+		vertices.clear();
+		indices.clear();
+		ReadObjectFile(fileName, vertices, indices, settings);
+		start = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < iterations; i++)
+		{
+			vertices.clear();
+			indices.clear();
+			info = ReadObjectFile(fileName, vertices, indices, settings);
+		}
+		double cachedSeconds = SecondsSince(start) / iterations;
+		std::cout << "Cooked cache: " << cachedSeconds * 1000.0 << " ms" << (info.bLoadedFromCache ? "" : " (CACHE NOT USED)")
+			<< ", " << dedupSeconds / cachedSeconds << "x faster than parsing" << std::endl;
+	}
+
+	// Player collision against a growing field of trees, grid query against testing every entity
+	static void CollisionQueries(int queries)
+	{
+		std::cout << "Radius collision, " << queries << " queries per scene" << std::endl;
+		for (int nTrees = 1000; nTrees <= 1000000; nTrees *= 10)
+		{
+			// Same density as the --stress-trees scene
+			EntityStore store;
+			store.Reserve(nTrees + 1);
+			float halfSize = sqrtf(32.0f * nTrees) * 0.5f;
+			std::mt19937 random(1234);
+			std::uniform_real_distribution<float> position(-halfSize, halfSize);
+			for (int i = 0; i < nTrees; i++)
+			{
+				Entity tree;
+				tree.transformation.x = position(random);
+				tree.transformation.z = position(random);
+				tree.RadiusCollisionSize = 0.5f;
+				tree.bHasRadiusCollision = true;
+				store.Create(tree);
+			}
+			Entity playerEntity;
+			playerEntity.RadiusCollisionSize = 0.5f;
+			EntityId mover = store.Create(playerEntity);
+
+			std::vector<glm::vec2> targets(queries);
+			for (glm::vec2& target : targets)
+				target = glm::vec2(position(random), position(random));
+
+			std::vector<glm::vec2> gridResults(queries);
+			auto start = std::chrono::high_resolution_clock::now();
+			for (int i = 0; i < queries; i++)
+			{
+				store.x[mover] = targets[i].x;
+				store.z[mover] = targets[i].y;
+				store.ResolveRadiusCollisions(mover);
+				gridResults[i] = glm::vec2(store.x[mover], store.z[mover]);
+			}
+			double gridSeconds = SecondsSince(start);
+
+			// The linear scan gets slow, run fewer queries on the big scenes
+			int linearQueries = std::max(1, std::min(queries, static_cast<int>(100000000LL / nTrees)));
+			int mismatches = 0;
+			start = std::chrono::high_resolution_clock::now();
+			for (int i = 0; i < linearQueries; i++)
+			{
+				store.x[mover] = targets[i].x;
+				store.z[mover] = targets[i].y;
+				store.ResolveRadiusCollisionsLinear(mover);
+				if (glm::vec2(store.x[mover], store.z[mover]) != gridResults[i]) mismatches++;
+			}
+			double linearSeconds = SecondsSince(start);
+
+			double gridNanoseconds = gridSeconds / queries * 1e9;
+			double linearNanoseconds = linearSeconds / linearQueries * 1e9;
+			std::cout << nTrees << " trees: grid " << gridNanoseconds << " ns/query, linear " << linearNanoseconds << " ns/query, "
+				<< linearNanoseconds / gridNanoseconds << "x" << (mismatches == 0 ? "" : " (RESULTS DIFFER)") << std::endl;
+		}
+	}
+
+	// Every agent wanders and collides with every other agent and a field of trees and boxes
+	static void AgentCollisions(int nAgents, int frames)
+	{
+		EntityStore store;
+		std::mt19937 random(1234);
+
+		// One agent per 8 square units, so there are plenty of contacts
+		float halfSize = sqrtf(8.0f * nAgents) * 0.5f;
+		std::uniform_real_distribution<float> position(-halfSize, halfSize);
+		int nStatics = nAgents / 4;
+		for (int i = 0; i < nStatics; i++)
+		{
+			Entity obstacle;
+			obstacle.transformation.x = position(random);
+			obstacle.transformation.z = position(random);
+			if (i % 2 == 0)
+			{
+				obstacle.RadiusCollisionSize = 0.5f;
+				obstacle.bHasRadiusCollision = true;
+			}
+			else
+			{
+				obstacle.collision = BoxCollisionDef();
+				obstacle.collision.x_relative = -1.0f;
+				obstacle.collision.z_relative = -0.5f;
+				obstacle.collision.y_relative = 0.0f;
+				obstacle.collision.x_size = 2.0f;
+				obstacle.collision.z_size = 1.0f;
+				obstacle.collision.y_size = 1.0f;
+				obstacle.bHasBoxCollision = true;
+			}
+			store.Create(obstacle);
+		}
+
+		std::vector<EntityId> agents;
+		std::vector<glm::vec2> velocities;
+		std::uniform_real_distribution<float> direction(-1.0f, 1.0f);
+		for (int i = 0; i < nAgents; i++)
+		{
+			Entity agent;
+			agent.transformation.x = position(random);
+			agent.transformation.z = position(random);
+			agent.RadiusCollisionSize = 0.4f;
+			agent.bHasRadiusCollision = true;
+			agent.bIsDynamic = true;
+			agents.push_back(store.Create(agent));
+			velocities.push_back(glm::vec2(direction(random), direction(random)));
+		}
+
+		// Check the broad phase against testing every pair of agents
+		if (nAgents <= 20000)
+		{
+			size_t overlappingPairs = 0;
+			for (int i = 0; i < nAgents; i++)
+			{
+				for (int j = i + 1; j < nAgents; j++)
+				{
+					glm::vec2 difference = glm::vec2(store.x[agents[i]] - store.x[agents[j]], store.z[agents[i]] - store.z[agents[j]]);
+					if (glm::dot(difference, difference) < 0.8f * 0.8f) overlappingPairs++;
+				}
+			}
+			CollisionSystem check;
+			check.Update(store);
+			size_t agentContacts = 0;
+			for (const Contact& contact : check.Contacts())
+			{
+				if (store.HasFlag(contact.other, EntityStore::kFlagDynamic)) agentContacts++;
+			}
+			std::cout << "Agent pairs overlapping: " << overlappingPairs << " all pairs, " << agentContacts / 2 << " broad phase"
+				<< (overlappingPairs * 2 == agentContacts ? "" : " (RESULTS DIFFER)") << std::endl;
+		}
+
+		CollisionSystem collisions;
+		const float frameTime = 1.0f / 60.0f;
+		size_t totalContacts = 0;
+		size_t totalPairs = 0;
+		double seconds = 0.0;
+		for (int frame = 0; frame < frames; frame++)
+		{
+			for (int i = 0; i < nAgents; i++)
+			{
+				store.x[agents[i]] += velocities[i].x * frameTime;
+				store.z[agents[i]] += velocities[i].y * frameTime;
+			}
+			auto start = std::chrono::high_resolution_clock::now();
+			collisions.Update(store);
+			seconds += SecondsSince(start);
+			totalContacts += collisions.Contacts().size();
+			totalPairs += collisions.PairsTested();
+		}
+
+		std::cout << nAgents << " agents, " << nStatics << " obstacles: " << seconds / frames * 1000.0 << " ms/frame, "
+			<< totalPairs / frames << " pairs tested, " << totalContacts / frames << " contacts per frame" << std::endl;
+	}
+
+	// Simulation ticks and draw preparation as task graphs on 1, 2, 4 ... threads
+	// Agents follow curves and collide in the tick, their matrices are blended between ticks and sorted for drawing
+	// Every thread count starts from the same scene, and must end with the same positions
+	static void SimulationScaling(int nAgents, int frames)
+	{
+		int maxThreads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+		std::vector<int> threadCounts;
+		for (int nThreads = 1; nThreads < maxThreads; nThreads *= 2)
+			threadCounts.push_back(nThreads);
+		threadCounts.push_back(maxThreads);
+		std::cout << nAgents << " agents, " << frames << " frames, " << maxThreads << " hardware threads" << std::endl;
+
+		// Agents use meshes 1 to 3 and obstacles mesh 0, two draw groups per mesh like the renderer
+		const size_t kGroups = 8;
+		const float tickLength = 1.0f / 60.0f;
+		double singleThreadTickSeconds = 0.0, singleThreadDrawSeconds = 0.0;
+		double firstChecksum = 0.0;
+		for (int nThreads : threadCounts)
+		{
+			EntityStore store;
+			std::mt19937 random(1234);
+			float halfSize = sqrtf(8.0f * nAgents) * 0.5f;
+			std::uniform_real_distribution<float> position(-halfSize, halfSize);
+			std::uniform_real_distribution<float> offset(-10.0f, 10.0f);
+			std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+			for (int i = 0; i < nAgents / 4; i++)
+			{
+				Entity obstacle;
+				obstacle.mesh = 0;
+				obstacle.transformation.x = position(random);
+				obstacle.transformation.z = position(random);
+				obstacle.RadiusCollisionSize = 0.5f;
+				obstacle.bHasRadiusCollision = true;
+				store.Create(obstacle);
+			}
+
+			CurveBatch paths(3);
+			std::vector<EntityId> agents;
+			std::vector<float> t(nAgents), speed(nAgents), pathX(nAgents), pathZ(nAgents);
+			for (int i = 0; i < nAgents; i++)
+			{
+				glm::vec2 start(position(random), position(random));
+				std::vector<glm::vec2> points(4, start);
+				for (size_t k = 1; k < points.size(); k++)
+					points[k] += glm::vec2(offset(random), offset(random));
+				paths.Add(points);
+				t[i] = unit(random);
+				speed[i] = 0.05f + 0.1f * unit(random);
+
+				Entity agent;
+				agent.mesh = 1 + i % 3;
+				agent.transformation.x = start.x;
+				agent.transformation.z = start.y;
+				agent.RadiusCollisionSize = 0.4f;
+				agent.bHasRadiusCollision = true;
+				agent.bIsDynamic = true;
+				agents.push_back(store.Create(agent));
+			}
+
+			CollisionSystem collisions;
+			std::vector<glm::mat4> matrices(store.Count());
+			std::vector<uint32_t> groups(store.Count());
+			InstanceBatches instances;
+
+			JobSystem jobs(nThreads);
+			TaskGraph tick;
+			TaskId storePrevious = tick.Add("store previous transforms", [&] { store.StorePreviousTransforms(); });
+			TaskId collisionSetup = tick.Add("collision setup", [&] { collisions.BeginUpdate(store); }, { storePrevious });
+			TaskId broadPhase = tick.AddParallelFor("broad-phase", [&] { return collisions.TaskCount(); }, 1, [&](size_t begin, size_t end)
+			{
+				for (size_t task = begin; task < end; task++)
+					collisions.FindContacts(store, task);
+			}, { collisionSetup });
+			TaskId resolveCollisions = tick.Add("resolve collisions", [&] { collisions.EndUpdate(store); }, { broadPhase });
+			// Back and forth along the path, steering halfway to the point on the path every frame
+			tick.AddParallelFor("update agents", [&] { return agents.size(); }, CurveBatch::kBlockSize * 64, [&](size_t begin, size_t end)
+			{
+				for (size_t i = begin; i < end; i++)
+				{
+					t[i] += speed[i] * tickLength;
+					if (t[i] > 1.0f || t[i] < 0.0f)
+					{
+						speed[i] = -speed[i];
+						t[i] = t[i] > 1.0f ? 2.0f - t[i] : -t[i];
+					}
+				}
+				paths.Evaluate(begin, end - begin, t.data(), pathX.data(), pathZ.data());
+				for (size_t i = begin; i < end; i++)
+				{
+					EntityId id = agents[i];
+					store.x[id] += (pathX[i] - store.x[id]) * 0.5f;
+					store.z[id] += (pathZ[i] - store.z[id]) * 0.5f;
+				}
+			}, { resolveCollisions });
+
+			// Drawn halfway between the last two ticks
+			TaskGraph draw;
+			TaskId buildMatrices = draw.AddParallelFor("build matrices", [&] { return store.Count(); }, 1024, [&](size_t begin, size_t end)
+			{
+				store.ComputeMatrices(matrices.data(), begin, end, true, 0.5f);
+				for (size_t id = begin; id < end; id++)
+					groups[id] = store.mesh[id] * 2;
+			});
+			TaskId countInstances = draw.AddParallelFor("count instances", [&] { return instances.TaskCount(); }, 1, [&](size_t begin, size_t end)
+			{
+				for (size_t task = begin; task < end; task++)
+					instances.Count(task, groups.data());
+			}, { buildMatrices });
+			TaskId instanceOffsets = draw.Add("instance offsets", [&] { instances.ComputeOffsets(); }, { countInstances });
+			draw.AddParallelFor("build instance buffers", [&] { return instances.TaskCount(); }, 1, [&](size_t begin, size_t end)
+			{
+				for (size_t task = begin; task < end; task++)
+					instances.Scatter(task, groups.data(), matrices.data());
+			}, { instanceOffsets });
+
+			double tickSeconds = 0.0, drawSeconds = 0.0;
+			for (int frame = 0; frame < frames; frame++)
+			{
+				auto start = std::chrono::high_resolution_clock::now();
+				tick.Run(jobs);
+				tickSeconds += SecondsSince(start);
+
+				start = std::chrono::high_resolution_clock::now();
+				instances.Begin(store.Count(), kGroups);
+				draw.Run(jobs);
+				drawSeconds += SecondsSince(start);
+			}
+			tickSeconds /= frames;
+			drawSeconds /= frames;
+			if (nThreads == 1)
+			{
+				singleThreadTickSeconds = tickSeconds;
+				singleThreadDrawSeconds = drawSeconds;
+			}
+
+			double checksum = 0.0;
+			for (size_t group = 0; group < kGroups; group++)
+			{
+				for (size_t i = 0; i < instances.InstanceCount(group); i++)
+					checksum += instances.Matrices(group)[i][3].x + instances.Matrices(group)[i][3].z;
+			}
+			if (nThreads == 1) firstChecksum = checksum;
+
+			std::cout << nThreads << " threads: tick " << tickSeconds * 1000.0 << " ms (" << singleThreadTickSeconds / tickSeconds << "x), draw preparation "
+				<< drawSeconds * 1000.0 << " ms (" << singleThreadDrawSeconds / drawSeconds << "x), " << collisions.Contacts().size() << " contacts"
+				<< (checksum == firstChecksum ? "" : " (RESULTS DIFFER)") << std::endl;
+		}
+	}
+
+	// Scalar terrain height against the batched SIMD version, and the largest difference between them
+	static void TerrainHeights(int count)
+	{
+		std::mt19937 random(1234);
+		std::uniform_real_distribution<float> position(-32768.0f, 32768.0f);
+		std::vector<float> x(count), z(count), scalarHeights(count), batchHeights(count);
+		for (int i = 0; i < count; i++)
+		{
+			x[i] = position(random);
+			z[i] = position(random);
+		}
+
+		const int iterations = 10;
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int iteration = 0; iteration < iterations; iteration++)
+		{
+			for (int i = 0; i < count; i++)
+				scalarHeights[i] = Surface::GetGroundZAt2dCoord(x[i], z[i]);
+		}
+		double scalarSeconds = SecondsSince(start) / iterations;
+
+		start = std::chrono::high_resolution_clock::now();
+		for (int iteration = 0; iteration < iterations; iteration++)
+			Surface::GetGroundZAt2dCoords(x.data(), z.data(), batchHeights.data(), count);
+		double batchSeconds = SecondsSince(start) / iterations;
+
+		float maxError = 0.0f;
+		for (int i = 0; i < count; i++)
+			maxError = std::max(maxError, std::abs(scalarHeights[i] - batchHeights[i]));
+
+#if defined(__AVX2__)
+		const char* width = "AVX2";
+#else
+		const char* width = "SSE2";
+#endif
+		std::cout << count << " heights" << std::endl;
+		std::cout << "Scalar: " << scalarSeconds / count * 1e9 << " ns/height" << std::endl;
+		std::cout << "Batch (" << width << "): " << batchSeconds / count * 1e9 << " ns/height, " << scalarSeconds / batchSeconds << "x" << std::endl;
+		std::cout << "Max error: " << maxError << " (bound " << Surface::kGroundZMaxError << ")"
+			<< (maxError <= Surface::kGroundZMaxError ? "" : " (BOUND EXCEEDED)") << std::endl;
+	}
+
+	// Shared vertex grid against the old generator with six vertices per cell
+	static void SurfaceGeneration(int subdivision)
+	{
+		auto report = [](const char* name, double seconds, const std::vector<Vertex>& vertices, const std::vector<int>& indices)
+		{
+			double megabytes = (vertices.size() * sizeof(Vertex) + indices.size() * sizeof(int)) / (1024.0 * 1024.0);
+			std::cout << name << ": " << seconds * 1000.0 << " ms, " << vertices.size() << " verts, " << indices.size() / 3 << " triangles, " << megabytes << " MB" << std::endl;
+		};
+
+		std::cout << "Surface subdivision " << subdivision << std::endl;
+		double gridSeconds;
+		{
+			std::vector<Vertex> vertices;
+			std::vector<int> indices;
+			auto start = std::chrono::high_resolution_clock::now();
+			Surface::GenerateSurface(-20.0f, 20.0f, -20.0f, 20.0f, subdivision, vertices, indices);
+			gridSeconds = SecondsSince(start);
+			report("Indexed grid", gridSeconds, vertices, indices);
+		}
+
+		// Six 44 byte vertices and six indices per cell
+		double legacyGigabytes = static_cast<double>(subdivision) * subdivision * 6 * (sizeof(Vertex) + sizeof(int)) / (1024.0 * 1024.0 * 1024.0);
+		if (legacyGigabytes > 2.0)
+		{
+			std::cout << "Old generator skipped, it would need about " << legacyGigabytes << " GB" << std::endl;
+			return;
+		}
+		std::vector<Vertex> vertices;
+		std::vector<int> indices;
+		auto start = std::chrono::high_resolution_clock::now();
+		Surface::GenerateSurfaceLegacy(-20.0f, 20.0f, -20.0f, 20.0f, subdivision, vertices, indices);
+		double legacySeconds = SecondsSince(start);
+		report("Per-cell vertices", legacySeconds, vertices, indices);
+		std::cout << "Speedup: " << legacySeconds / gridSeconds << "x" << std::endl;
+	}
+
+	// Walk in a straight line over streamed terrain at 60 frames per second and time the main thread's share
+	// Nothing is uploaded, so no window is needed
+	static void TerrainStreaming(int frames)
+	{
+		const float kFrameSeconds = 1.0f / 60.0f;
+		const float kSpeed = 30.0f;
+
+		MeshRegistry meshes;
+		TerrainStreamerSettings settings;
+		settings.bUploadToGpu = false;
+		TerrainStreamer streamer(meshes, settings);
+
+		// Let the first ring of chunks load before walking, like a loading screen would
+		glm::vec3 position(0.0f);
+		while (streamer.LoadedCount() == 0 || streamer.PendingCount() > 0)
+		{
+			streamer.Update(position);
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+
+		double totalSeconds = 0.0, maxSeconds = 0.0;
+		size_t maxPending = 0;
+		for (int frame = 0; frame < frames; frame++)
+		{
+			auto frameStart = std::chrono::high_resolution_clock::now();
+			streamer.Update(position);
+			double seconds = SecondsSince(frameStart);
+			totalSeconds += seconds;
+			maxSeconds = std::max(maxSeconds, seconds);
+			maxPending = std::max(maxPending, streamer.PendingCount());
+
+			position.x += kSpeed * kFrameSeconds;
+			// The rest of the frame is left to the workers
+			double remaining = kFrameSeconds - SecondsSince(frameStart);
+			if (remaining > 0.0) std::this_thread::sleep_for(std::chrono::duration<double>(remaining));
+		}
+
+		// What a new row of full detail chunks would cost if it was generated on the main thread
+		std::vector<Vertex> vertices;
+		std::vector<int> indices;
+		auto start = std::chrono::high_resolution_clock::now();
+		int rowLength = settings.viewRadius * 2 + 1;
+		for (int i = 0; i < rowLength; i++)
+			TerrainStreamer::GenerateChunk(0, i, settings.chunkSize, settings.maxSubdivision, vertices, indices);
+		double rowSeconds = SecondsSince(start);
+
+		std::cout << "Terrain streaming, " << frames << " frames walking " << kSpeed << " units per second" << std::endl;
+		std::cout << "Main thread: " << totalSeconds / frames * 1000.0 << " ms average, " << maxSeconds * 1000.0 << " ms worst frame" << std::endl;
+		std::cout << "Chunks loaded at the end: " << streamer.LoadedCount() << ", most waiting on workers: " << maxPending << std::endl;
+		std::cout << "Generating one row of " << rowLength << " chunks on the main thread: " << rowSeconds * 1000.0 << " ms" << std::endl;
+	}
+
+	// Smooth normals for a terrain grid on one thread and on every core
+	static void NormalGeneration(int subdivision)
+	{
+		std::vector<Vertex> vertices;
+		std::vector<int> indices;
+		auto start = std::chrono::high_resolution_clock::now();
+		Surface::GenerateSurface(-20.0f, 20.0f, -20.0f, 20.0f, subdivision, vertices, indices);
+		double generationSeconds = SecondsSince(start);
+		std::vector<Vertex> analytic = vertices;
+		std::cout << "Surface subdivision " << subdivision << ", " << vertices.size() << " verts, " << indices.size() / 3 << " triangles" << std::endl;
+		std::cout << "Generation with analytic normals: " << generationSeconds * 1000.0 << " ms" << std::endl;
+
+		start = std::chrono::high_resolution_clock::now();
+		MeshNormals::GenerateSmooth(vertices, indices.data(), indices.size());
+		double singleSeconds = SecondsSince(start);
+		std::vector<Vertex> single = vertices;
+		std::cout << "Averaged normals, 1 thread: " << singleSeconds * 1000.0 << " ms" << std::endl;
+
+		int nThreads = std::max(2u, std::thread::hardware_concurrency());
+		JobSystem jobs(nThreads);
+		start = std::chrono::high_resolution_clock::now();
+		MeshNormals::GenerateSmooth(vertices, indices.data(), indices.size(), 0, &jobs);
+		double threadedSeconds = SecondsSince(start);
+		float maxDifference = 0.0f;
+		for (size_t i = 0; i < vertices.size(); i++)
+		{
+			maxDifference = std::max(maxDifference, fabsf(vertices[i].nx - single[i].nx));
+			maxDifference = std::max(maxDifference, fabsf(vertices[i].ny - single[i].ny));
+			maxDifference = std::max(maxDifference, fabsf(vertices[i].nz - single[i].nz));
+		}
+		std::cout << "Averaged normals, " << nThreads << " threads: " << threadedSeconds * 1000.0 << " ms (" << singleSeconds / threadedSeconds << "x), largest difference " << maxDifference << std::endl;
+
+		// Away from the border the averaged face normals should agree with the exact ones
+		size_t rowLength = static_cast<size_t>(subdivision) + 1;
+		float maxAngle = 0.0f;
+		for (size_t row = 1; row + 1 < rowLength; row++)
+		{
+			for (size_t column = 1; column + 1 < rowLength; column++)
+			{
+				const Vertex& a = analytic[row * rowLength + column];
+				const Vertex& b = single[row * rowLength + column];
+				float cosine = std::min(1.0f, a.nx * b.nx + a.ny * b.ny + a.nz * b.nz);
+				maxAngle = std::max(maxAngle, acosf(cosine));
+			}
+		}
+		std::cout << "Largest angle between analytic and averaged normals: " << maxAngle * 57.2957795f << " degrees" << std::endl;
+	}
+
+	// Evaluate one point on every curve per frame, the copying de Casteljau against the precomputed coefficients and the SIMD batch
+	static void CurveEvaluation(int nCurves, int frames)
+	{
+		std::mt19937 random(7);
+		std::uniform_real_distribution<float> coordinate(-30.0f, 30.0f);
+		std::vector<Curve> curves(nCurves);
+		CurveBatch batch(3);
+		auto start = std::chrono::high_resolution_clock::now();
+		for (Curve& curve : curves)
+		{
+			std::vector<glm::vec2> points(4);
+			for (glm::vec2& point : points)
+				point = glm::vec2(coordinate(random), coordinate(random));
+			curve.setPoints(points);
+			batch.Add(points);
+		}
+		double setupSeconds = SecondsSince(start);
+		std::cout << nCurves << " cubic curves, " << frames << " frames" << std::endl;
+		std::cout << "Coefficients and arc length tables: " << setupSeconds * 1000.0 << " ms" << std::endl;
+
+		// Summed so the evaluations cannot be optimized away
+		glm::vec2 checksum(0.0f);
+		auto timeFrames = [&](const char* name, glm::vec2 (*evaluate)(const Curve&, float))
+		{
+			auto frameStart = std::chrono::high_resolution_clock::now();
+			for (int frame = 0; frame < frames; frame++)
+			{
+				float progress = (frame + 0.5f) / frames;
+				for (const Curve& curve : curves)
+					checksum += evaluate(curve, progress);
+			}
+			double seconds = SecondsSince(frameStart) / frames;
+			std::cout << name << ": " << seconds * 1000.0 << " ms per frame" << std::endl;
+			return seconds;
+		};
+		double legacySeconds = timeFrames("Copying de Casteljau", [](const Curve& curve, float t) { return curve.getBezierPointLegacy(t); });
+		double hornerSeconds = timeFrames("Precomputed coefficients", [](const Curve& curve, float t) { return curve.getBezierPoint(t); });
+		double distanceSeconds = timeFrames("Constant speed (arc length lookup)", [](const Curve& curve, float t) { return curve.getPointAtDistance(t * curve.getLength()); });
+		std::cout << "Speedup: " << legacySeconds / hornerSeconds << "x, " << legacySeconds / distanceSeconds << "x at constant speed" << std::endl;
+
+		// All curves at once, eight per vector step
+		std::vector<float> t(nCurves), x(nCurves), y(nCurves), tangentX(nCurves), tangentY(nCurves);
+		auto timeBatch = [&](const char* name, bool bTangents)
+		{
+			auto frameStart = std::chrono::high_resolution_clock::now();
+			for (int frame = 0; frame < frames; frame++)
+			{
+				std::fill(t.begin(), t.end(), (frame + 0.5f) / frames);
+				batch.Evaluate(t.data(), x.data(), y.data(), bTangents ? tangentX.data() : nullptr, bTangents ? tangentY.data() : nullptr);
+				checksum += glm::vec2(x[frame % nCurves], y[frame % nCurves]);
+			}
+			double seconds = SecondsSince(frameStart) / frames;
+			std::cout << name << ": " << seconds * 1000.0 << " ms per frame (" << hornerSeconds / seconds << "x precomputed)" << std::endl;
+		};
+		timeBatch("Batched", false);
+		timeBatch("Batched with tangents", true);
+		float batchError = 0.0f;
+		for (int i = 0; i < nCurves; i++)
+			batchError = std::max(batchError, glm::length(curves[i].getBezierPoint(t[i]) - glm::vec2(x[i], y[i])));
+		std::cout << "Largest difference between batched and single evaluation: " << batchError << std::endl;
+
+		// How much the distance covered per step varies, stepping evenly in t and evenly in distance
+		// Each step is measured along the curve, a straight line between its ends falls short on tight turns
+		const int kSteps = 1000;
+		const int kSubSteps = 32;
+		auto arcBetween = [](const Curve& curve, float t0, float t1)
+		{
+			float arc = 0.0f;
+			glm::vec2 previous = curve.getBezierPoint(t0);
+			for (int i = 1; i <= kSubSteps; i++)
+			{
+				glm::vec2 current = curve.getBezierPoint(t0 + (t1 - t0) * i / kSubSteps);
+				arc += glm::length(current - previous);
+				previous = current;
+			}
+			return arc;
+		};
+		std::vector<float> tSpeeds, distanceSpeeds;
+		for (int c = 0; c < std::min(nCurves, 1000); c++)
+		{
+			const Curve& curve = curves[c];
+			float average = curve.getLength() / kSteps;
+			for (int i = 0; i < kSteps; i++)
+			{
+				tSpeeds.push_back(arcBetween(curve, static_cast<float>(i) / kSteps, (i + 1.0f) / kSteps) / average);
+				float t0 = curve.getParameterAtDistance(average * i), t1 = curve.getParameterAtDistance(average * (i + 1));
+				distanceSpeeds.push_back(arcBetween(curve, t0, t1) / average);
+			}
+		}
+		std::sort(tSpeeds.begin(), tSpeeds.end());
+		std::sort(distanceSpeeds.begin(), distanceSpeeds.end());
+		size_t low = tSpeeds.size() / 1000, high = tSpeeds.size() - 1 - low;
+		std::cout << "Speed relative to average (p0.1 to p99.9), stepping in t: " << tSpeeds[low] << " to " << tSpeeds[high]
+			<< ", stepping in distance: " << distanceSpeeds[low] << " to " << distanceSpeeds[high] << std::endl;
+		std::cout << "(checksum " << checksum.x + checksum.y << ")" << std::endl;
+	}
+
+	// Sphere against frustum one at a time and in SIMD batches, for spheres scattered around a camera like a large scene
+	static void FrustumCulling(int count)
+	{
+		std::mt19937 random(1234);
+		std::uniform_real_distribution<float> position(-200.0f, 200.0f);
+		std::uniform_real_distribution<float> radius(0.2f, 3.0f);
+		std::vector<float> x(count), y(count), z(count), radii(count);
+		for (int i = 0; i < count; i++)
+		{
+			x[i] = position(random);
+			y[i] = position(random) * 0.05f;
+			z[i] = position(random);
+			radii[i] = radius(random);
+		}
+		glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 2.0f, 0.0f), glm::vec3(1.0f, 2.0f, 0.3f), glm::vec3(0.0f, 1.0f, 0.0f));
+		glm::mat4 projection = glm::perspective(glm::radians(45.0f), 1080.0f / 720.0f, 0.1f, 100.0f);
+		Frustum frustum = Frustum::FromMatrix(projection * view);
+
+		const int kIterations = 20;
+		std::vector<uint8_t> single(count), batched(count);
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int iteration = 0; iteration < kIterations; iteration++)
+		{
+			for (int i = 0; i < count; i++)
+				single[i] = frustum.IsSphereVisible(glm::vec3(x[i], y[i], z[i]), radii[i]) ? 1 : 0;
+		}
+		double singleSeconds = SecondsSince(start) / kIterations;
+
+		start = std::chrono::high_resolution_clock::now();
+		for (int iteration = 0; iteration < kIterations; iteration++)
+			frustum.TestSpheres(x.data(), y.data(), z.data(), radii.data(), batched.data(), count);
+		double batchedSeconds = SecondsSince(start) / kIterations;
+
+		size_t nVisible = 0, nDifferent = 0;
+		for (int i = 0; i < count; i++)
+		{
+			nVisible += batched[i];
+			nDifferent += single[i] != batched[i];
+		}
+		std::cout << count << " spheres, " << nVisible << " visible (" << 100.0 * nVisible / count << "%)" << std::endl;
+		std::cout << "One at a time: " << singleSeconds * 1000.0 << " ms" << std::endl;
+		std::cout << "Batched: " << batchedSeconds * 1000.0 << " ms, " << singleSeconds / batchedSeconds << "x" << std::endl;
+		if (nDifferent > 0) std::cout << "WARNING: " << nDifferent << " spheres differ between the two" << std::endl;
+	}
+
+	// Bounding volume hierarchy against testing every box, for scenes growing to maxItems props spread like the stress trees
+	// Frustum, ray and sphere queries should cost about the same however many props are out of reach
+	static void BoundingVolumeQueries(int maxItems)
+	{
+		glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 2.0f, 0.0f), glm::vec3(1.0f, 2.0f, 0.3f), glm::vec3(0.0f, 1.0f, 0.0f));
+		glm::mat4 projection = glm::perspective(glm::radians(45.0f), 1080.0f / 720.0f, 0.1f, 100.0f);
+		Frustum frustum = Frustum::FromMatrix(projection * view);
+		const int kRays = 1000, kSpheres = 1000;
+
+		for (int nItems = std::max(1, maxItems / 100); nItems <= maxItems; nItems *= 10)
+		{
+			std::mt19937 random(1234);
+			float halfSize = sqrtf(32.0f * nItems) * 0.5f;
+			std::uniform_real_distribution<float> position(-halfSize, halfSize);
+			std::uniform_real_distribution<float> size(0.3f, 2.0f);
+			std::vector<glm::vec3> boundsMin(nItems), boundsMax(nItems);
+			for (int i = 0; i < nItems; i++)
+			{
+				glm::vec3 center(position(random), 0.0f, position(random));
+				float radius = size(random);
+				boundsMin[i] = center - glm::vec3(radius * 0.5f, 0.0f, radius * 0.5f);
+				boundsMax[i] = center + glm::vec3(radius * 0.5f, radius * 2.0f, radius * 0.5f);
+			}
+
+			auto start = std::chrono::high_resolution_clock::now();
+			Bvh tree;
+			tree.Build(boundsMin.data(), boundsMax.data(), nItems);
+			double buildSeconds = SecondsSince(start);
+			start = std::chrono::high_resolution_clock::now();
+			tree.Refit(boundsMin.data(), boundsMax.data());
+			double refitSeconds = SecondsSince(start);
+
+			// Frustum
+			std::vector<uint32_t> flatVisible, treeVisible;
+			start = std::chrono::high_resolution_clock::now();
+			for (int i = 0; i < nItems; i++)
+			{
+				if (frustum.ClassifyBox(boundsMin[i], boundsMax[i]) != Frustum::kOutside) flatVisible.push_back(i);
+			}
+			double flatFrustumSeconds = SecondsSince(start);
+			start = std::chrono::high_resolution_clock::now();
+			tree.QueryFrustum(frustum, treeVisible);
+			double treeFrustumSeconds = SecondsSince(start);
+			std::sort(treeVisible.begin(), treeVisible.end());
+			bool bFrustumSame = treeVisible == flatVisible;
+
+			// Rays along the ground from near the middle, like line of sight checks
+			std::uniform_real_distribution<float> angle(0.0f, 6.2831853f), nearby(-20.0f, 20.0f);
+			std::vector<glm::vec3> rayOrigins(kRays), rayDirections(kRays);
+			for (int ray = 0; ray < kRays; ray++)
+			{
+				float a = angle(random);
+				rayOrigins[ray] = glm::vec3(nearby(random), 1.0f, nearby(random));
+				rayDirections[ray] = glm::vec3(cosf(a), 0.0f, sinf(a));
+			}
+			std::vector<float> flatDistances(kRays, -1.0f), treeDistances(kRays, -1.0f);
+			start = std::chrono::high_resolution_clock::now();
+			for (int ray = 0; ray < kRays; ray++)
+			{
+				glm::vec3 inverse = 1.0f / glm::vec3(rayDirections[ray].x, 1e-30f, rayDirections[ray].z);
+				float nearest = 100.0f;
+				for (int i = 0; i < nItems; i++)
+				{
+					glm::vec3 t1 = (boundsMin[i] - rayOrigins[ray]) * inverse, t2 = (boundsMax[i] - rayOrigins[ray]) * inverse;
+					glm::vec3 tNear = glm::min(t1, t2), tFar = glm::max(t1, t2);
+					float entry = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+					float exit = std::min(std::min(tFar.x, tFar.y), tFar.z);
+					if (entry <= exit && entry < nearest)
+					{
+						nearest = entry;
+						flatDistances[ray] = entry;
+					}
+				}
+			}
+			double flatRaySeconds = SecondsSince(start) / kRays;
+			start = std::chrono::high_resolution_clock::now();
+			for (int ray = 0; ray < kRays; ray++)
+			{
+				Bvh::RayHit hit;
+				if (tree.Raycast(rayOrigins[ray], rayDirections[ray], 100.0f, hit)) treeDistances[ray] = hit.distance;
+			}
+			double treeRaySeconds = SecondsSince(start) / kRays;
+			int nRayDifferences = 0;
+			for (int ray = 0; ray < kRays; ray++)
+				nRayDifferences += std::fabs(flatDistances[ray] - treeDistances[ray]) > 1e-3f;
+
+			// Spheres of radius 10 around points near the middle
+			size_t flatOverlaps = 0, treeOverlaps = 0;
+			std::vector<glm::vec3> sphereCenters(kSpheres);
+			for (glm::vec3& center : sphereCenters)
+				center = glm::vec3(nearby(random), 1.0f, nearby(random));
+			start = std::chrono::high_resolution_clock::now();
+			for (const glm::vec3& center : sphereCenters)
+			{
+				for (int i = 0; i < nItems; i++)
+				{
+					glm::vec3 outside = glm::max(glm::max(boundsMin[i] - center, center - boundsMax[i]), glm::vec3(0.0f));
+					flatOverlaps += glm::dot(outside, outside) <= 100.0f;
+				}
+			}
+			double flatSphereSeconds = SecondsSince(start) / kSpheres;
+			std::vector<uint32_t> overlaps;
+			start = std::chrono::high_resolution_clock::now();
+			for (const glm::vec3& center : sphereCenters)
+			{
+				overlaps.clear();
+				tree.QuerySphere(center, 10.0f, overlaps);
+				treeOverlaps += overlaps.size();
+			}
+			double treeSphereSeconds = SecondsSince(start) / kSpheres;
+
+			std::cout << nItems << " props, " << tree.NodeCount() << " nodes, build " << buildSeconds * 1000.0 << " ms, refit " << refitSeconds * 1000.0 << " ms" << std::endl;
+			std::cout << "  Frustum: every box " << flatFrustumSeconds * 1000.0 << " ms, tree " << treeFrustumSeconds * 1000.0 << " ms, "
+				<< treeVisible.size() << " visible" << (bFrustumSame ? "" : " (RESULTS DIFFER)") << std::endl;
+			std::cout << "  Ray: every box " << flatRaySeconds * 1e6 << " us, tree " << treeRaySeconds * 1e6 << " us"
+				<< (nRayDifferences == 0 ? "" : " (RESULTS DIFFER)") << std::endl;
+			std::cout << "  Sphere: every box " << flatSphereSeconds * 1e6 << " us, tree " << treeSphereSeconds * 1e6 << " us, "
+				<< static_cast<double>(treeOverlaps) / kSpheres << " overlaps" << (flatOverlaps == treeOverlaps ? "" : " (RESULTS DIFFER)") << std::endl;
+			if (nItems > maxItems / 10) break;
+		}
+	}
+
+	// Load a level, build the world around it and run it for a number of ticks with no window or GL context
+	// Everything loading prints is swallowed, stdout is one JSON object with the time each phase took
+	// Returns the process exit code
+	static int Headless(const std::string& levelFile, int ticks, int numStressTrees)
+	{
+		if (!std::ifstream(levelFile))
+		{
+			std::cout << "{ \"error\": \"could not open level " << levelFile << "\" }" << std::endl;
+			return 1;
+		}
+		ticks = std::max(ticks, 1);
+
+		NullBuffer nullBuffer;
+		std::streambuf* coutBuffer = std::cout.rdbuf(&nullBuffer);
+
+		// Level, meshes and entities
+		auto start = std::chrono::high_resolution_clock::now();
+		MeshRegistry meshes;
+		EntityStore entities;
+		Level level(levelFile, meshes, entities);
+		World world(meshes, entities, 1.0f / 60.0f);
+		world.Populate(numStressTrees);
+		double loadSeconds = SecondsSince(start);
+
+		// The terrain the player starts on, everything in view generated like a loading screen would wait for it
+		start = std::chrono::high_resolution_clock::now();
+		TerrainStreamerSettings terrainSettings;
+		terrainSettings.bUploadToGpu = false;
+		TerrainStreamer terrain(meshes, terrainSettings);
+		glm::vec3 playerPosition(entities.x[world.Player()], entities.y[world.Player()], entities.z[world.Player()]);
+		do
+		{
+			terrain.Update(playerPosition);
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+		} while (terrain.LoadedCount() == 0 || terrain.PendingCount() > 0);
+		double generateSeconds = SecondsSince(start);
+
+		std::cout.rdbuf(coutBuffer);
+
+		JobSystem jobs;
+		const TaskGraph& tasks = world.TickTasks();
+		std::vector<double> tickSeconds(ticks);
+		std::vector<double> taskTotal(tasks.TaskCount(), 0.0), taskMax(tasks.TaskCount(), 0.0);
+		size_t totalContacts = 0;
+		for (int tick = 0; tick < ticks; tick++)
+		{
+			start = std::chrono::high_resolution_clock::now();
+			world.Tick(jobs);
+			tickSeconds[tick] = SecondsSince(start);
+			for (TaskId id = 0; id < tasks.TaskCount(); id++)
+			{
+				taskTotal[id] += tasks.Seconds(id);
+				taskMax[id] = std::max(taskMax[id], tasks.Seconds(id));
+			}
+			totalContacts += world.Collisions().Contacts().size();
+		}
+
+		std::vector<double> sortedTicks = tickSeconds;
+		std::sort(sortedTicks.begin(), sortedTicks.end());
+		double tickTotal = 0.0;
+		for (double seconds : tickSeconds)
+			tickTotal += seconds;
+		auto milliseconds = [](double seconds) { return seconds * 1000.0; };
+
+		// Times in milliseconds, tasks are the stages of a tick in the order they were added
+		std::cout << std::fixed << std::setprecision(4);
+		std::cout << "{" << std::endl;
+		std::cout << "  \"level\": \"" << levelFile << "\"," << std::endl;
+		std::cout << "  \"entities\": " << entities.Count() << "," << std::endl;
+		std::cout << "  \"threads\": " << jobs.ThreadCount() << "," << std::endl;
+		std::cout << "  \"ticks\": " << ticks << "," << std::endl;
+		std::cout << "  \"load_ms\": " << milliseconds(loadSeconds) << "," << std::endl;
+		std::cout << "  \"generate_ms\": " << milliseconds(generateSeconds) << "," << std::endl;
+		std::cout << "  \"terrain_chunks\": " << terrain.LoadedCount() << "," << std::endl;
+		std::cout << "  \"tick_ms\": { \"mean\": " << milliseconds(tickTotal / ticks)
+			<< ", \"median\": " << milliseconds(sortedTicks[ticks / 2])
+			<< ", \"p95\": " << milliseconds(sortedTicks[std::min(ticks - 1, ticks * 95 / 100)])
+			<< ", \"max\": " << milliseconds(sortedTicks.back()) << " }," << std::endl;
+		std::cout << "  \"tasks\": [" << std::endl;
+		for (TaskId id = 0; id < tasks.TaskCount(); id++)
+		{
+			std::cout << "    { \"name\": \"" << tasks.Name(id) << "\", \"mean_ms\": " << milliseconds(taskTotal[id] / ticks)
+				<< ", \"max_ms\": " << milliseconds(taskMax[id]) << " }" << (id + 1 < tasks.TaskCount() ? "," : "") << std::endl;
+		}
+		std::cout << "  ]," << std::endl;
+		std::cout << "  \"contacts_per_tick\": " << static_cast<double>(totalContacts) / ticks << std::endl;
+		std::cout << "}" << std::endl;
+		return 0;
+	}
+};
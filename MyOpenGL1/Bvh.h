@@ -0,0 +1,388 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Frustum.h"
+
+// Bounding volume hierarchy over axis aligned boxes, for frustum, ray and sphere queries that only look at nearby items
+// Built top down with the surface area heuristic over binned centroids, items are the indices of the boxes it was built from
+// When the boxes move but stay roughly where they were, Refit updates the bounds without changing the tree
+class Bvh
+{
+public:
+	static constexpr int kBins = 16;
+	// Nodes with this many items or fewer become leaves when splitting them does not pay off
+	static constexpr int kMaxLeafItems = 8;
+
+	struct RayHit
+	{
+		uint32_t item = 0;
+		// Along the ray, where it enters the item's box, 0 if it starts inside
+		float distance = 0.0f;
+	};
+
+	// Build over count boxes, item i is the box boundsMin[i], boundsMax[i]
+	void Build(const glm::vec3* boundsMin, const glm::vec3* boundsMax, size_t count)
+	{
+		itemMin.assign(boundsMin, boundsMin + count);
+		itemMax.assign(boundsMax, boundsMax + count);
+		items.resize(count);
+		std::vector<glm::vec3> centroids(count);
+		for (size_t i = 0; i < count; i++)
+		{
+			items[i] = static_cast<uint32_t>(i);
+			centroids[i] = (boundsMin[i] + boundsMax[i]) * 0.5f;
+		}
+
+		nodes.clear();
+		if (count == 0) return;
+		// A binary tree with one item per leaf at most has 2 * count - 1 nodes, so references into nodes stay valid
+		nodes.reserve(2 * count);
+		Node root;
+		root.first = 0;
+		root.count = static_cast<uint32_t>(count);
+		nodes.push_back(root);
+
+		// Node and its depth
+		std::vector<std::pair<uint32_t, int>> stack(1, std::make_pair(0u, 0));
+		while (!stack.empty())
+		{
+			uint32_t index = stack.back().first;
+			int depth = stack.back().second;
+			stack.pop_back();
+			UpdateLeafBounds(nodes[index]);
+			uint32_t left;
+			if (depth + 1 < kMaxDepth && Split(index, centroids, left))
+			{
+				stack.push_back(std::make_pair(left, depth + 1));
+				stack.push_back(std::make_pair(left + 1, depth + 1));
+			}
+		}
+		// Interior bounds from the children, so they are exactly the union of what is below
+		Refit();
+	}
+
+	// Boxes moved, update every node's bounds to fit them again, count must be the same as when built
+	void Refit(const glm::vec3* boundsMin, const glm::vec3* boundsMax)
+	{
+		std::copy(boundsMin, boundsMin + itemMin.size(), itemMin.begin());
+		std::copy(boundsMax, boundsMax + itemMax.size(), itemMax.begin());
+		Refit();
+	}
+
+	size_t ItemCount() const { return items.size(); }
+	size_t NodeCount() const { return nodes.size(); }
+
+	// Append every item whose box may be inside the frustum to out
+	void QueryFrustum(const Frustum& frustum, std::vector<uint32_t>& out) const
+	{
+		if (nodes.empty()) return;
+		uint32_t stack[kMaxDepth + 1];
+		size_t stackSize = 0;
+		stack[stackSize++] = 0;
+		while (stackSize > 0)
+		{
+			const Node& node = nodes[stack[--stackSize]];
+			Frustum::Containment containment = frustum.ClassifyBox(node.boundsMin, node.boundsMax);
+			if (containment == Frustum::kOutside) continue;
+			// Everything under a node that is entirely inside is inside too, its items are next to each other
+			if (containment == Frustum::kInside)
+			{
+				out.insert(out.end(), items.begin() + node.first, items.begin() + node.first + node.count);
+				continue;
+			}
+			if (node.left == 0)
+			{
+				// The spheres around the boxes rule out most items outside in SIMD batches, the boxes decide for the rest
+				uint8_t visible[kLeafBatch];
+				for (uint32_t batch = node.first; batch < node.first + node.count; batch += kLeafBatch)
+				{
+					uint32_t batchCount = std::min<uint32_t>(kLeafBatch, node.first + node.count - batch);
+					frustum.TestSpheres(sphereX.data() + batch, sphereY.data() + batch, sphereZ.data() + batch, sphereRadius.data() + batch, visible, batchCount);
+					for (uint32_t i = 0; i < batchCount; i++)
+					{
+						uint32_t item = items[batch + i];
+						if (visible[i] && frustum.ClassifyBox(itemMin[item], itemMax[item]) != Frustum::kOutside) out.push_back(item);
+					}
+				}
+				continue;
+			}
+			stack[stackSize++] = node.left;
+			stack[stackSize++] = node.left + 1;
+		}
+	}
+
+	// Append every item whose box overlaps the sphere to out
+	void QuerySphere(const glm::vec3& center, float radius, std::vector<uint32_t>& out) const
+	{
+		if (nodes.empty()) return;
+		float radiusSquared = radius * radius;
+		uint32_t stack[kMaxDepth + 1];
+		size_t stackSize = 0;
+		stack[stackSize++] = 0;
+		while (stackSize > 0)
+		{
+			const Node& node = nodes[stack[--stackSize]];
+			if (DistanceSquared(center, node.boundsMin, node.boundsMax) > radiusSquared) continue;
+			if (node.left == 0)
+			{
+				for (uint32_t i = node.first; i < node.first + node.count; i++)
+				{
+					if (DistanceSquared(center, itemMin[items[i]], itemMax[items[i]]) <= radiusSquared) out.push_back(items[i]);
+				}
+				continue;
+			}
+			stack[stackSize++] = node.left;
+			stack[stackSize++] = node.left + 1;
+		}
+	}
+
+	// Nearest item box the ray enters within maxDistance, direction does not need to be unit length
+	// Distances are in multiples of direction
+	bool Raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, RayHit& hit) const
+	{
+		return Raycast(origin, direction, maxDistance, hit, [](uint32_t) { return false; });
+	}
+
+	// As above, passing over the items bSkip(item) is true for, like the one the ray starts in
+	template <typename SkipFunction>
+	bool Raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, RayHit& hit, SkipFunction bSkip) const
+	{
+		if (nodes.empty()) return false;
+		glm::vec3 inverseDirection;
+		for (int axis = 0; axis < 3; axis++)
+			inverseDirection[axis] = std::fabs(direction[axis]) > 1e-12f ? 1.0f / direction[axis] : 1e30f;
+
+		bool bHit = false;
+		float nearest = maxDistance;
+		uint32_t stack[kMaxDepth + 1];
+		size_t stackSize = 0;
+		stack[stackSize++] = 0;
+		while (stackSize > 0)
+		{
+			const Node& node = nodes[stack[--stackSize]];
+			float entry;
+			if (!RayEntersBox(origin, inverseDirection, node.boundsMin, node.boundsMax, nearest, entry)) continue;
+			if (node.left == 0)
+			{
+				for (uint32_t i = node.first; i < node.first + node.count; i++)
+				{
+					if (bSkip(items[i])) continue;
+					if (!RayEntersBox(origin, inverseDirection, itemMin[items[i]], itemMax[items[i]], nearest, entry)) continue;
+					nearest = entry;
+					hit.item = items[i];
+					hit.distance = entry;
+					bHit = true;
+				}
+				continue;
+			}
+			// Nearer child on top, so its hits can rule out the farther one
+			float leftEntry = 0.0f, rightEntry = 0.0f;
+			bool bLeft = RayEntersBox(origin, inverseDirection, nodes[node.left].boundsMin, nodes[node.left].boundsMax, nearest, leftEntry);
+			bool bRight = RayEntersBox(origin, inverseDirection, nodes[node.left + 1].boundsMin, nodes[node.left + 1].boundsMax, nearest, rightEntry);
+			if (bLeft && bRight)
+			{
+				bool bLeftFirst = leftEntry <= rightEntry;
+				stack[stackSize++] = bLeftFirst ? node.left + 1 : node.left;
+				stack[stackSize++] = bLeftFirst ? node.left : node.left + 1;
+			}
+			else if (bLeft) stack[stackSize++] = node.left;
+			else if (bRight) stack[stackSize++] = node.left + 1;
+		}
+		return bHit;
+	}
+
+private:
+	// Nodes this deep are not split any more, so a traversal stack of one waiting sibling per level is enough
+	enum { kMaxDepth = 64 };
+	// Leaf items are sphere tested this many at a time, leaves at kMaxDepth can hold more than kMaxLeafItems
+	enum { kLeafBatch = 64 };
+
+	struct Node
+	{
+		glm::vec3 boundsMin = glm::vec3(0.0f), boundsMax = glm::vec3(0.0f);
+		// Items [first, first + count) of items are under this node
+		uint32_t first = 0, count = 0;
+		// Children are left and left + 1, 0 for a leaf since the root is nobody's child
+		uint32_t left = 0;
+	};
+
+	struct Bin
+	{
+		glm::vec3 boundsMin = glm::vec3(1e30f), boundsMax = glm::vec3(-1e30f);
+		uint32_t count = 0;
+	};
+
+	static float HalfArea(const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+	{
+		glm::vec3 extent = glm::max(boundsMax - boundsMin, glm::vec3(0.0f));
+		return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+	}
+
+	void UpdateLeafBounds(Node& node) const
+	{
+		node.boundsMin = glm::vec3(1e30f);
+		node.boundsMax = glm::vec3(-1e30f);
+		for (uint32_t i = node.first; i < node.first + node.count; i++)
+		{
+			node.boundsMin = glm::min(node.boundsMin, itemMin[items[i]]);
+			node.boundsMax = glm::max(node.boundsMax, itemMax[items[i]]);
+		}
+	}
+
+	// Bounding sphere of every item's box, in the order of items so a leaf's spheres are next to each other
+	// A little larger than the box needs, so rounding never has a sphere ruled out when ClassifyBox would keep its box
+	void UpdateItemSpheres()
+	{
+		sphereX.resize(items.size());
+		sphereY.resize(items.size());
+		sphereZ.resize(items.size());
+		sphereRadius.resize(items.size());
+		for (size_t i = 0; i < items.size(); i++)
+		{
+			glm::vec3 center = (itemMin[items[i]] + itemMax[items[i]]) * 0.5f;
+			sphereX[i] = center.x;
+			sphereY[i] = center.y;
+			sphereZ[i] = center.z;
+			sphereRadius[i] = glm::length(itemMax[items[i]] - center) * 1.001f + 1e-4f;
+		}
+	}
+
+	// Children were added after their parents, so going backwards every child is done before its parent
+	void Refit()
+	{
+		UpdateItemSpheres();
+		for (size_t index = nodes.size(); index-- > 0;)
+		{
+			Node& node = nodes[index];
+			if (node.left == 0)
+			{
+				UpdateLeafBounds(node);
+				continue;
+			}
+			node.boundsMin = glm::min(nodes[node.left].boundsMin, nodes[node.left + 1].boundsMin);
+			node.boundsMax = glm::max(nodes[node.left].boundsMax, nodes[node.left + 1].boundsMax);
+		}
+	}
+
+	// Split a node where the surface area heuristic says it is cheapest, false if it stays a leaf
+	// The cost of a split is the area of each side times its items, against the node's area times all its items
+	bool Split(uint32_t index, const std::vector<glm::vec3>& centroids, uint32_t& left)
+	{
+		Node& node = nodes[index];
+		if (node.count <= 1) return false;
+
+		glm::vec3 centroidMin(1e30f), centroidMax(-1e30f);
+		for (uint32_t i = node.first; i < node.first + node.count; i++)
+		{
+			centroidMin = glm::min(centroidMin, centroids[items[i]]);
+			centroidMax = glm::max(centroidMax, centroids[items[i]]);
+		}
+
+		float bestCost = 1e30f;
+		int bestAxis = -1, bestSplit = 0;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float extent = centroidMax[axis] - centroidMin[axis];
+			if (extent <= 0.0f) continue;
+			float scale = static_cast<float>(kBins) / extent;
+			Bin bins[kBins];
+			for (uint32_t i = node.first; i < node.first + node.count; i++)
+			{
+				uint32_t item = items[i];
+				Bin& bin = bins[BinIndex(centroids[item][axis], centroidMin[axis], scale)];
+				bin.count++;
+				bin.boundsMin = glm::min(bin.boundsMin, itemMin[item]);
+				bin.boundsMax = glm::max(bin.boundsMax, itemMax[item]);
+			}
+
+			// Cost of everything left of each split, then add the right side sweeping back
+			float leftCost[kBins - 1];
+			glm::vec3 sweepMin(1e30f), sweepMax(-1e30f);
+			uint32_t sweepCount = 0;
+			for (int split = 0; split < kBins - 1; split++)
+			{
+				sweepCount += bins[split].count;
+				sweepMin = glm::min(sweepMin, bins[split].boundsMin);
+				sweepMax = glm::max(sweepMax, bins[split].boundsMax);
+				leftCost[split] = sweepCount * HalfArea(sweepMin, sweepMax);
+			}
+			sweepMin = glm::vec3(1e30f);
+			sweepMax = glm::vec3(-1e30f);
+			sweepCount = 0;
+			for (int split = kBins - 1; split > 0; split--)
+			{
+				sweepCount += bins[split].count;
+				sweepMin = glm::min(sweepMin, bins[split].boundsMin);
+				sweepMax = glm::max(sweepMax, bins[split].boundsMax);
+				if (sweepCount == 0 || sweepCount == node.count) continue;
+				float cost = leftCost[split - 1] + sweepCount * HalfArea(sweepMin, sweepMax);
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					bestAxis = axis;
+					bestSplit = split;
+				}
+			}
+		}
+
+		// Every centroid in the same place, nothing to split on
+		if (bestAxis < 0) return false;
+		// Splitting also costs testing the two children when the node is reached, about two item tests
+		float area = HalfArea(node.boundsMin, node.boundsMax);
+		if (node.count <= kMaxLeafItems && bestCost + 2.0f * area >= node.count * area) return false;
+
+		// Items in bins below the split to the front
+		float scale = static_cast<float>(kBins) / (centroidMax[bestAxis] - centroidMin[bestAxis]);
+		uint32_t* begin = items.data() + node.first;
+		uint32_t* middle = std::partition(begin, begin + node.count, [&](uint32_t item)
+		{
+			return BinIndex(centroids[item][bestAxis], centroidMin[bestAxis], scale) < bestSplit;
+		});
+		uint32_t leftCount = static_cast<uint32_t>(middle - begin);
+
+		left = static_cast<uint32_t>(nodes.size());
+		Node leftNode, rightNode;
+		leftNode.first = node.first;
+		leftNode.count = leftCount;
+		rightNode.first = node.first + leftCount;
+		rightNode.count = node.count - leftCount;
+		node.left = left;
+		nodes.push_back(leftNode);
+		nodes.push_back(rightNode);
+		return true;
+	}
+
+	static int BinIndex(float centroid, float centroidMin, float scale)
+	{
+		return std::min(kBins - 1, static_cast<int>((centroid - centroidMin) * scale));
+	}
+
+	static float DistanceSquared(const glm::vec3& point, const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+	{
+		glm::vec3 outside = glm::max(glm::max(boundsMin - point, point - boundsMax), glm::vec3(0.0f));
+		return glm::dot(outside, outside);
+	}
+
+	// Slab test, entry is where the ray enters the box, or 0 if it starts inside
+	static bool RayEntersBox(const glm::vec3& origin, const glm::vec3& inverseDirection, const glm::vec3& boundsMin, const glm::vec3& boundsMax, float maxDistance, float& entry)
+	{
+		glm::vec3 t1 = (boundsMin - origin) * inverseDirection;
+		glm::vec3 t2 = (boundsMax - origin) * inverseDirection;
+		glm::vec3 tNear = glm::min(t1, t2), tFar = glm::max(t1, t2);
+		entry = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+		float exit = std::min(std::min(tFar.x, tFar.y), tFar.z);
+		return entry <= exit && entry < maxDistance;
+	}
+
+	std::vector<Node> nodes;
+	std::vector<uint32_t> items;
+	std::vector<glm::vec3> itemMin, itemMax;
+	std::vector<float> sphereX, sphereY, sphereZ, sphereRadius;
+};
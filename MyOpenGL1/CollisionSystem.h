@@ -0,0 +1,405 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "EntityStore.h"
+
+// Overlap between a dynamic entity and another collider, on the XZ plane
+struct Contact
+{
+	EntityId self;
+	EntityId other;
+	// Points away from other, moving self by normal * depth separates the two
+	glm::vec2 normal;
+	float depth;
+};
+
+// Collides every dynamic entity against every other collider each frame
+// Broad phase: static colliders come from the EntityStore's grid, dynamic ones are counting sorted into a fresh hash grid every frame
+// Narrow phase: circle-circle, circle-AABB and AABB-AABB, boxes are the XZ part of the entity's BoxCollisionDef
+class CollisionSystem
+{
+public:
+	// Cells of the dynamic grid are never smaller than minCellSize, and grow to fit the largest dynamic collider
+	explicit CollisionSystem(float minCellSize = 1.0f) : minCellSize(minCellSize) {}
+
+	// Find this frame's contacts and push dynamic entities apart
+	// Dynamic pairs each move half the overlap, against static colliders the dynamic entity moves all of it
+	void Update(EntityStore& store)
+	{
+		BeginUpdate(store);
+		for (size_t task = 0; task < TaskCount(); task++)
+			FindContacts(store, task);
+		EndUpdate(store);
+	}
+
+	// Update split in three, so the contact search can be spread over threads
+	// FindContacts may run for different tasks at the same time, the three steps must not overlap
+	// The result is the same as Update's however the tasks are run
+	void BeginUpdate(const EntityStore& store)
+	{
+		GatherDynamics(store);
+		BuildDynamicGrid();
+		batches.resize(TaskCount());
+	}
+
+	// Tasks of kDynamicsPerTask dynamic entities each, valid after BeginUpdate
+	size_t TaskCount() const { return (dynamics.size() + kDynamicsPerTask - 1) / kDynamicsPerTask; }
+
+	void FindContacts(const EntityStore& store, size_t task)
+	{
+		ContactBatch& batch = batches[task];
+		batch.contacts.clear();
+		batch.pairsTested = 0;
+		uint32_t end = static_cast<uint32_t>(std::min(dynamics.size(), (task + 1) * kDynamicsPerTask));
+		for (uint32_t i = static_cast<uint32_t>(task * kDynamicsPerTask); i < end; i++)
+		{
+			FindDynamicContacts(i, batch);
+			FindStaticContacts(store, i, batch);
+		}
+	}
+
+	void EndUpdate(EntityStore& store)
+	{
+		pairsTested = 0;
+		for (const ContactBatch& batch : batches)
+			pairsTested += batch.pairsTested;
+		SortContactsByEntity();
+		ResolveContacts(store);
+	}
+
+	// Contacts of a dynamic entity from the last Update, empty for other entities
+	const Contact* ContactsBegin(EntityId id) const { return contacts.data() + ContactStart(id, 0); }
+	const Contact* ContactsEnd(EntityId id) const { return contacts.data() + ContactStart(id, 1); }
+
+	const std::vector<Contact>& Contacts() const { return contacts; }
+	size_t DynamicCount() const { return dynamics.size(); }
+	size_t PairsTested() const { return pairsTested; }
+
+private:
+	enum ShapeType : uint8_t { kShapeNone, kShapeCircle, kShapeBox };
+	enum : uint32_t { kNotDynamic = ~0u };
+	enum { kDynamicsPerTask = 256 };
+
+	struct Shape
+	{
+		ShapeType type;
+		float x, z;
+		float radius;
+		float minX, maxX, minZ, maxZ;
+	};
+
+	// Contacts found by one task, in the order a single thread would find them
+	struct ContactBatch
+	{
+		std::vector<Contact> contacts;
+		std::vector<unsigned int> nearbyStatics;
+		size_t pairsTested = 0;
+	};
+
+	// Boxes win over circles when an entity has both
+	static Shape MakeShape(const EntityStore& store, EntityId id)
+	{
+		Shape shape;
+		shape.x = store.x[id];
+		shape.z = store.z[id];
+		shape.radius = store.radius[id];
+		if (store.flags[id] & EntityStore::kFlagBoxCollision)
+		{
+			WorldCollision bounds = store.GetWorldCollision(id);
+			shape.type = kShapeBox;
+			shape.minX = std::min(bounds.x1, bounds.x2);
+			shape.maxX = std::max(bounds.x1, bounds.x2);
+			shape.minZ = std::min(bounds.z1, bounds.z2);
+			shape.maxZ = std::max(bounds.z1, bounds.z2);
+			// The box does not have to be centered on the entity
+			shape.x = (shape.minX + shape.maxX) * 0.5f;
+			shape.z = (shape.minZ + shape.maxZ) * 0.5f;
+		}
+		else if ((store.flags[id] & (EntityStore::kFlagRadiusCollision | EntityStore::kFlagRadiusTrigger)) && shape.radius > 0.0f)
+		{
+			shape.type = kShapeCircle;
+			shape.minX = shape.x - shape.radius;
+			shape.maxX = shape.x + shape.radius;
+			shape.minZ = shape.z - shape.radius;
+			shape.maxZ = shape.z + shape.radius;
+		}
+		else
+		{
+			shape.type = kShapeNone;
+		}
+		return shape;
+	}
+
+	static bool CircleCircle(const Shape& a, const Shape& b, glm::vec2& normal, float& depth)
+	{
+		float differenceX = a.x - b.x;
+		float differenceZ = a.z - b.z;
+		float contactDistance = a.radius + b.radius;
+		float distanceSquared = differenceX * differenceX + differenceZ * differenceZ;
+		if (distanceSquared >= contactDistance * contactDistance) return false;
+
+		float distance = sqrtf(distanceSquared);
+		normal = distance > 0.0f ? glm::vec2(differenceX, differenceZ) / distance : glm::vec2(1.0f, 0.0f);
+		depth = contactDistance - distance;
+		return true;
+	}
+
+	// Normal points from the box towards the circle
+	static bool CircleBox(const Shape& circle, const Shape& box, glm::vec2& normal, float& depth)
+	{
+		float closestX = std::min(std::max(circle.x, box.minX), box.maxX);
+		float closestZ = std::min(std::max(circle.z, box.minZ), box.maxZ);
+		float differenceX = circle.x - closestX;
+		float differenceZ = circle.z - closestZ;
+		float distanceSquared = differenceX * differenceX + differenceZ * differenceZ;
+		if (distanceSquared >= circle.radius * circle.radius) return false;
+
+		if (distanceSquared > 0.0f)
+		{
+			float distance = sqrtf(distanceSquared);
+			normal = glm::vec2(differenceX, differenceZ) / distance;
+			depth = circle.radius - distance;
+			return true;
+		}
+
+		// Center inside the box, leave through the nearest side
+		float left = circle.x - box.minX, right = box.maxX - circle.x;
+		float back = circle.z - box.minZ, front = box.maxZ - circle.z;
+		float nearest = std::min(std::min(left, right), std::min(back, front));
+		if (nearest == left) normal = glm::vec2(-1.0f, 0.0f);
+		else if (nearest == right) normal = glm::vec2(1.0f, 0.0f);
+		else if (nearest == back) normal = glm::vec2(0.0f, -1.0f);
+		else normal = glm::vec2(0.0f, 1.0f);
+		depth = nearest + circle.radius;
+		return true;
+	}
+
+	static bool BoxBox(const Shape& a, const Shape& b, glm::vec2& normal, float& depth)
+	{
+		float overlapX = std::min(a.maxX, b.maxX) - std::max(a.minX, b.minX);
+		float overlapZ = std::min(a.maxZ, b.maxZ) - std::max(a.minZ, b.minZ);
+		if (overlapX <= 0.0f || overlapZ <= 0.0f) return false;
+
+		// Separate along the axis with the least overlap
+		if (overlapX < overlapZ)
+		{
+			normal = glm::vec2((a.minX + a.maxX) >= (b.minX + b.maxX) ? 1.0f : -1.0f, 0.0f);
+			depth = overlapX;
+		}
+		else
+		{
+			normal = glm::vec2(0.0f, (a.minZ + a.maxZ) >= (b.minZ + b.maxZ) ? 1.0f : -1.0f);
+			depth = overlapZ;
+		}
+		return true;
+	}
+
+	// Normal points from b towards a
+	static bool Collide(const Shape& a, const Shape& b, glm::vec2& normal, float& depth)
+	{
+		if (a.maxX <= b.minX || b.maxX <= a.minX || a.maxZ <= b.minZ || b.maxZ <= a.minZ) return false;
+
+		if (a.type == kShapeCircle && b.type == kShapeCircle) return CircleCircle(a, b, normal, depth);
+		if (a.type == kShapeCircle && b.type == kShapeBox) return CircleBox(a, b, normal, depth);
+		if (a.type == kShapeBox && b.type == kShapeCircle)
+		{
+			if (!CircleBox(b, a, normal, depth)) return false;
+			normal = -normal;
+			return true;
+		}
+		return BoxBox(a, b, normal, depth);
+	}
+
+	void GatherDynamics(const EntityStore& store)
+	{
+		dynamics.clear();
+		shapes.clear();
+		dynamicIndexOf.assign(store.Count(), kNotDynamic);
+		maxDynamicExtent = 0.0f;
+		for (EntityId id = 0; id < store.Count(); id++)
+		{
+			if ((store.flags[id] & EntityStore::kFlagDynamic) == 0) continue;
+			Shape shape = MakeShape(store, id);
+			if (shape.type == kShapeNone) continue;
+
+			dynamicIndexOf[id] = static_cast<uint32_t>(dynamics.size());
+			dynamics.push_back(id);
+			shapes.push_back(shape);
+			maxDynamicExtent = std::max(maxDynamicExtent, std::max(shape.maxX - shape.minX, shape.maxZ - shape.minZ) * 0.5f);
+		}
+	}
+
+	// Counting sort of the dynamic entities into hashed cells
+	// Cells are at least as big as the largest dynamic collider, so overlapping pairs are always in neighbouring cells
+	void BuildDynamicGrid()
+	{
+		cellSize = std::max(minCellSize, maxDynamicExtent * 2.0f);
+		inverseCellSize = 1.0f / cellSize;
+
+		uint32_t bucketCount = 1;
+		while (bucketCount < dynamics.size() * 2) bucketCount *= 2;
+		bucketMask = bucketCount - 1;
+
+		bucketStart.assign(bucketCount + 1, 0);
+		bucketOf.resize(dynamics.size());
+		for (uint32_t i = 0; i < dynamics.size(); i++)
+		{
+			bucketOf[i] = Bucket(CellCoord(shapes[i].x), CellCoord(shapes[i].z));
+			bucketStart[bucketOf[i] + 1]++;
+		}
+		for (uint32_t bucket = 0; bucket < bucketCount; bucket++)
+			bucketStart[bucket + 1] += bucketStart[bucket];
+
+		bucketFill.assign(bucketStart.begin(), bucketStart.end() - 1);
+		bucketEntries.resize(dynamics.size());
+		for (uint32_t i = 0; i < dynamics.size(); i++)
+			bucketEntries[bucketFill[bucketOf[i]]++] = i;
+	}
+
+	// Tests each dynamic pair once, from the entity with the lower index
+	void FindDynamicContacts(uint32_t i, ContactBatch& batch) const
+	{
+		int cellX = CellCoord(shapes[i].x);
+		int cellZ = CellCoord(shapes[i].z);
+
+		// Different cells can hash to the same bucket, never visit one twice
+		uint32_t visited[9];
+		int nVisited = 0;
+		for (int offsetX = -1; offsetX <= 1; offsetX++)
+		{
+			for (int offsetZ = -1; offsetZ <= 1; offsetZ++)
+			{
+				uint32_t bucket = Bucket(cellX + offsetX, cellZ + offsetZ);
+				if (std::find(visited, visited + nVisited, bucket) != visited + nVisited) continue;
+				visited[nVisited++] = bucket;
+
+				for (uint32_t entry = bucketStart[bucket]; entry < bucketStart[bucket + 1]; entry++)
+				{
+					uint32_t j = bucketEntries[entry];
+					if (j <= i) continue;
+					batch.pairsTested++;
+
+					glm::vec2 normal;
+					float depth;
+					if (!Collide(shapes[i], shapes[j], normal, depth)) continue;
+					batch.contacts.push_back(Contact{ dynamics[i], dynamics[j], normal, depth });
+					batch.contacts.push_back(Contact{ dynamics[j], dynamics[i], -normal, depth });
+				}
+			}
+		}
+	}
+
+	void FindStaticContacts(const EntityStore& store, uint32_t i, ContactBatch& batch) const
+	{
+		const Shape& shape = shapes[i];
+		// The grid widens the search by the largest static collider itself
+		float halfX = std::max(shape.maxX - shape.x, shape.x - shape.minX);
+		float halfZ = std::max(shape.maxZ - shape.z, shape.z - shape.minZ);
+		batch.nearbyStatics.clear();
+		store.ColliderGrid().Query(shape.x, shape.z, sqrtf(halfX * halfX + halfZ * halfZ), batch.nearbyStatics);
+		for (unsigned int other : batch.nearbyStatics)
+		{
+			batch.pairsTested++;
+			Shape otherShape = MakeShape(store, other);
+			glm::vec2 normal;
+			float depth;
+			if (otherShape.type == kShapeNone || !Collide(shape, otherShape, normal, depth)) continue;
+			batch.contacts.push_back(Contact{ dynamics[i], other, normal, depth });
+		}
+	}
+
+	// Counting sort of every batch by dynamic index so every entity's contacts are contiguous
+	void SortContactsByEntity()
+	{
+		contactStart.assign(dynamics.size() + 1, 0);
+		for (const ContactBatch& batch : batches)
+		{
+			for (const Contact& contact : batch.contacts)
+				contactStart[dynamicIndexOf[contact.self] + 1]++;
+		}
+		for (size_t i = 0; i < dynamics.size(); i++)
+			contactStart[i + 1] += contactStart[i];
+
+		contacts.resize(contactStart[dynamics.size()]);
+		contactFill.assign(contactStart.begin(), contactStart.end() - 1);
+		for (const ContactBatch& batch : batches)
+		{
+			for (const Contact& contact : batch.contacts)
+				contacts[contactFill[dynamicIndexOf[contact.self]]++] = contact;
+		}
+	}
+
+	static bool Blocks(const EntityStore& store, EntityId id)
+	{
+		return (store.flags[id] & (EntityStore::kFlagRadiusCollision | EntityStore::kFlagBoxCollision)) != 0;
+	}
+
+	// Every correction is computed from the positions at the start of the update, then applied at once
+	void ResolveContacts(EntityStore& store)
+	{
+		for (uint32_t i = 0; i < dynamics.size(); i++)
+		{
+			EntityId self = dynamics[i];
+			glm::vec2 correction(0.0f);
+			for (uint32_t c = contactStart[i]; c < contactStart[i + 1]; c++)
+			{
+				const Contact& contact = contacts[c];
+				if (store.flags[contact.other] & EntityStore::kFlagRadiusTrigger)
+					store.OnTrigger(contact.other);
+				if (!Blocks(store, self) || !Blocks(store, contact.other)) continue;
+
+				float share = (store.flags[contact.other] & EntityStore::kFlagDynamic) ? 0.5f : 1.0f;
+				correction += contact.normal * contact.depth * share;
+			}
+			corrections.push_back(correction);
+		}
+		for (uint32_t i = 0; i < dynamics.size(); i++)
+		{
+			store.x[dynamics[i]] += corrections[i].x;
+			store.z[dynamics[i]] += corrections[i].y;
+		}
+		corrections.clear();
+	}
+
+	size_t ContactStart(EntityId id, uint32_t end) const
+	{
+		if (id >= dynamicIndexOf.size() || dynamicIndexOf[id] == kNotDynamic) return 0;
+		return contactStart[dynamicIndexOf[id] + end];
+	}
+
+	int CellCoord(float value) const { return static_cast<int>(std::floor(value * inverseCellSize)); }
+
+	uint32_t Bucket(int cellX, int cellZ) const
+	{
+		uint32_t hash = static_cast<uint32_t>(cellX) * 73856093u ^ static_cast<uint32_t>(cellZ) * 19349663u;
+		return (hash ^ (hash >> 16)) & bucketMask;
+	}
+
+	float minCellSize;
+	float cellSize = 0.0f;
+	float inverseCellSize = 0.0f;
+	float maxDynamicExtent = 0.0f;
+	uint32_t bucketMask = 0;
+	size_t pairsTested = 0;
+
+	// Per dynamic entity, in EntityId order
+	std::vector<EntityId> dynamics;
+	std::vector<Shape> shapes;
+	std::vector<uint32_t> bucketOf;
+	std::vector<glm::vec2> corrections;
+	std::vector<uint32_t> contactStart;
+	std::vector<uint32_t> contactFill;
+
+	std::vector<uint32_t> dynamicIndexOf;
+	std::vector<uint32_t> bucketStart;
+	std::vector<uint32_t> bucketFill;
+	std::vector<uint32_t> bucketEntries;
+
+	std::vector<ContactBatch> batches;
+	std::vector<Contact> contacts;
+};
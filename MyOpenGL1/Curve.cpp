@@ -1 +1,43 @@
 #include "Curve.h"
+
+#include <algorithm>
+
+#include "glm/geometric.hpp"
+
+void Curve::setPoints(const std::vector<glm::vec2>& newPoints, int arcLengthSamples)
+{
+    points = newPoints;
+
+    int degree = static_cast<int>(points.size()) - 1;
+    weightedPoints.assign(1, glm::vec2(0.0f));
+    weightedTangentPoints.assign(1, glm::vec2(0.0f));
+    if (degree >= 0) {
+        weightedPoints.resize(degree + 1);
+        float binomial = 1.0f;
+        for (int i = 0; i <= degree; i++) {
+            weightedPoints[i] = binomial * points[i];
+            binomial = binomial * (degree - i) / (i + 1);
+        }
+    }
+    if (degree >= 1) {
+        weightedTangentPoints.resize(degree);
+        float binomial = 1.0f;
+        for (int i = 0; i < degree; i++) {
+            weightedTangentPoints[i] = binomial * static_cast<float>(degree) * (points[i + 1] - points[i]);
+            binomial = binomial * (degree - 1 - i) / (i + 1);
+        }
+    }
+
+    // Chord lengths between evenly spaced parameters, summed up
+    arcLengthSamples = std::max(arcLengthSamples, 1);
+    arcLengths.assign(arcLengthSamples + 1, 0.0f);
+    glm::vec2 previous = getBezierPoint(0.0f);
+    for (int i = 1; i <= arcLengthSamples; i++)
+    {
+        glm::vec2 current = getBezierPoint(static_cast<float>(i) / arcLengthSamples);
+        arcLengths[i] = arcLengths[i - 1] + glm::length(current - previous);
+        previous = current;
+    }
+
+    length = arcLengths.back();
+}
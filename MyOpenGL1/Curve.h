@@ -1,14 +1,49 @@
 #pragma once
+#include <algorithm>
 #include <vector>
 
 #include "glm/vec2.hpp"
 
+// Bezier curve of any degree in the XZ plane
+// The Bernstein coefficients and an arc length table are worked out once when the points are set,
+// so evaluating a point is allocation free and linear in the number of points
 class Curve
 {
 public:
-    std::vector<glm::vec2> points;
+    Curve() = default;
+    explicit Curve(const std::vector<glm::vec2>& points, int arcLengthSamples = 64) { setPoints(points, arcLengthSamples); }
+
+    void setPoints(const std::vector<glm::vec2>& points, int arcLengthSamples = 64);
+    const std::vector<glm::vec2>& getPoints() const { return points; }
+
+    // Point at parameter t in [0, 1]
+    glm::vec2 getBezierPoint(float t) const { return evaluateBernstein(weightedPoints, t); }
+
+    // Derivative of the curve at t, not normalized
+    glm::vec2 getBezierTangent(float t) const { return evaluateBernstein(weightedTangentPoints, t); }
+
+    // Length of the curve, measured along the arc length table
+    float getLength() const { return length; }
+
+    // Parameter t that lies distance along the curve, clamped to the ends
+    float getParameterAtDistance(float distance) const {
+        int nSegments = static_cast<int>(arcLengths.size()) - 1;
+        if (nSegments < 1 || !(distance > 0.0f)) return 0.0f;
+        if (distance >= length) return 1.0f;
+
+        // First sample past distance, the segment before it holds distance
+        int segment = static_cast<int>(std::upper_bound(arcLengths.begin(), arcLengths.end(), distance) - arcLengths.begin()) - 1;
+        segment = std::min(std::max(segment, 0), nSegments - 1);
+        float segmentLength = arcLengths[segment + 1] - arcLengths[segment];
+        float fraction = segmentLength > 0.0f ? (distance - arcLengths[segment]) / segmentLength : 0.0f;
+        return (segment + fraction) / nSegments;
+    }
 
-    glm::vec2 getBezierPoint(float t) {
+    // Point distance along the curve, moving distance forward at a fixed rate moves at a fixed speed
+    glm::vec2 getPointAtDistance(float distance) const { return getBezierPoint(getParameterAtDistance(distance)); }
+
+    // Copies the control points and runs de Casteljau on every call, kept as a reference for benchmarks
+    glm::vec2 getBezierPointLegacy(float t) const {
         std::vector<glm::vec2> points = this->points;
         auto const maxi = points.size() - 1;
         for (int i = 0; i != maxi; ++i)
@@ -19,5 +54,39 @@ public:
         }
         return points[0];
     }
-};
 
+private:
+    // Sum of weighted[i] * t^i * (1 - t)^(n - i), the binomial factors are already in weighted
+    // Horner's rule in t / (1 - t) or (1 - t) / t, whichever is at most one, so high degrees stay accurate
+    static glm::vec2 evaluateBernstein(const std::vector<glm::vec2>& weighted, float t) {
+        int degree = static_cast<int>(weighted.size()) - 1;
+        glm::vec2 sum;
+        float scale = 1.0f;
+        if (t <= 0.5f) {
+            float ratio = t / (1.0f - t);
+            sum = weighted[degree];
+            for (int i = degree - 1; i >= 0; i--)
+                sum = sum * ratio + weighted[i];
+            for (int i = 0; i < degree; i++)
+                scale *= 1.0f - t;
+        }
+        else {
+            float ratio = (1.0f - t) / t;
+            sum = weighted[0];
+            for (int i = 1; i <= degree; i++)
+                sum = sum * ratio + weighted[i];
+            for (int i = 0; i < degree; i++)
+                scale *= t;
+        }
+        return sum * scale;
+    }
+
+    std::vector<glm::vec2> points;
+    // points[i] times (n choose i)
+    std::vector<glm::vec2> weightedPoints = { glm::vec2(0.0f) };
+    // The derivative is a curve of one degree less through n * (points[i + 1] - points[i]), weighted the same way
+    std::vector<glm::vec2> weightedTangentPoints = { glm::vec2(0.0f) };
+    float length = 0.0f;
+    // Length of the curve from t = 0 to t = i / (size - 1)
+    std::vector<float> arcLengths = { 0.0f };
+};
@@ -0,0 +1,205 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#include <emmintrin.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include <glm/glm.hpp>
+
+// Many Bezier curves of the same degree, evaluated eight at a time
+// Control points are packed in blocks of eight curves: for every point of the block eight x values, then eight y values
+// Each step of the evaluation is then one vector operation over the whole block, with AVX2 when the compiler targets it
+class CurveBatch
+{
+public:
+	enum { kBlockSize = 8 };
+
+	explicit CurveBatch(int degree = 3) : degree(std::max(0, degree)) {}
+
+	int Degree() const { return degree; }
+	size_t Size() const { return count; }
+	// Packed control points, Size() curves rounded up to whole blocks, unused lanes are zero
+	const float* Blocks() const { return blocks.data(); }
+
+	// Append a curve, false if it does not have Degree() + 1 points
+	bool Add(const std::vector<glm::vec2>& points)
+	{
+		if (points.size() != static_cast<size_t>(degree) + 1) return false;
+		if (count % kBlockSize == 0) blocks.resize(blocks.size() + BlockFloats(degree), 0.0f);
+		count++;
+		SetPoints(count - 1, points.data());
+		return true;
+	}
+
+	// Replace the Degree() + 1 control points of a curve
+	void SetPoints(size_t curve, const glm::vec2* points)
+	{
+		float* block = blocks.data() + curve / kBlockSize * BlockFloats(degree);
+		size_t lane = curve % kBlockSize;
+		for (int k = 0; k <= degree; k++)
+		{
+			block[k * 2 * kBlockSize + lane] = points[k].x;
+			block[k * 2 * kBlockSize + kBlockSize + lane] = points[k].y;
+		}
+	}
+
+	void Clear()
+	{
+		blocks.clear();
+		count = 0;
+	}
+
+	// Point and derivative of curve i at t[i], for every curve, the tangent outputs may be null
+	void Evaluate(const float* t, float* outX, float* outY, float* outTangentX = nullptr, float* outTangentY = nullptr) const
+	{
+		Evaluate(blocks.data(), degree, count, t, outX, outY, outTangentX, outTangentY);
+	}
+
+	// Only curves [first, first + n), first must be a multiple of kBlockSize
+	// The arrays are indexed like for the whole batch, so different ranges can be evaluated on different threads
+	void Evaluate(size_t first, size_t n, const float* t, float* outX, float* outY, float* outTangentX = nullptr, float* outTangentY = nullptr) const
+	{
+		n = std::min(n, count - std::min(first, count));
+		Evaluate(blocks.data() + first / kBlockSize * BlockFloats(degree), degree, n, t + first, outX + first, outY + first,
+			outTangentX ? outTangentX + first : nullptr, outTangentY ? outTangentY + first : nullptr);
+	}
+
+	// Same as above for control points packed the way the batch packs them, count curves of the given degree
+	static void Evaluate(const float* blocks, int degree, size_t count, const float* t, float* outX, float* outY, float* outTangentX = nullptr, float* outTangentY = nullptr)
+	{
+		// Binomial weights for the points and for the differences between them, the derivative is one degree lower
+		std::vector<float> weights(degree + 1), tangentWeights(std::max(degree, 1), 0.0f);
+		float binomial = 1.0f;
+		for (int k = 0; k <= degree; k++)
+		{
+			weights[k] = binomial;
+			binomial = binomial * (degree - k) / (k + 1);
+		}
+		binomial = static_cast<float>(degree);
+		for (int k = 0; k < degree; k++)
+		{
+			tangentWeights[k] = binomial;
+			binomial = binomial * (degree - 1 - k) / (k + 1);
+		}
+
+		bool bTangents = outTangentX && outTangentY;
+		size_t nBlocks = (count + kBlockSize - 1) / kBlockSize;
+		for (size_t b = 0; b < nBlocks; b++)
+		{
+			const float* block = blocks + b * BlockFloats(degree);
+			size_t first = b * kBlockSize;
+			if (first + kBlockSize <= count)
+			{
+				EvaluateBlock(block, degree, weights.data(), tangentWeights.data(), t + first, outX + first, outY + first,
+					bTangents ? outTangentX + first : nullptr, bTangents ? outTangentY + first : nullptr);
+				continue;
+			}
+
+			// The last block is partly empty, run it on copies so nothing past count is read or written
+			size_t used = count - first;
+			float tailT[kBlockSize] = {}, tailX[kBlockSize], tailY[kBlockSize], tailTangentX[kBlockSize], tailTangentY[kBlockSize];
+			std::copy(t + first, t + count, tailT);
+			EvaluateBlock(block, degree, weights.data(), tangentWeights.data(), tailT, tailX, tailY, tailTangentX, tailTangentY);
+			std::copy(tailX, tailX + used, outX + first);
+			std::copy(tailY, tailY + used, outY + first);
+			if (bTangents)
+			{
+				std::copy(tailTangentX, tailTangentX + used, outTangentX + first);
+				std::copy(tailTangentY, tailTangentY + used, outTangentY + first);
+			}
+		}
+	}
+
+private:
+	static size_t BlockFloats(int degree) { return static_cast<size_t>(degree + 1) * 2 * kBlockSize; }
+
+	// Thin wrappers so one evaluation loop serves both vector widths
+	struct Sse
+	{
+		typedef __m128 Type;
+		enum { kWidth = 4 };
+		static Type Load(const float* p) { return _mm_loadu_ps(p); }
+		static void Store(float* p, Type v) { _mm_storeu_ps(p, v); }
+		static Type Set(float value) { return _mm_set1_ps(value); }
+		static Type Add(Type a, Type b) { return _mm_add_ps(a, b); }
+		static Type Sub(Type a, Type b) { return _mm_sub_ps(a, b); }
+		static Type Mul(Type a, Type b) { return _mm_mul_ps(a, b); }
+	};
+
+#if defined(__AVX2__)
+	struct Avx
+	{
+		typedef __m256 Type;
+		enum { kWidth = 8 };
+		static Type Load(const float* p) { return _mm256_loadu_ps(p); }
+		static void Store(float* p, Type v) { _mm256_storeu_ps(p, v); }
+		static Type Set(float value) { return _mm256_set1_ps(value); }
+		static Type Add(Type a, Type b) { return _mm256_add_ps(a, b); }
+		static Type Sub(Type a, Type b) { return _mm256_sub_ps(a, b); }
+		static Type Mul(Type a, Type b) { return _mm256_mul_ps(a, b); }
+	};
+	typedef Avx Lanes;
+#else
+	typedef Sse Lanes;
+#endif
+
+	static void EvaluateBlock(const float* block, int degree, const float* weights, const float* tangentWeights, const float* t, float* outX, float* outY, float* outTangentX, float* outTangentY)
+	{
+		for (int lane = 0; lane < kBlockSize; lane += Lanes::kWidth)
+		{
+			if (degree == 3)
+				EvaluateLanes<Lanes, 3>(block + lane, 3, weights, tangentWeights, t + lane, outX + lane, outY + lane, outTangentX ? outTangentX + lane : nullptr, outTangentY ? outTangentY + lane : nullptr);
+			else
+				EvaluateLanes<Lanes, 0>(block + lane, degree, weights, tangentWeights, t + lane, outX + lane, outY + lane, outTangentX ? outTangentX + lane : nullptr, outTangentY ? outTangentY + lane : nullptr);
+		}
+	}
+
+	// Sum of weights[k] * t^k * (1 - t)^(n - k) * P[k] by Horner's rule in 1 - t, carrying the power of t along
+	// Only multiplies and adds, so every lane runs the same instructions whatever its t
+	// kFixedDegree lets the compiler unroll the common cubic case, 0 reads the degree at runtime
+	template <typename L, int kFixedDegree>
+	static void EvaluateLanes(const float* points, int runtimeDegree, const float* weights, const float* tangentWeights, const float* t, float* outX, float* outY, float* outTangentX, float* outTangentY)
+	{
+		const int n = kFixedDegree > 0 ? kFixedDegree : runtimeDegree;
+		const size_t stride = 2 * kBlockSize;
+
+		typename L::Type tv = L::Load(t);
+		typename L::Type u = L::Sub(L::Set(1.0f), tv);
+		typename L::Type previousX = L::Load(points), previousY = L::Load(points + kBlockSize);
+		typename L::Type x = L::Mul(previousX, L::Set(weights[0])), y = L::Mul(previousY, L::Set(weights[0]));
+		typename L::Type tangentX = L::Set(0.0f), tangentY = L::Set(0.0f);
+		// t^(k - 1) at the start of step k
+		typename L::Type tPower = L::Set(1.0f);
+		for (int k = 1; k <= n; k++)
+		{
+			typename L::Type pointX = L::Load(points + k * stride), pointY = L::Load(points + k * stride + kBlockSize);
+			if (outTangentX)
+			{
+				typename L::Type scale = L::Mul(tPower, L::Set(tangentWeights[k - 1]));
+				tangentX = L::Add(L::Mul(tangentX, u), L::Mul(L::Sub(pointX, previousX), scale));
+				tangentY = L::Add(L::Mul(tangentY, u), L::Mul(L::Sub(pointY, previousY), scale));
+				previousX = pointX;
+				previousY = pointY;
+			}
+			tPower = L::Mul(tPower, tv);
+			typename L::Type scale = L::Mul(tPower, L::Set(weights[k]));
+			x = L::Add(L::Mul(x, u), L::Mul(pointX, scale));
+			y = L::Add(L::Mul(y, u), L::Mul(pointY, scale));
+		}
+		L::Store(outX, x);
+		L::Store(outY, y);
+		if (outTangentX)
+		{
+			L::Store(outTangentX, tangentX);
+			L::Store(outTangentY, tangentY);
+		}
+	}
+
+	int degree;
+	size_t count = 0;
+	std::vector<float> blocks;
+};
@@ -0,0 +1,355 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "Arena.h"
+#include "SpatialHashGrid.h"
+#include "Surface.h"
+#include "Types.h"
+
+// Dense index of an entity in the EntityStore, ids are handed out in order and never reused
+typedef unsigned int EntityId;
+const EntityId InvalidEntityId = ~0u;
+
+// Every entity in the level, stored as one array per field so each pass only touches the fields it needs
+// Arrays live in the store's arena and are indexed by EntityId
+class EntityStore
+{
+public:
+	static const uint8_t kFlagAffectedByTerrain = 1;
+	static const uint8_t kFlagRadiusCollision = 2;
+	static const uint8_t kFlagRadiusTrigger = 4;
+	static const uint8_t kFlagBoxCollision = 8;
+	static const uint8_t kFlagDynamic = 16;
+
+	// Transforms
+	float* x = nullptr;
+	float* y = nullptr;
+	float* z = nullptr;
+	float* pitch = nullptr;
+	float* yaw = nullptr;
+	float* roll = nullptr;
+	float* scaleX = nullptr;
+	float* scaleY = nullptr;
+	float* scaleZ = nullptr;
+	// Transform at the start of the current simulation tick, drawing blends from it to the current one
+	float* previousX = nullptr;
+	float* previousY = nullptr;
+	float* previousZ = nullptr;
+	float* previousPitch = nullptr;
+	float* previousYaw = nullptr;
+	float* previousRoll = nullptr;
+
+	// Colliders
+	float* radius = nullptr;
+	BoxCollisionDef* box = nullptr;
+
+	uint8_t* flags = nullptr;
+	MeshHandle* mesh = nullptr;
+
+	EntityStore() = default;
+	EntityStore(const EntityStore&) = delete;
+	EntityStore& operator=(const EntityStore&) = delete;
+
+	// Copy an entity description into the store
+	EntityId Create(const Entity& entity)
+	{
+		if (count == capacity) Reserve(capacity == 0 ? 256 : capacity * 2);
+
+		EntityId id = static_cast<EntityId>(count++);
+		const Transformation& transformation = entity.transformation;
+		x[id] = transformation.x;
+		y[id] = transformation.y;
+		z[id] = transformation.z;
+		pitch[id] = transformation.pitch;
+		yaw[id] = transformation.yaw;
+		roll[id] = transformation.roll;
+		scaleX[id] = transformation.scale_x;
+		scaleY[id] = transformation.scale_y;
+		scaleZ[id] = transformation.scale_z;
+		previousX[id] = transformation.x;
+		previousY[id] = transformation.y;
+		previousZ[id] = transformation.z;
+		previousPitch[id] = transformation.pitch;
+		previousYaw[id] = transformation.yaw;
+		previousRoll[id] = transformation.roll;
+
+		radius[id] = entity.RadiusCollisionSize;
+		box[id] = entity.collision;
+
+		uint8_t entityFlags = 0;
+		if (entity.bIsAffectedByTerrain) entityFlags |= kFlagAffectedByTerrain;
+		if (entity.bHasRadiusCollision) entityFlags |= kFlagRadiusCollision;
+		if (entity.bHasRadiusTrigger) entityFlags |= kFlagRadiusTrigger;
+		if (entity.bHasBoxCollision) entityFlags |= kFlagBoxCollision;
+		if (entity.bIsDynamic) entityFlags |= kFlagDynamic;
+		flags[id] = entityFlags;
+
+		mesh[id] = entity.mesh;
+
+		// Static colliders are registered once, dynamic ones are sorted into cells every frame by the CollisionSystem
+		if ((entityFlags & kFlagDynamic) == 0 && (entityFlags & (kFlagRadiusCollision | kFlagRadiusTrigger | kFlagBoxCollision)))
+			colliderGrid.Insert(id, x[id], z[id], ColliderExtent(id));
+		return id;
+	}
+
+	// Make room for at least newCapacity entities, existing ids stay valid
+	// The old arrays are left in the arena, growing by doubling keeps that waste below the live size
+	void Reserve(size_t newCapacity)
+	{
+		if (newCapacity <= capacity) return;
+		Grow(x, newCapacity);
+		Grow(y, newCapacity);
+		Grow(z, newCapacity);
+		Grow(pitch, newCapacity);
+		Grow(yaw, newCapacity);
+		Grow(roll, newCapacity);
+		Grow(scaleX, newCapacity);
+		Grow(scaleY, newCapacity);
+		Grow(scaleZ, newCapacity);
+		Grow(previousX, newCapacity);
+		Grow(previousY, newCapacity);
+		Grow(previousZ, newCapacity);
+		Grow(previousPitch, newCapacity);
+		Grow(previousYaw, newCapacity);
+		Grow(previousRoll, newCapacity);
+		Grow(radius, newCapacity);
+		Grow(box, newCapacity);
+		Grow(flags, newCapacity);
+		Grow(mesh, newCapacity);
+		capacity = newCapacity;
+	}
+
+	size_t Count() const { return count; }
+	size_t BytesUsed() const { return arena.BytesUsed(); }
+
+	bool HasFlag(EntityId id, uint8_t flag) const { return (flags[id] & flag) != 0; }
+	glm::vec3 Position(EntityId id) const { return glm::vec3(x[id], y[id], z[id]); }
+
+	// Position drawn blend of the way from the start of the current tick to now
+	glm::vec3 InterpolatedPosition(EntityId id, float blend) const
+	{
+		return glm::vec3(Lerp(previousX[id], x[id], blend), Lerp(previousY[id], y[id], blend), Lerp(previousZ[id], z[id], blend));
+	}
+
+	// Remember every transform at the start of a simulation tick
+	// Drawing blends from these, and entities can tell how far they moved during the tick
+	void StorePreviousTransforms()
+	{
+		memcpy(previousX, x, count * sizeof(float));
+		memcpy(previousY, y, count * sizeof(float));
+		memcpy(previousZ, z, count * sizeof(float));
+		memcpy(previousPitch, pitch, count * sizeof(float));
+		memcpy(previousYaw, yaw, count * sizeof(float));
+		memcpy(previousRoll, roll, count * sizeof(float));
+	}
+
+	// Called when the mover enters the radius trigger of the entity passed in
+	// Deliberately empty, the hook where trigger volumes get their gameplay
+	void OnTrigger(EntityId /*other*/) {}
+
+	// Distance from the entity's position to the farthest point of its collider on the XZ plane
+	float ColliderExtent(EntityId id) const
+	{
+		float extent = (flags[id] & (kFlagRadiusCollision | kFlagRadiusTrigger)) ? radius[id] : 0.0f;
+		if (flags[id] & kFlagBoxCollision)
+		{
+			WorldCollision bounds = GetWorldCollision(id);
+			float farX = std::max(fabsf(bounds.x1 - x[id]), fabsf(bounds.x2 - x[id]));
+			float farZ = std::max(fabsf(bounds.z1 - z[id]), fabsf(bounds.z2 - z[id]));
+			extent = std::max(extent, sqrtf(farX * farX + farZ * farZ));
+		}
+		return extent;
+	}
+
+	// Grid of every static collider
+	const SpatialHashGrid& ColliderGrid() const { return colliderGrid; }
+
+	// Call after moving a static entity that has a collider
+	void SyncCollider(EntityId id)
+	{
+		colliderGrid.Move(id, x[id], z[id]);
+	}
+
+	// Push the mover out of every radius collider it overlaps, on the XZ plane
+	// Only colliders in grid cells near the mover are tested
+	void ResolveRadiusCollisions(EntityId mover)
+	{
+		float startX = x[mover];
+		float startZ = z[mover];
+		float queryRadius = radius[mover];
+		float moverX, moverZ;
+		for (;;)
+		{
+			nearbyColliders.clear();
+			colliderGrid.Query(startX, startZ, queryRadius, nearbyColliders);
+			// Resolve in id order, the same order the linear scan uses
+			std::sort(nearbyColliders.begin(), nearbyColliders.end());
+
+			moverX = startX;
+			moverZ = startZ;
+			triggeredColliders.clear();
+			float maxDisplacementSquared = 0.0f;
+			for (EntityId other : nearbyColliders)
+			{
+				if (other == mover) continue;
+				ResolveRadiusCollision(mover, other, moverX, moverZ, &triggeredColliders);
+				float displacementX = moverX - startX;
+				float displacementZ = moverZ - startZ;
+				maxDisplacementSquared = std::max(maxDisplacementSquared, displacementX * displacementX + displacementZ * displacementZ);
+			}
+
+			// A chain of pushes can carry the mover past the cells that were searched, search wider and redo it
+			float maxDisplacement = sqrtf(maxDisplacementSquared);
+			if (maxDisplacement <= queryRadius - radius[mover]) break;
+			queryRadius = radius[mover] + maxDisplacement * 2.0f;
+		}
+
+		for (EntityId other : triggeredColliders)
+			OnTrigger(other);
+		x[mover] = moverX;
+		z[mover] = moverZ;
+	}
+
+	// Same as ResolveRadiusCollisions but tests every entity, kept as a reference for benchmarks
+	void ResolveRadiusCollisionsLinear(EntityId mover)
+	{
+		float moverX = x[mover];
+		float moverZ = z[mover];
+		for (size_t i = 0; i < count; i++)
+		{
+			if ((flags[i] & (kFlagRadiusCollision | kFlagRadiusTrigger)) == 0 || i == mover) continue;
+			ResolveRadiusCollision(mover, static_cast<EntityId>(i), moverX, moverZ, nullptr);
+		}
+		x[mover] = moverX;
+		z[mover] = moverZ;
+	}
+
+	// World matrix of every entity, out must have room for Count() matrices
+	// Without bApplyGround the ground height is left out, for when the vertex shader adds it
+	// blend goes from the transform at the start of the current tick (0) to the current one (1)
+	void ComputeMatrices(glm::mat4* out, bool bApplyGround = true, float blend = 1.0f) const
+	{
+		ComputeMatrices(out, size_t(0), count, bApplyGround, blend);
+	}
+
+	// Matrices of entities [begin, end) only, into out[begin] onwards
+	// Only reads the store, so different ranges can be computed on different threads
+	void ComputeMatrices(glm::mat4* out, size_t begin, size_t end, bool bApplyGround = true, float blend = 1.0f) const
+	{
+		ComputeMatricesOf(out + begin, end - begin, [begin](size_t i) { return static_cast<EntityId>(begin + i); }, bApplyGround, blend);
+	}
+
+	// Matrices of the count entities in ids only, out[i] is the matrix of ids[i]
+	void ComputeMatrices(glm::mat4* out, const EntityId* ids, size_t count, bool bApplyGround = true, float blend = 1.0f) const
+	{
+		ComputeMatricesOf(out, count, [ids](size_t i) { return ids[i]; }, bApplyGround, blend);
+	}
+
+	// Get the absolute collision values for an entity
+	WorldCollision GetWorldCollision(EntityId id) const
+	{
+		const BoxCollisionDef& collision = box[id];
+		WorldCollision worldCollision;
+		worldCollision.x1 = x[id] + collision.x_relative * scaleX[id];
+		worldCollision.x2 = worldCollision.x1 + collision.x_size * scaleX[id];
+		worldCollision.y1 = y[id] + collision.y_relative * scaleY[id];
+		worldCollision.y2 = worldCollision.y1 + collision.y_size * scaleY[id];
+		worldCollision.z1 = z[id] + collision.z_relative * scaleZ[id];
+		worldCollision.z2 = worldCollision.z1 + collision.z_size * scaleZ[id];
+		return worldCollision;
+	}
+
+private:
+	// Matrices of the entities idAt(0) to idAt(count - 1), into out[0] to out[count - 1]
+	template <typename IdAt>
+	void ComputeMatricesOf(glm::mat4* out, size_t count, IdAt idAt, bool bApplyGround, float blend) const
+	{
+		// Entities are done in runs, so the ground height under a whole run is worked out in one batch
+		const size_t kRunLength = 256;
+		float runX[kRunLength], runZ[kRunLength], groundHeights[kRunLength];
+		for (size_t runStart = 0; runStart < count; runStart += kRunLength)
+		{
+			size_t runCount = std::min(kRunLength, count - runStart);
+			for (size_t run = 0; run < runCount; run++)
+			{
+				EntityId i = idAt(runStart + run);
+				runX[run] = Lerp(previousX[i], x[i], blend);
+				runZ[run] = Lerp(previousZ[i], z[i], blend);
+			}
+			if (bApplyGround) Surface::GetGroundZAt2dCoords(runX, runZ, groundHeights, runCount);
+
+			for (size_t run = 0; run < runCount; run++)
+			{
+				EntityId i = idAt(runStart + run);
+				glm::vec3 translation = glm::vec3(runX[run], Lerp(previousY[i], y[i], blend), runZ[run]);
+
+				// Account for surface displacement if the entity is configured to do so
+				if (bApplyGround && (flags[i] & kFlagAffectedByTerrain))
+					translation.y += groundHeights[run];
+
+				glm::mat4 entityMatrix = glm::translate(glm::mat4(1.0f), translation);
+				entityMatrix = glm::rotate(entityMatrix, LerpAngle(previousPitch[i], pitch[i], blend), glm::vec3(1.0f, 0.0f, 0.0f));
+				entityMatrix = glm::rotate(entityMatrix, LerpAngle(previousYaw[i], yaw[i], blend), glm::vec3(0.0f, 1.0f, 0.0f));
+				entityMatrix = glm::rotate(entityMatrix, LerpAngle(previousRoll[i], roll[i], blend), glm::vec3(0.0f, 0.0f, 1.0f));
+				out[runStart + run] = entityMatrix;
+			}
+		}
+	}
+
+	static float Lerp(float from, float to, float blend) { return from + (to - from) * blend; }
+
+	// Turns the short way round, angles that wrapped between ticks do not spin the entity
+	static float LerpAngle(float from, float to, float blend)
+	{
+		const float kTwoPi = 6.28318531f;
+		float difference = fmodf(to - from, kTwoPi);
+		if (difference > kTwoPi * 0.5f) difference -= kTwoPi;
+		else if (difference < -kTwoPi * 0.5f) difference += kTwoPi;
+		return from + difference * blend;
+	}
+
+	// Triggers are collected into triggered when it is given, otherwise fired right away
+	void ResolveRadiusCollision(EntityId mover, EntityId other, float& moverX, float& moverZ, std::vector<EntityId>* triggered)
+	{
+		float differenceX = moverX - x[other];
+		float differenceZ = moverZ - z[other];
+		float contactDistance = radius[mover] + radius[other];
+		float distanceSquared = differenceX * differenceX + differenceZ * differenceZ;
+		if (distanceSquared >= contactDistance * contactDistance) return;
+
+		if (flags[other] & kFlagRadiusTrigger)
+		{
+			if (triggered != nullptr) triggered->push_back(other);
+			else OnTrigger(other);
+		}
+		if ((flags[other] & kFlagRadiusCollision) && distanceSquared > 0.0f)
+		{
+			// Move the mover away from the object
+			float scale = contactDistance / sqrtf(distanceSquared);
+			moverX = x[other] + differenceX * scale;
+			moverZ = z[other] + differenceZ * scale;
+		}
+	}
+
+	template <typename T>
+	void Grow(T*& array, size_t newCapacity)
+	{
+		T* grown = arena.AllocateArray<T>(newCapacity);
+		if (count > 0) memcpy(grown, array, count * sizeof(T));
+		array = grown;
+	}
+
+	Arena arena;
+	SpatialHashGrid colliderGrid;
+	std::vector<unsigned int> nearbyColliders;
+	std::vector<EntityId> triggeredColliders;
+	size_t count = 0;
+	size_t capacity = 0;
+};
@@ -0,0 +1,43 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+// Turns frames of any length into a whole number of simulation ticks of one fixed length
+// The simulation then behaves the same at any frame rate, and drawing blends between the last two ticks for smooth motion
+class FixedTimestep
+{
+public:
+	// After a long stall at most maxTicksPerFrame ticks are run, the rest of the time is dropped instead of catching up
+	explicit FixedTimestep(double step = 1.0 / 60.0, int maxTicksPerFrame = 8) : step(step), maxTicksPerFrame(maxTicksPerFrame) {}
+
+	// Add the time since the last frame and return how many ticks to run for it
+	int Advance(double frameSeconds)
+	{
+		accumulator += std::max(0.0, frameSeconds);
+		int ticks = 0;
+		while (accumulator >= step && ticks < maxTicksPerFrame)
+		{
+			accumulator -= step;
+			ticks++;
+		}
+		// Whole ticks left over after a stall are dropped, the part of a tick drawing is into is kept
+		if (accumulator >= step) accumulator = fmod(accumulator, step);
+		tickCount += ticks;
+		ticksLastFrame = ticks;
+		return ticks;
+	}
+
+	double Step() const { return step; }
+	// How far drawing is from the state before the last tick (0) to the state after it (1)
+	float Blend() const { return static_cast<float>(std::min(1.0, accumulator / step)); }
+	uint64_t TickCount() const { return tickCount; }
+	int TicksLastFrame() const { return ticksLastFrame; }
+
+private:
+	double step;
+	int maxTicksPerFrame;
+	double accumulator = 0.0;
+	uint64_t tickCount = 0;
+	int ticksLastFrame = 0;
+};
@@ -0,0 +1,111 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#include <emmintrin.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include <glm/glm.hpp>
+
+// The six planes bounding what a camera can see, to skip drawing what is entirely outside them
+// Spheres are tested in batches from separate x, y, z and radius arrays, eight at a time with AVX2 and four with SSE
+class Frustum
+{
+public:
+	// Planes of viewProjection = projection * view, in world space with normals pointing inside
+	// Each plane is the fourth row of the matrix plus or minus one of the other rows (Gribb and Hartmann)
+	static Frustum FromMatrix(const glm::mat4& viewProjection)
+	{
+		// glm is column major, so row i is element i of every column
+		glm::vec4 rows[4];
+		for (int i = 0; i < 4; i++)
+			rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+
+		Frustum frustum;
+		frustum.planes[0] = rows[3] + rows[0]; // left
+		frustum.planes[1] = rows[3] - rows[0]; // right
+		frustum.planes[2] = rows[3] + rows[1]; // bottom
+		frustum.planes[3] = rows[3] - rows[1]; // top
+		frustum.planes[4] = rows[3] + rows[2]; // near
+		frustum.planes[5] = rows[3] - rows[2]; // far
+		// Unit normals, so a plane gives the distance to a point and can be compared with a radius
+		for (glm::vec4& plane : frustum.planes)
+			plane /= glm::length(glm::vec3(plane));
+		return frustum;
+	}
+
+	// False only if the sphere is entirely outside one of the planes
+	// Spheres near a corner can pass without touching the frustum, they are drawn for nothing but never missing
+	bool IsSphereVisible(const glm::vec3& center, float radius) const
+	{
+		for (const glm::vec4& plane : planes)
+		{
+			if (glm::dot(glm::vec3(plane), center) + plane.w < -radius) return false;
+		}
+		return true;
+	}
+
+	enum Containment { kOutside, kIntersecting, kInside };
+
+	// Where an axis aligned box is, tested with the corner farthest along each plane's normal and the one nearest
+	// Like the sphere test, boxes near a corner can come out intersecting while outside
+	Containment ClassifyBox(const glm::vec3& boxMin, const glm::vec3& boxMax) const
+	{
+		Containment result = kInside;
+		for (const glm::vec4& plane : planes)
+		{
+			glm::vec3 farthest(plane.x >= 0.0f ? boxMax.x : boxMin.x, plane.y >= 0.0f ? boxMax.y : boxMin.y, plane.z >= 0.0f ? boxMax.z : boxMin.z);
+			if (glm::dot(glm::vec3(plane), farthest) + plane.w < 0.0f) return kOutside;
+			glm::vec3 nearest(plane.x >= 0.0f ? boxMin.x : boxMax.x, plane.y >= 0.0f ? boxMin.y : boxMax.y, plane.z >= 0.0f ? boxMin.z : boxMax.z);
+			if (glm::dot(glm::vec3(plane), nearest) + plane.w < 0.0f) result = kIntersecting;
+		}
+		return result;
+	}
+
+	// visible[i] = IsSphereVisible of sphere i, for count spheres
+	void TestSpheres(const float* x, const float* y, const float* z, const float* radius, uint8_t* visible, size_t count) const
+	{
+		size_t i = 0;
+#if defined(__AVX2__)
+		for (; i + 8 <= count; i += 8)
+		{
+			__m256 sphereX = _mm256_loadu_ps(x + i), sphereY = _mm256_loadu_ps(y + i), sphereZ = _mm256_loadu_ps(z + i);
+			__m256 negativeRadius = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(radius + i));
+			__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+			for (const glm::vec4& plane : planes)
+			{
+				__m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sphereX, _mm256_set1_ps(plane.x)), _mm256_mul_ps(sphereY, _mm256_set1_ps(plane.y))),
+					_mm256_add_ps(_mm256_mul_ps(sphereZ, _mm256_set1_ps(plane.z)), _mm256_set1_ps(plane.w)));
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, negativeRadius, _CMP_NLT_UQ));
+			}
+			WriteMask(_mm256_movemask_ps(inside), visible + i, 8);
+		}
+#endif
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128 sphereX = _mm_loadu_ps(x + i), sphereY = _mm_loadu_ps(y + i), sphereZ = _mm_loadu_ps(z + i);
+			__m128 negativeRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(radius + i));
+			__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+			for (const glm::vec4& plane : planes)
+			{
+				__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(sphereX, _mm_set1_ps(plane.x)), _mm_mul_ps(sphereY, _mm_set1_ps(plane.y))),
+					_mm_add_ps(_mm_mul_ps(sphereZ, _mm_set1_ps(plane.z)), _mm_set1_ps(plane.w)));
+				inside = _mm_and_ps(inside, _mm_cmpnlt_ps(distance, negativeRadius));
+			}
+			WriteMask(_mm_movemask_ps(inside), visible + i, 4);
+		}
+		for (; i < count; i++)
+			visible[i] = IsSphereVisible(glm::vec3(x[i], y[i], z[i]), radius[i]) ? 1 : 0;
+	}
+
+private:
+	static void WriteMask(int mask, uint8_t* visible, int lanes)
+	{
+		for (int lane = 0; lane < lanes; lane++)
+			visible[lane] = static_cast<uint8_t>((mask >> lane) & 1);
+	}
+
+	glm::vec4 planes[6];
+};
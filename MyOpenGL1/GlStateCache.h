@@ -0,0 +1,138 @@
+#pragma once
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+// Remembers the GL state it last set and skips calls that would set it again
+// Bindings can be changed behind its back (mesh uploads bind their own buffers), so Invalidate them before a run of draws
+// Uniforms live in their program, they stay valid as long as every uniform of those programs is set through here
+// Counts the calls it issued and skipped, and the ones that can never be skipped given to CountIssued, since ResetCounters
+class GlStateCache
+{
+public:
+	// Forget the bindings, the next bind of each kind is issued whatever it was
+	void Invalidate()
+	{
+		program = kUnknown;
+		vertexArray = kUnknown;
+		arrayBuffer = kUnknown;
+		texture2D = kUnknown;
+	}
+
+	void UseProgram(GLuint name)
+	{
+		if (Changed(program, name)) glUseProgram(name);
+	}
+
+	void BindVertexArray(GLuint name)
+	{
+		if (Changed(vertexArray, name)) glBindVertexArray(name);
+	}
+
+	void BindArrayBuffer(GLuint name)
+	{
+		if (Changed(arrayBuffer, name)) glBindBuffer(GL_ARRAY_BUFFER, name);
+	}
+
+	// On texture unit 0, the only one used
+	void BindTexture2D(GLuint name)
+	{
+		if (Changed(texture2D, name)) glBindTexture(GL_TEXTURE_2D, name);
+	}
+
+	// Uniforms of the program in use, a location of -1 (not in the program) is ignored like GL does
+	void Uniform1i(GLint location, int value)
+	{
+		if (UniformChanged(location, &value, sizeof(value))) glUniform1i(location, value);
+	}
+
+	void Uniform1f(GLint location, float value)
+	{
+		if (UniformChanged(location, &value, sizeof(value))) glUniform1f(location, value);
+	}
+
+	void Uniform3f(GLint location, const glm::vec3& value)
+	{
+		if (UniformChanged(location, glm::value_ptr(value), sizeof(value))) glUniform3fv(location, 1, glm::value_ptr(value));
+	}
+
+	void UniformMatrix4(GLint location, const glm::mat4& value)
+	{
+		if (UniformChanged(location, glm::value_ptr(value), sizeof(value))) glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(value));
+	}
+
+	// Calls made directly, draws and buffer uploads, so the counts cover all of them
+	void CountIssued(int calls)
+	{
+		issued += calls;
+	}
+
+	void ResetCounters()
+	{
+		issued = 0;
+		skipped = 0;
+	}
+
+	int Issued() const { return issued; }
+	int Skipped() const { return skipped; }
+
+private:
+	// No GL name is this large, so nothing compares equal to it
+	enum : GLuint { kUnknown = 0xFFFFFFFFu };
+
+	// Up to a mat4, compared and copied as raw bytes
+	struct UniformValue
+	{
+		bool bKnown = false;
+		unsigned char bytes[sizeof(glm::mat4)];
+	};
+
+	bool Changed(GLuint& current, GLuint name)
+	{
+		if (current == name)
+		{
+			skipped++;
+			return false;
+		}
+		current = name;
+		issued++;
+		return true;
+	}
+
+	bool UniformChanged(GLint location, const void* value, size_t size)
+	{
+		if (location < 0) return false;
+		// Not knowing which program is in use, not knowing what it holds either
+		if (program == kUnknown)
+		{
+			issued++;
+			return true;
+		}
+		std::vector<UniformValue>& values = uniforms[program];
+		if (static_cast<size_t>(location) >= values.size()) values.resize(location + 1);
+		UniformValue& cached = values[location];
+		if (cached.bKnown && memcmp(cached.bytes, value, size) == 0)
+		{
+			skipped++;
+			return false;
+		}
+		cached.bKnown = true;
+		memcpy(cached.bytes, value, size);
+		issued++;
+		return true;
+	}
+
+	GLuint program = kUnknown;
+	GLuint vertexArray = kUnknown;
+	GLuint arrayBuffer = kUnknown;
+	GLuint texture2D = kUnknown;
+	// Last value set at each uniform location, by program
+	std::unordered_map<GLuint, std::vector<UniformValue>> uniforms;
+
+	int issued = 0;
+	int skipped = 0;
+};
@@ -0,0 +1,68 @@
+#pragma once
+#include <glad/glad.h>
+
+// GPU time spent between Begin and End, measured with GL_TIME_ELAPSED queries
+// Results are read a few frames later, once the GPU has got there, so the CPU never waits for them
+// Needs a current GL context from construction until DeleteQueries, which has to be called before the context goes
+class GpuTimer
+{
+public:
+	// Frames a measurement may stay in flight, when all of them are a frame goes unmeasured
+	enum { kQueries = 4 };
+
+	GpuTimer()
+	{
+		glGenQueries(kQueries, queries);
+	}
+
+	void DeleteQueries()
+	{
+		glDeleteQueries(kQueries, queries);
+	}
+
+	GpuTimer(const GpuTimer&) = delete;
+	GpuTimer& operator=(const GpuTimer&) = delete;
+
+	void Begin()
+	{
+		bActive = !bPending[next];
+		if (bActive) glBeginQuery(GL_TIME_ELAPSED, queries[next]);
+	}
+
+	void End()
+	{
+		if (!bActive) return;
+		glEndQuery(GL_TIME_ELAPSED);
+		bPending[next] = true;
+		next = (next + 1) % kQueries;
+		bActive = false;
+	}
+
+	// Collect every measurement the GPU has finished, false if none has since the last call
+	// seconds is set to the newest of them
+	bool Poll(double& seconds)
+	{
+		bool bFound = false;
+		// Oldest first, the query after the next one to use is the one issued longest ago
+		for (int i = 0; i < kQueries; i++)
+		{
+			int query = (next + i) % kQueries;
+			if (!bPending[query]) continue;
+			GLint available = 0;
+			glGetQueryObjectiv(queries[query], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available) break;
+			GLuint64 nanoseconds = 0;
+			glGetQueryObjectui64v(queries[query], GL_QUERY_RESULT, &nanoseconds);
+			bPending[query] = false;
+			seconds = nanoseconds * 1e-9;
+			bFound = true;
+		}
+		return bFound;
+	}
+
+private:
+	GLuint queries[kQueries];
+	bool bPending[kQueries] = {};
+	int next = 0;
+	bool bActive = false;
+};
@@ -0,0 +1,77 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Entity matrices sorted into one array by draw group, every group ends up contiguous and ready for one instanced draw
+// A counting sort split into tasks: count the groups of each range of entities, work out where each range writes, then copy
+// Every range keeps its entities in id order, so the result is the same however the tasks are run
+class InstanceBatches
+{
+public:
+	enum { kEntitiesPerTask = 1024 };
+
+	// Start a frame of nEntities entities spread over nGroups groups
+	void Begin(size_t nEntities, size_t nGroups)
+	{
+		this->nEntities = nEntities;
+		this->nGroups = nGroups;
+		counts.assign(TaskCount() * nGroups, 0);
+		matrices.resize(nEntities);
+	}
+
+	size_t TaskCount() const { return (nEntities + kEntitiesPerTask - 1) / kEntitiesPerTask; }
+
+	// Count the entities of one task in each group, groups[id] is the group of entity id
+	void Count(size_t task, const uint32_t* groups)
+	{
+		uint32_t* taskCounts = counts.data() + task * nGroups;
+		size_t end = std::min(nEntities, (task + 1) * kEntitiesPerTask);
+		for (size_t id = task * kEntitiesPerTask; id < end; id++)
+			taskCounts[groups[id]]++;
+	}
+
+	// Where every group starts, and where every task writes into it, after all tasks are counted
+	void ComputeOffsets()
+	{
+		groupStart.resize(nGroups + 1);
+		uint32_t offset = 0;
+		for (size_t group = 0; group < nGroups; group++)
+		{
+			groupStart[group] = offset;
+			for (size_t task = 0; task < TaskCount(); task++)
+			{
+				uint32_t count = counts[task * nGroups + group];
+				counts[task * nGroups + group] = offset;
+				offset += count;
+			}
+		}
+		groupStart[nGroups] = offset;
+	}
+
+	// Copy the matrices of one task's entities into their groups, after ComputeOffsets
+	void Scatter(size_t task, const uint32_t* groups, const glm::mat4* entityMatrices)
+	{
+		uint32_t* fill = counts.data() + task * nGroups;
+		size_t end = std::min(nEntities, (task + 1) * kEntitiesPerTask);
+		for (size_t id = task * kEntitiesPerTask; id < end; id++)
+			matrices[fill[groups[id]]++] = entityMatrices[id];
+	}
+
+	size_t GroupCount() const { return nGroups; }
+	size_t InstanceCount(size_t group) const { return groupStart[group + 1] - groupStart[group]; }
+	// Instances in all groups together, after ComputeOffsets
+	size_t TotalInstanceCount() const { return groupStart[nGroups]; }
+	const glm::mat4* Matrices(size_t group) const { return matrices.data() + groupStart[group]; }
+
+private:
+	size_t nEntities = 0;
+	size_t nGroups = 0;
+	// Per task and group, first the number of entities, after ComputeOffsets where the next one goes
+	std::vector<uint32_t> counts;
+	std::vector<uint32_t> groupStart;
+	std::vector<glm::mat4> matrices;
+};
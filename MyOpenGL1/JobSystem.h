@@ -0,0 +1,200 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Runs ranges of parallel loops on a fixed set of worker threads
+// Every thread has its own deque of jobs: it takes the newest job from its own deque and steals the oldest from the others when it runs dry
+// Any thread that waits on jobs runs jobs in the meantime, so jobs can start and wait on more jobs without blocking a worker
+class JobSystem
+{
+public:
+	// Body of a parallel loop, called with [begin, end)
+	typedef std::function<void(size_t, size_t)> RangeFunction;
+
+	// Jobs still to finish from one dispatch, onDone is called by the thread that finishes the last one
+	struct Counter
+	{
+		std::atomic<size_t> remaining{ 0 };
+		const std::function<void()>* onDone = nullptr;
+	};
+
+	// nThreads threads run jobs, the calling thread included, 0 uses every core
+	explicit JobSystem(int nThreads = 0)
+	{
+		if (nThreads <= 0) nThreads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+		// Queue 0 belongs to whichever thread is not a worker
+		for (int i = 0; i < nThreads; i++)
+			queues.emplace_back(new Queue());
+		for (int i = 1; i < nThreads; i++)
+			workers.emplace_back(&JobSystem::WorkerLoop, this, static_cast<size_t>(i));
+	}
+
+	~JobSystem()
+	{
+		{
+			std::lock_guard<std::mutex> lock(sleepMutex);
+			bStopping = true;
+		}
+		jobAvailable.notify_all();
+		for (std::thread& worker : workers)
+			worker.join();
+	}
+
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator=(const JobSystem&) = delete;
+
+	// Threads that run jobs, the calling thread included
+	size_t ThreadCount() const { return workers.size() + 1; }
+
+	// Call body over [0, count) in ranges of grain and return when all of them are done
+	// Ranges start at multiples of grain, so a body can tell which range it has from begin / grain
+	void ParallelFor(size_t count, size_t grain, const RangeFunction& body)
+	{
+		grain = std::max<size_t>(grain, 1);
+		if (count == 0) return;
+		if (count <= grain || workers.empty())
+		{
+			body(0, count);
+			return;
+		}
+		Counter counter;
+		Dispatch(count, grain, body, counter);
+		Wait(counter);
+	}
+
+	// Call task(0) .. task(count - 1) and return when all of them are done, for work already split into count parts
+	template <typename Task>
+	void RunTasks(size_t count, const Task& task)
+	{
+		ParallelFor(count, 1, [&task](size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; i++)
+				task(i);
+		});
+	}
+
+	// Queue body over [0, count) in ranges of grain and return right away
+	// body and counter must stay alive until the counter reaches zero, count must not be zero
+	void Dispatch(size_t count, size_t grain, const RangeFunction& body, Counter& counter)
+	{
+		grain = std::max<size_t>(grain, 1);
+		size_t nJobs = (count + grain - 1) / grain;
+		counter.remaining.store(nJobs);
+
+		Queue& queue = *queues[ThreadIndex()];
+		{
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			// The owner takes from the back, so the first range is run first here and stolen last
+			for (size_t job = nJobs; job-- > 0;)
+				queue.jobs.push_back(Job{ &body, job * grain, std::min(count, (job + 1) * grain), &counter });
+		}
+		queuedJobs.fetch_add(nJobs);
+		{
+			std::lock_guard<std::mutex> lock(sleepMutex);
+		}
+		if (nJobs > 1) jobAvailable.notify_all();
+		else jobAvailable.notify_one();
+	}
+
+	// Run jobs until the counter reaches zero
+	void Wait(const Counter& counter)
+	{
+		size_t index = ThreadIndex();
+		while (counter.remaining.load() > 0)
+		{
+			Job job;
+			if (TryTakeJob(index, job)) Run(job);
+			else std::this_thread::yield();
+		}
+	}
+
+private:
+	struct Job
+	{
+		const RangeFunction* body;
+		size_t begin, end;
+		Counter* counter;
+	};
+
+	struct Queue
+	{
+		std::mutex mutex;
+		std::deque<Job> jobs;
+	};
+
+	// Index of the calling thread's queue, 0 for every thread that is not a worker
+	static size_t& ThreadIndex()
+	{
+		static thread_local size_t index = 0;
+		return index;
+	}
+
+	bool TryTakeJob(size_t index, Job& job)
+	{
+		if (queuedJobs.load() == 0) return false;
+		{
+			Queue& own = *queues[index];
+			std::lock_guard<std::mutex> lock(own.mutex);
+			if (!own.jobs.empty())
+			{
+				job = own.jobs.back();
+				own.jobs.pop_back();
+				queuedJobs.fetch_sub(1);
+				return true;
+			}
+		}
+		for (size_t i = 1; i < queues.size(); i++)
+		{
+			Queue& victim = *queues[(index + i) % queues.size()];
+			std::lock_guard<std::mutex> lock(victim.mutex);
+			if (victim.jobs.empty()) continue;
+			job = victim.jobs.front();
+			victim.jobs.pop_front();
+			queuedJobs.fetch_sub(1);
+			return true;
+		}
+		return false;
+	}
+
+	static void Run(const Job& job)
+	{
+		(*job.body)(job.begin, job.end);
+		// A waiter may destroy the counter as soon as it reaches zero, read the callback first
+		const std::function<void()>* onDone = job.counter->onDone;
+		if (job.counter->remaining.fetch_sub(1) == 1 && onDone) (*onDone)();
+	}
+
+	void WorkerLoop(size_t index)
+	{
+		ThreadIndex() = index;
+		for (;;)
+		{
+			Job job;
+			if (TryTakeJob(index, job))
+			{
+				Run(job);
+				continue;
+			}
+			std::unique_lock<std::mutex> lock(sleepMutex);
+			jobAvailable.wait(lock, [this] { return bStopping || queuedJobs.load() > 0; });
+			if (bStopping) return;
+		}
+	}
+
+	std::vector<std::unique_ptr<Queue>> queues;
+	std::atomic<size_t> queuedJobs{ 0 };
+
+	std::mutex sleepMutex;
+	std::condition_variable jobAvailable;
+	bool bStopping = false;
+
+	std::vector<std::thread> workers;
+};
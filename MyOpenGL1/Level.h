@@ -1,15 +1,19 @@
 ﻿#pragma once
+#include "EntityStore.h"
+#include "MeshRegistry.h"
 #include "Types.h"
 
 class Level
 {
 public:
-    std::vector<Entity*> entities;
+    std::vector<EntityId> entities;
     Transformation playerStart;
     Transformation cameraPosition;
     std::string levelName;
 
-    Level(std::string levelFile)
+    // Entity meshes are resolved through the registry, so repeated files are only loaded once
+    // The entities themselves go into the store, the level keeps their ids
+    Level(std::string levelFile, MeshRegistry& meshes, EntityStore& store)
     {
         std::ifstream in;
         in.open(levelFile);
@@ -41,36 +45,36 @@ public:
 
         for (int i = 0; i < nEntities; i++)
         {
-            Entity* entity = new Entity();
+            Entity entity;
             std::string fileName;
             in
         		>> fileName;
 
             in
-                >> entity->transformation.x
-                >> entity->transformation.y
-                >> entity->transformation.z
-                >> entity->transformation.pitch
-                >> entity->transformation.yaw
-                >> entity->transformation.roll;
+                >> entity.transformation.x
+                >> entity.transformation.y
+                >> entity.transformation.z
+                >> entity.transformation.pitch
+                >> entity.transformation.yaw
+                >> entity.transformation.roll;
 
             in
-                >> entity->collision.x_relative
-                >> entity->collision.y_relative
-                >> entity->collision.z_relative
-                >> entity->collision.x_size
-                >> entity->collision.y_size
-                >> entity->collision.z_size;
+                >> entity.collision.x_relative
+                >> entity.collision.y_relative
+                >> entity.collision.z_relative
+                >> entity.collision.x_size
+                >> entity.collision.y_size
+                >> entity.collision.z_size;
 
             in
-                >> entity->RadiusCollisionSize;
+                >> entity.RadiusCollisionSize;
 
-            if (entity->RadiusCollisionSize > 0.0f) entity->bHasRadiusCollision = true;
+            if (entity.RadiusCollisionSize > 0.0f) entity.bHasRadiusCollision = true;
+            if (entity.collision.x_size > 0.0f && entity.collision.z_size > 0.0f) entity.bHasBoxCollision = true;
 
-            ObjectFileReturnInfo objectLoadReturn = ReadObjectFile(fileName, entity->vertices, entity->indices);
-            objectLoadReturn.print();
+            entity.mesh = meshes.Load(fileName);
 
-            entities.push_back(entity);
+            entities.push_back(store.Create(entity));
         }
     }
 };
\ No newline at end of file
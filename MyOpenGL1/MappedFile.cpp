@@ -0,0 +1,171 @@
+#include "MappedFile.h"
+
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+{
+	Swap(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+	if (this != &other)
+	{
+		Close();
+		Swap(other);
+	}
+	return *this;
+}
+
+void MappedFile::Swap(MappedFile& other) noexcept
+{
+	std::swap(data, other.data);
+	std::swap(size, other.size);
+	std::swap(bIsOpen, other.bIsOpen);
+#ifdef _WIN32
+	std::swap(fileHandle, other.fileHandle);
+	std::swap(mappingHandle, other.mappingHandle);
+#else
+	std::swap(fileDescriptor, other.fileDescriptor);
+#endif
+}
+
+#ifdef _WIN32
+
+bool MappedFile::GetFileInfo(const std::string& filePath, uint64_t& size, int64_t& modifiedTime)
+{
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	if (!GetFileAttributesExA(filePath.c_str(), GetFileExInfoStandard, &attributes)) return false;
+	size = (static_cast<uint64_t>(attributes.nFileSizeHigh) << 32) | attributes.nFileSizeLow;
+	modifiedTime = static_cast<int64_t>((static_cast<uint64_t>(attributes.ftLastWriteTime.dwHighDateTime) << 32) | attributes.ftLastWriteTime.dwLowDateTime);
+	return true;
+}
+
+bool MappedFile::Open(const std::string& filePath)
+{
+	Close();
+
+	HANDLE file = CreateFileA(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE) return false;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize))
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	fileHandle = file;
+	size = static_cast<size_t>(fileSize.QuadPart);
+	bIsOpen = true;
+
+	// Empty files can not be mapped, but are still valid files
+	if (size == 0)
+	{
+		data = "";
+		return true;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping == NULL)
+	{
+		Close();
+		return false;
+	}
+	mappingHandle = mapping;
+
+	data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+	if (data == nullptr)
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (data != nullptr && size > 0) UnmapViewOfFile(data);
+	if (mappingHandle != nullptr) CloseHandle(mappingHandle);
+	if (fileHandle != nullptr) CloseHandle(fileHandle);
+	data = nullptr;
+	size = 0;
+	bIsOpen = false;
+	mappingHandle = nullptr;
+	fileHandle = nullptr;
+}
+
+#else
+
+bool MappedFile::GetFileInfo(const std::string& filePath, uint64_t& size, int64_t& modifiedTime)
+{
+	struct stat fileInfo;
+	if (stat(filePath.c_str(), &fileInfo) != 0) return false;
+	size = static_cast<uint64_t>(fileInfo.st_size);
+	modifiedTime = static_cast<int64_t>(fileInfo.st_mtim.tv_sec) * 1000000000 + fileInfo.st_mtim.tv_nsec;
+	return true;
+}
+
+bool MappedFile::Open(const std::string& filePath)
+{
+	Close();
+
+	int fd = open(filePath.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+
+	struct stat fileInfo;
+	if (fstat(fd, &fileInfo) != 0)
+	{
+		close(fd);
+		return false;
+	}
+
+	fileDescriptor = fd;
+	size = static_cast<size_t>(fileInfo.st_size);
+	bIsOpen = true;
+
+	// Empty files can not be mapped, but are still valid files
+	if (size == 0)
+	{
+		data = "";
+		return true;
+	}
+
+	void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (mapping == MAP_FAILED)
+	{
+		Close();
+		return false;
+	}
+	madvise(mapping, size, MADV_SEQUENTIAL);
+	data = static_cast<const char*>(mapping);
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (data != nullptr && size > 0) munmap(const_cast<char*>(data), size);
+	if (fileDescriptor >= 0) close(fileDescriptor);
+	data = nullptr;
+	size = 0;
+	bIsOpen = false;
+	fileDescriptor = -1;
+}
+
+#endif
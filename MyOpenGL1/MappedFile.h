@@ -0,0 +1,43 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Read-only memory mapping of a whole file
+// The mapped bytes stay valid until the file is closed or the object is destroyed
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	MappedFile(MappedFile&& other) noexcept;
+	MappedFile& operator=(MappedFile&& other) noexcept;
+
+	// Size and last write time of a file without opening it, returns false if it does not exist
+	// The time is only meant to be compared against other values from this function
+	static bool GetFileInfo(const std::string& filePath, uint64_t& size, int64_t& modifiedTime);
+
+	// Map the file at filePath, returns false if it could not be opened
+	bool Open(const std::string& filePath);
+	void Close();
+
+	bool IsOpen() const { return bIsOpen; }
+	const char* Data() const { return data; }
+	size_t Size() const { return size; }
+
+private:
+	void Swap(MappedFile& other) noexcept;
+
+	const char* data = nullptr;
+	size_t size = 0;
+	bool bIsOpen = false;
+#ifdef _WIN32
+	void* fileHandle = nullptr;
+	void* mappingHandle = nullptr;
+#else
+	int fileDescriptor = -1;
+#endif
+};
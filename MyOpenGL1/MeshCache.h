@@ -0,0 +1,163 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "MappedFile.h"
+#include "Types.h"
+
+// Binary header of a cooked mesh, followed by the raw vertex and index arrays
+// Arrays start on kAlignment byte boundaries so the mapped file can be handed straight to glBufferData
+struct CookedMeshHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t vertexSize;
+	uint32_t flags;
+
+	// Source file the mesh was cooked from
+	uint64_t sourceSize;
+	int64_t sourceModifiedTime;
+	uint64_t sourceHash;
+
+	uint64_t vertexOffset;
+	uint64_t vertexCount;
+	uint64_t indexOffset;
+	uint64_t indexCount;
+
+	// Statistics from the original load, reported again on cache hits
+	int32_t nSourceVertices;
+	int32_t nFaces;
+	int32_t nObjects;
+	int32_t nCorners;
+};
+
+// A cooked mesh mapped into memory, valid for as long as this object lives
+struct CookedMeshView
+{
+	MappedFile file;
+	const CookedMeshHeader* header = nullptr;
+	const Vertex* vertices = nullptr;
+	const int* indices = nullptr;
+	size_t vertexCount = 0;
+	size_t indexCount = 0;
+};
+
+// Reads and writes cooked meshes, stored next to their source as <source>.mesh
+class MeshCache
+{
+public:
+	static const uint32_t kVersion = 2;
+	static constexpr uint64_t kAlignment = 64;
+
+	static const uint32_t kFlagHasTextureData = 1;
+	static const uint32_t kFlagHasNormalData = 2;
+	static const uint32_t kFlagDeduplicated = 4;
+	// The source had no normals, the cooked vertices carry smooth normals made by MeshNormals
+	static const uint32_t kFlagGeneratedNormals = 8;
+
+	static std::string CookedPath(const std::string& sourcePath)
+	{
+		return sourcePath + ".mesh";
+	}
+
+	// Fast 64-bit hash of the source bytes, reads eight bytes at a time
+	static uint64_t HashBytes(const char* data, size_t size)
+	{
+		const uint64_t kMultiplier = 0x9E3779B97F4A7C15ull;
+		uint64_t hash = size * kMultiplier;
+		size_t i = 0;
+		for (; i + 8 <= size; i += 8)
+		{
+			uint64_t word;
+			memcpy(&word, data + i, 8);
+			hash = (hash ^ word) * kMultiplier;
+			hash ^= hash >> 32;
+		}
+		uint64_t tail = 0;
+		memcpy(&tail, data + i, size - i);
+		hash = (hash ^ tail) * kMultiplier;
+		return hash ^ (hash >> 29);
+	}
+
+	static uint64_t AlignOffset(uint64_t offset)
+	{
+		return (offset + kAlignment - 1) / kAlignment * kAlignment;
+	}
+
+	// Map a cooked mesh, fails if it is missing, damaged, has indices past its vertices or was cooked from a different source
+	// The source is only read and hashed when its size or modification time differ from the ones it was cooked from,
+	// so a source that was touched but not changed still hits
+	static bool Open(const std::string& cookedPath, const std::string& sourcePath, uint64_t sourceSize, int64_t sourceModifiedTime, uint32_t requiredFlags, CookedMeshView& view)
+	{
+		if (!view.file.Open(cookedPath)) return false;
+		if (view.file.Size() < sizeof(CookedMeshHeader)) return false;
+
+		const CookedMeshHeader* header = reinterpret_cast<const CookedMeshHeader*>(view.file.Data());
+		if (memcmp(header->magic, "MESH", 4) != 0) return false;
+		if (header->version != kVersion || header->vertexSize != sizeof(Vertex)) return false;
+		if ((header->flags & kFlagDeduplicated) != (requiredFlags & kFlagDeduplicated)) return false;
+		if (header->sourceSize != sourceSize) return false;
+		if (header->sourceModifiedTime != sourceModifiedTime)
+		{
+			MappedFile source;
+			if (!source.Open(sourcePath) || HashBytes(source.Data(), source.Size()) != header->sourceHash) return false;
+		}
+
+		uint64_t fileSize = view.file.Size();
+		if (header->vertexOffset % kAlignment != 0 || header->indexOffset % kAlignment != 0) return false;
+		if (header->vertexOffset > fileSize || header->vertexCount > (fileSize - header->vertexOffset) / sizeof(Vertex)) return false;
+		if (header->indexOffset > fileSize || header->indexCount > (fileSize - header->indexOffset) / sizeof(int)) return false;
+
+		// A damaged index would have the GPU read past the vertex buffer, such a file is parsed from the source again
+		const int* indices = reinterpret_cast<const int*>(view.file.Data() + header->indexOffset);
+		for (uint64_t i = 0; i < header->indexCount; i++)
+		{
+			if (indices[i] < 0 || static_cast<uint64_t>(indices[i]) >= header->vertexCount) return false;
+		}
+
+		view.header = header;
+		view.vertices = reinterpret_cast<const Vertex*>(view.file.Data() + header->vertexOffset);
+		view.indices = indices;
+		view.vertexCount = static_cast<size_t>(header->vertexCount);
+		view.indexCount = static_cast<size_t>(header->indexCount);
+		return true;
+	}
+
+	// Write a cooked mesh, indices must be relative to the first vertex
+	// Writes to a temporary file first so a crash never leaves a half written cache behind
+	static bool Write(const std::string& cookedPath, CookedMeshHeader header, const Vertex* vertices, size_t vertexCount, const int* indices, size_t indexCount)
+	{
+		memcpy(header.magic, "MESH", 4);
+		header.version = kVersion;
+		header.vertexSize = sizeof(Vertex);
+		header.vertexCount = vertexCount;
+		header.indexCount = indexCount;
+		header.vertexOffset = AlignOffset(sizeof(CookedMeshHeader));
+		header.indexOffset = AlignOffset(header.vertexOffset + vertexCount * sizeof(Vertex));
+
+		std::string temporaryPath = cookedPath + ".tmp";
+		std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+		if (!file.is_open()) return false;
+
+		static const char padding[kAlignment] = {};
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(padding, header.vertexOffset - sizeof(header));
+		file.write(reinterpret_cast<const char*>(vertices), vertexCount * sizeof(Vertex));
+		file.write(padding, header.indexOffset - header.vertexOffset - vertexCount * sizeof(Vertex));
+		file.write(reinterpret_cast<const char*>(indices), indexCount * sizeof(int));
+		file.close();
+		bool bWritten = !file.fail();
+
+		if (bWritten)
+		{
+			std::remove(cookedPath.c_str());
+			bWritten = std::rename(temporaryPath.c_str(), cookedPath.c_str()) == 0;
+		}
+		if (!bWritten) std::remove(temporaryPath.c_str());
+		return bWritten;
+	}
+};
@@ -0,0 +1,138 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "JobSystem.h"
+#include "Types.h"
+
+// Smooth vertex normals for indexed triangle meshes
+// Every vertex gets the area weighted average of the face normals around it
+// Normals are summed in face order whatever the number of threads, so the result is always the same
+class MeshNormals
+{
+public:
+	// Fill in the normals of vertices[firstVertex] onwards from the triangles in indices
+	// Indices point into the whole vertices array, vertices no triangle uses get a zero normal
+	// Large meshes are split over jobs when given a JobSystem, small ones and those without stay on the calling thread
+	static void GenerateSmooth(std::vector<Vertex>& vertices, const int* indices, size_t indexCount, size_t firstVertex = 0, JobSystem* jobs = nullptr)
+	{
+		size_t nFaces = indexCount / 3;
+		size_t nVertices = vertices.size() - firstVertex;
+		size_t nTasks = jobs != nullptr ? std::max<size_t>(1, std::min(jobs->ThreadCount(), nFaces / kMinFacesPerTask)) : 1;
+		if (nTasks < kMinThreads) nTasks = 1;
+		Vertex* first = vertices.data() + firstVertex;
+
+		// The scatter is bound by memory on one thread, a plain loop over the triangles is as fast as anything batched
+		if (nTasks == 1)
+		{
+			ClearNormals(first, first + nVertices);
+			for (size_t face = 0; face < nFaces; face++)
+			{
+				glm::vec3 normal = FaceNormal(vertices.data(), indices + face * 3);
+				for (int corner = 0; corner < 3; corner++)
+				{
+					Vertex& vertex = vertices[indices[face * 3 + corner]];
+					vertex.nx += normal.x; vertex.ny += normal.y; vertex.nz += normal.z;
+				}
+			}
+			Normalize(first, first + nVertices);
+			return;
+		}
+
+		// The vertices are split into buckets and every face is listed, in face order, in each bucket it has a corner in
+		// Each bucket is then added up by one task alone, so no two tasks write the same vertex
+		// Bucket sizes are a power of two so a corner's bucket is a shift, with up to two buckets per task
+		int bucketShift = 0;
+		while ((nVertices >> bucketShift) >= 2 * nTasks) bucketShift++;
+		size_t nBuckets = (nVertices >> bucketShift) + 1;
+		// The faces of each face range in each bucket, at bucket * nTasks + task
+		std::vector<std::vector<uint32_t>> bucketFaces(nBuckets * nTasks);
+		jobs->RunTasks(nTasks, [&](size_t task)
+		{
+			size_t begin = nFaces * task / nTasks, end = nFaces * (task + 1) / nTasks;
+			size_t buckets[3];
+			for (size_t face = begin; face < end; face++)
+			{
+				int nFaceBuckets = FaceBuckets(indices + face * 3, firstVertex, nVertices, bucketShift, buckets);
+				for (int i = 0; i < nFaceBuckets; i++)
+					bucketFaces[buckets[i] * nTasks + task].push_back(static_cast<uint32_t>(face));
+			}
+		});
+
+		jobs->RunTasks(nBuckets, [&](size_t bucket)
+		{
+			size_t begin = std::min(nVertices, bucket << bucketShift) + firstVertex;
+			size_t end = std::min(nVertices, (bucket + 1) << bucketShift) + firstVertex;
+			ClearNormals(vertices.data() + begin, vertices.data() + end);
+			for (size_t task = 0; task < nTasks; task++)
+			{
+				for (uint32_t face : bucketFaces[bucket * nTasks + task])
+				{
+					glm::vec3 normal = FaceNormal(vertices.data(), indices + face * 3);
+					for (int corner = 0; corner < 3; corner++)
+					{
+						size_t index = static_cast<size_t>(indices[face * 3 + corner]);
+						if (index - begin >= end - begin) continue;
+						Vertex& vertex = vertices[index];
+						vertex.nx += normal.x; vertex.ny += normal.y; vertex.nz += normal.z;
+					}
+				}
+			}
+			Normalize(vertices.data() + begin, vertices.data() + end);
+		});
+	}
+
+private:
+	static constexpr size_t kMinFacesPerTask = 16384;
+	// Sorting faces into buckets costs about as much as adding them up, it only pays off on several threads
+	enum { kMinThreads = 4 };
+
+	// Not normalized, the length of the cross product weighs the normal by triangle area
+	static glm::vec3 FaceNormal(const Vertex* vertices, const int* corners)
+	{
+		const Vertex& a = vertices[corners[0]];
+		const Vertex& b = vertices[corners[1]];
+		const Vertex& c = vertices[corners[2]];
+		return glm::cross(glm::vec3(b.x - a.x, b.y - a.y, b.z - a.z), glm::vec3(c.x - a.x, c.y - a.y, c.z - a.z));
+	}
+
+	// The distinct buckets the corners of a face are in, corners outside the vertices being filled in are left out
+	static int FaceBuckets(const int* corners, size_t firstVertex, size_t nVertices, int bucketShift, size_t buckets[3])
+	{
+		int count = 0;
+		for (int corner = 0; corner < 3; corner++)
+		{
+			size_t vertex = static_cast<size_t>(corners[corner]) - firstVertex;
+			if (vertex >= nVertices) continue;
+			size_t bucket = vertex >> bucketShift;
+			if ((count > 0 && buckets[0] == bucket) || (count > 1 && buckets[1] == bucket)) continue;
+			buckets[count++] = bucket;
+		}
+		return count;
+	}
+
+	static void ClearNormals(Vertex* begin, Vertex* end)
+	{
+		for (Vertex* vertex = begin; vertex < end; vertex++)
+		{
+			vertex->nx = 0.0f; vertex->ny = 0.0f; vertex->nz = 0.0f;
+		}
+	}
+
+	static void Normalize(Vertex* begin, Vertex* end)
+	{
+		for (Vertex* vertex = begin; vertex < end; vertex++)
+		{
+			float length = sqrtf(vertex->nx * vertex->nx + vertex->ny * vertex->ny + vertex->nz * vertex->nz);
+			if (length > 0.0f)
+			{
+				vertex->nx /= length; vertex->ny /= length; vertex->nz /= length;
+			}
+		}
+	}
+};
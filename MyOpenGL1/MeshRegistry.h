@@ -0,0 +1,238 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "MeshNormals.h"
+#include "ObjectFileLoader.h"
+#include "Types.h"
+
+// Owns every mesh in the program, so identical meshes are loaded and uploaded once
+// Meshes are reference counted, every MeshHandle returned by Load, Create or AddReference must be released once
+class MeshRegistry
+{
+public:
+	// Load an .obj file, or take another reference to it if it is already loaded
+	MeshHandle Load(const std::string& fileName, const ObjectFileReadSettings& settings = ObjectFileReadSettings())
+	{
+		auto existing = handlesByName.find(fileName);
+		if (existing != handlesByName.end())
+			return AddReference(existing->second);
+
+		MeshHandle handle = Allocate(fileName);
+		Mesh& mesh = Get(handle);
+		// A cooked mesh stays mapped until it is uploaded, its arrays go to the GPU from the file without a copy
+		std::shared_ptr<CookedMeshView> cooked(new CookedMeshView());
+		ObjectFileReturnInfo info;
+		if (OpenCookedObjectFile(fileName, settings, *cooked, info))
+		{
+			mesh.cooked = cooked;
+			ComputeBounds(mesh, cooked->vertices, cooked->vertexCount);
+		}
+		else
+		{
+			info = ReadObjectFile(fileName, mesh.vertices, mesh.indices, settings);
+			ComputeBounds(mesh);
+		}
+		// The loader fills in normals, from the file or generated and cached with the cooked mesh
+		mesh.bHasNormals = info.bSuccess;
+		if (!settings.bQuiet) info.print();
+		handlesByName[fileName] = handle;
+		return handle;
+	}
+
+	// Create an empty mesh for generated geometry, the name is only used for logging
+	MeshHandle Create(const std::string& name)
+	{
+		return Allocate(name);
+	}
+
+	MeshHandle AddReference(MeshHandle handle)
+	{
+		Get(handle).referenceCount++;
+		return handle;
+	}
+
+	// Drop a reference, the mesh and its GPU buffers are freed with the last one
+	void Release(MeshHandle handle)
+	{
+		Mesh& mesh = Get(handle);
+		if (--mesh.referenceCount > 0) return;
+
+		DeleteBuffers(mesh);
+		auto named = handlesByName.find(mesh.name);
+		if (named != handlesByName.end() && named->second == handle)
+			handlesByName.erase(named);
+		meshes[handle].reset();
+		freeHandles.push_back(handle);
+	}
+
+	Mesh& Get(MeshHandle handle) { return *meshes[handle]; }
+	const Mesh& Get(MeshHandle handle) const { return *meshes[handle]; }
+
+	bool IsValid(MeshHandle handle) const { return handle < meshes.size() && meshes[handle] != nullptr; }
+
+	// Number of meshes currently alive
+	size_t Count() const { return meshes.size() - freeHandles.size(); }
+
+	// One past the highest handle ever given out, for tables indexed by MeshHandle
+	size_t HandleCount() const { return meshes.size(); }
+
+	// Create the vertex array and buffers for every mesh that does not have them yet
+	// Needs a current OpenGL context
+	void UploadAll()
+	{
+		for (size_t i = 0; i < meshes.size(); i++)
+		{
+			if (meshes[i] != nullptr && !meshes[i]->bIsUploaded)
+				Upload(*meshes[i]);
+		}
+	}
+
+	void Upload(Mesh& mesh, bool bLog = true)
+	{
+		if (!mesh.bHasNormals) MeshNormals::GenerateSmooth(mesh.vertices, mesh.indices.data(), mesh.indices.size());
+		if (!mesh.bHasBounds) ComputeBounds(mesh);
+
+		const Vertex* vertices = mesh.vertices.data();
+		size_t vertexCount = mesh.vertices.size();
+		const int* indices = mesh.indices.data();
+		mesh.indexCount = mesh.indices.size();
+		if (mesh.cooked != nullptr)
+		{
+			vertices = mesh.cooked->vertices;
+			vertexCount = mesh.cooked->vertexCount;
+			indices = mesh.cooked->indices;
+			mesh.indexCount = mesh.cooked->indexCount;
+		}
+
+		glGenVertexArrays(1, &mesh.VAO);
+		glBindVertexArray(mesh.VAO);
+
+		glGenBuffers(1, &mesh.VBO);
+		glBindBuffer(GL_ARRAY_BUFFER, mesh.VBO);
+		glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(Vertex), vertices, GL_STATIC_DRAW);
+
+		glGenBuffers(1, &mesh.EBO);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.EBO);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh.indexCount * sizeof(int), indices, GL_STATIC_DRAW);
+
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(float), (void*)0);
+		glEnableVertexAttribArray(0);
+
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(float), (void*)(3 * sizeof(float)));
+		glEnableVertexAttribArray(1);
+
+		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 11 * sizeof(float), (void*)(6 * sizeof(float)));
+		glEnableVertexAttribArray(2);
+
+		glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(float), (void*)(8 * sizeof(float)));
+		glEnableVertexAttribArray(3);
+
+		// Instance matrices, a mat4 attribute takes one location per column
+		glGenBuffers(1, &mesh.instanceVBO);
+		glBindBuffer(GL_ARRAY_BUFFER, mesh.instanceVBO);
+		for (int column = 0; column < 4; column++)
+		{
+			glVertexAttribPointer(4 + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(column * sizeof(glm::vec4)));
+			glEnableVertexAttribArray(4 + column);
+			glVertexAttribDivisor(4 + column, 1);
+		}
+
+		glBindVertexArray(0);
+
+		// The GPU has its own copy now
+		mesh.cooked.reset();
+		mesh.bIsUploaded = true;
+		if (bLog) std::cout << "Uploaded mesh " << mesh.name << " (" << vertexCount << " verts) to VAO " << mesh.VAO << std::endl;
+	}
+
+	// Fill in the bounding box and sphere of a mesh from its vertices
+	static void ComputeBounds(Mesh& mesh)
+	{
+		ComputeBounds(mesh, mesh.vertices.data(), mesh.vertices.size());
+	}
+
+	// Same for vertices that are not in mesh.vertices, like those of a mapped cooked mesh
+	static void ComputeBounds(Mesh& mesh, const Vertex* vertices, size_t vertexCount)
+	{
+		mesh.bHasBounds = true;
+		if (vertexCount == 0)
+		{
+			mesh.boundsMin = mesh.boundsMax = mesh.boundsCenter = glm::vec3(0.0f);
+			mesh.boundsRadius = 0.0f;
+			return;
+		}
+		glm::vec3 boundsMin(vertices[0].x, vertices[0].y, vertices[0].z), boundsMax = boundsMin;
+		for (const Vertex* vertex = vertices; vertex != vertices + vertexCount; ++vertex)
+		{
+			glm::vec3 position(vertex->x, vertex->y, vertex->z);
+			boundsMin = glm::min(boundsMin, position);
+			boundsMax = glm::max(boundsMax, position);
+		}
+		// Centered on the box, but only as large as the farthest vertex, which is usually well inside the box's corners
+		glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+		float radiusSquared = 0.0f;
+		for (const Vertex* vertex = vertices; vertex != vertices + vertexCount; ++vertex)
+		{
+			glm::vec3 offset = glm::vec3(vertex->x, vertex->y, vertex->z) - center;
+			radiusSquared = std::max(radiusSquared, glm::dot(offset, offset));
+		}
+		mesh.boundsMin = boundsMin;
+		mesh.boundsMax = boundsMax;
+		mesh.boundsCenter = center;
+		mesh.boundsRadius = sqrtf(radiusSquared);
+	}
+
+	// Free the GPU buffers of every mesh, must happen before the OpenGL context goes away
+	void DeleteAllBuffers()
+	{
+		for (std::unique_ptr<Mesh>& mesh : meshes)
+		{
+			if (mesh != nullptr) DeleteBuffers(*mesh);
+		}
+	}
+
+private:
+	MeshHandle Allocate(const std::string& name)
+	{
+		MeshHandle handle;
+		if (!freeHandles.empty())
+		{
+			handle = freeHandles.back();
+			freeHandles.pop_back();
+		}
+		else
+		{
+			handle = static_cast<MeshHandle>(meshes.size());
+			meshes.emplace_back();
+		}
+		meshes[handle].reset(new Mesh());
+		meshes[handle]->name = name;
+		meshes[handle]->referenceCount = 1;
+		return handle;
+	}
+
+	static void DeleteBuffers(Mesh& mesh)
+	{
+		if (!mesh.bIsUploaded) return;
+		glDeleteVertexArrays(1, &mesh.VAO);
+		glDeleteBuffers(1, &mesh.VBO);
+		glDeleteBuffers(1, &mesh.EBO);
+		glDeleteBuffers(1, &mesh.instanceVBO);
+		mesh.VAO = mesh.VBO = mesh.EBO = mesh.instanceVBO = 0;
+		mesh.bIsUploaded = false;
+	}
+
+	// Meshes are kept behind pointers so references from Get stay valid while new meshes are added
+	std::vector<std::unique_ptr<Mesh>> meshes;
+	std::vector<MeshHandle> freeHandles;
+	std::unordered_map<std::string, MeshHandle> handlesByName;
+};
@@ -1,28 +1,703 @@
 ﻿#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <vector>
+
+#include "JobSystem.h"
+#include "MappedFile.h"
+#include "MeshCache.h"
+#include "MeshNormals.h"
+#include "Types.h"
 
 struct ObjectFileReturnInfo
 {
     bool bHasTextureData = false;
     bool bHasNormalData = false;
     bool bSuccess = false;
+    bool bLoadedFromCache = false;
     int nVertices = 0;
     int nFaces = 0;
     int nObjects = 0;
+    // Face corners in the file and the vertices left after merging identical ones
+    int nCorners = 0;
+    int nUniqueVertices = 0;
+    float DedupRatio() const { return nUniqueVertices > 0 ? static_cast<float>(nCorners) / nUniqueVertices : 0.0f; }
     void print()
     {
         std::cout << "Object Properties" << std::endl;
         std::cout << "Loaded: " << bSuccess << std::endl;
+        std::cout << "Loaded From Cache: " << bLoadedFromCache << std::endl;
         std::cout << "Has Texture Data: " << bHasTextureData << std::endl;
         std::cout << "Has Normal Data: " << bHasNormalData << std::endl;
         std::cout << "Vertices: " << nVertices << std::endl;
         std::cout << "Faces: " << nFaces << std::endl;
         std::cout << "Meshes: " << nObjects << std::endl;
+        std::cout << "Unique Vertices: " << nUniqueVertices << " of " << nCorners << " corners (" << DedupRatio() << "x)" << std::endl;
     }
 };
 
-ObjectFileReturnInfo ReadObjectFile(std::string fileName, std::vector<Vertex>& vertices, std::vector<int>& indices)
+struct ObjectFileReadSettings
+{
+    // Do not log comments, objects, materials or the load summary
+    bool bQuiet = false;
+    // Threads used for parsing, 0 uses every core
+    int nThreads = 0;
+    // Parse on these threads instead, so loads can share the caller's JobSystem rather than start threads of their own
+    JobSystem* jobs = nullptr;
+    // Files are only split into chunks of at least this many bytes, so small files parse on one thread
+    size_t minChunkSize = 1024 * 1024;
+    // Share vertices between faces that use the same position, uv and normal
+    // When disabled every face corner gets its own vertex
+    bool bDeduplicate = true;
+    // Load from and save to a cooked binary copy next to the source file (see MeshCache)
+    bool bUseCache = true;
+};
+
+// Reads tokens straight out of a block of .obj text without allocating
+// Tokens never span lines, so a scanner can be pointed at any range of whole lines
+struct ObjectFileScanner
+{
+    const char* cursor;
+    const char* end;
+
+    ObjectFileScanner(const char* begin, const char* end) : cursor(begin), end(end) {}
+
+    static bool IsSpace(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f'; }
+    static bool IsDigit(char c) { return c >= '0' && c <= '9'; }
+    static bool IsDelimiter(char c) { return IsSpace(c) || c == '/'; }
+
+    bool AtEnd() const { return cursor >= end; }
+    bool AtLineEnd() const { return cursor >= end || *cursor == '\n' || *cursor == '\r'; }
+
+    // Skip spaces and tabs, but stay on the current line
+    void SkipSpaces()
+    {
+        while (cursor < end && (*cursor == ' ' || *cursor == '\t')) cursor++;
+    }
+
+    // Position of the newline ending the current line, or the end of the block
+    const char* LineEnd() const
+    {
+        if (cursor >= end) return end;
+        const char* newline = static_cast<const char*>(memchr(cursor, '\n', end - cursor));
+        return newline ? newline : end;
+    }
+
+    // Move to the first character of the next line
+    void NextLine()
+    {
+        const char* lineEnd = LineEnd();
+        cursor = lineEnd < end ? lineEnd + 1 : end;
+    }
+
+    // Read the first word of a line, returns false on blank lines
+    bool ReadKeyword(const char*& keyword, size_t& length)
+    {
+        SkipSpaces();
+        if (AtLineEnd()) return false;
+        keyword = cursor;
+        while (cursor < end && !IsSpace(*cursor)) cursor++;
+        length = cursor - keyword;
+        return true;
+    }
+
+    // Everything left on the current line, without surrounding whitespace
+    void RestOfLine(const char*& text, size_t& length)
+    {
+        SkipSpaces();
+        text = cursor;
+        const char* lineEnd = LineEnd();
+        while (lineEnd > text && IsSpace(lineEnd[-1])) lineEnd--;
+        length = lineEnd - text;
+    }
+
+    bool ReadInt(int& value)
+    {
+        SkipSpaces();
+        const char* p = cursor;
+        bool bNegative = false;
+        if (p < end && (*p == '-' || *p == '+')) bNegative = (*p++ == '-');
+        if (p >= end || !IsDigit(*p)) return false;
+        int result = 0;
+        while (p < end && IsDigit(*p)) result = result * 10 + (*p++ - '0');
+        value = bNegative ? -result : result;
+        cursor = p;
+        return true;
+    }
+
+    // Plain decimals with at most 24 bits of mantissa and a small exponent convert exactly
+    // with a single float multiply or divide, which covers what exporters write
+    // Anything else falls back to strtof so the result always matches the stream reader
+    bool ReadFloat(float& value)
+    {
+        static const float kPowersOf10[] = { 1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f };
+
+        SkipSpaces();
+        const char* p = cursor;
+        bool bNegative = false;
+        if (p < end && (*p == '-' || *p == '+')) bNegative = (*p++ == '-');
+
+        uint64_t mantissa = 0;
+        int nSignificantDigits = 0;
+        int exponent = 0;
+        bool bHasDigits = false;
+        while (p < end && IsDigit(*p))
+        {
+            int digit = *p++ - '0';
+            if (mantissa != 0 || digit != 0) nSignificantDigits++;
+            mantissa = mantissa * 10 + digit;
+            bHasDigits = true;
+            if (nSignificantDigits > 19) return ReadFloatSlow(value);
+        }
+        if (p < end && *p == '.')
+        {
+            p++;
+            while (p < end && IsDigit(*p))
+            {
+                int digit = *p++ - '0';
+                if (mantissa != 0 || digit != 0) nSignificantDigits++;
+                mantissa = mantissa * 10 + digit;
+                exponent--;
+                bHasDigits = true;
+                if (nSignificantDigits > 19) return ReadFloatSlow(value);
+            }
+        }
+        if (!bHasDigits) return ReadFloatSlow(value);
+        if (p < end && (*p == 'e' || *p == 'E'))
+        {
+            p++;
+            bool bNegativeExponent = false;
+            if (p < end && (*p == '-' || *p == '+')) bNegativeExponent = (*p++ == '-');
+            if (p >= end || !IsDigit(*p)) return ReadFloatSlow(value);
+            int explicitExponent = 0;
+            while (p < end && IsDigit(*p))
+            {
+                if (explicitExponent < 10000) explicitExponent = explicitExponent * 10 + (*p - '0');
+                p++;
+            }
+            exponent += bNegativeExponent ? -explicitExponent : explicitExponent;
+        }
+        if (p < end && !IsDelimiter(*p)) return ReadFloatSlow(value);
+
+        float result;
+        if (mantissa == 0)
+            result = 0.0f;
+        else if (mantissa <= (1u << 24) && exponent >= -10 && exponent <= 10)
+            result = exponent < 0
+                ? static_cast<float>(mantissa) / kPowersOf10[-exponent]
+                : static_cast<float>(mantissa) * kPowersOf10[exponent];
+        else
+            return ReadFloatSlow(value);
+
+        value = bNegative ? -result : result;
+        cursor = p;
+        return true;
+    }
+
+    bool ReadFloatSlow(float& value)
+    {
+        char buffer[64];
+        size_t length = 0;
+        while (cursor + length < end && !IsDelimiter(cursor[length]) && length < sizeof(buffer) - 1)
+        {
+            buffer[length] = cursor[length];
+            length++;
+        }
+        buffer[length] = '\0';
+        char* parsedEnd;
+        float result = strtof(buffer, &parsedEnd);
+        if (parsedEnd == buffer) return false;
+        value = result;
+        cursor += parsedEnd - buffer;
+        return true;
+    }
+
+    // Reads a face corner in the form v, v/vt, v//vn or v/vt/vn
+    // Missing indices are returned as 0, which is never a valid .obj index
+    bool ReadFaceCorner(int& vertexIndex, int& uvIndex, int& normalIndex)
+    {
+        uvIndex = 0;
+        normalIndex = 0;
+        if (!ReadInt(vertexIndex)) return false;
+        if (cursor < end && *cursor == '/')
+        {
+            cursor++;
+            if (cursor < end && *cursor != '/' && !IsSpace(*cursor) && !ReadInt(uvIndex)) return false;
+            if (cursor < end && *cursor == '/')
+            {
+                cursor++;
+                if (!ReadInt(normalIndex)) return false;
+            }
+        }
+        return true;
+    }
+};
+
+// Everything parsed out of one range of whole lines
+// Faces are fanned into triangles and stored as unresolved corners, since indices
+// can only be resolved once every chunk before this one has been counted
+struct ObjectFileChunk
+{
+    struct TempVertex
+    {
+        float x, y, z;
+        float r, g, b;
+    };
+
+    struct TempUV
+    {
+        float u, v;
+    };
+
+    struct TempNormal
+    {
+        float x, y, z;
+    };
+
+    // Indices as written in the file (1-based), 0 when missing
+    // Negative indices are stored relative to the start of the chunk and flagged in relativeMask
+    struct Corner
+    {
+        int vertex, uv, normal;
+        unsigned char relativeMask;
+    };
+    static const unsigned char kRelativeVertex = 1;
+    static const unsigned char kRelativeUV = 2;
+    static const unsigned char kRelativeNormal = 4;
+
+    const char* begin = nullptr;
+    const char* end = nullptr;
+
+    std::vector<TempVertex> vertex_vector;
+    std::vector<TempUV> uv_vector;
+    std::vector<TempNormal> normal_vector;
+    std::vector<Corner> corners;
+    int nFaces = 0;
+    int nObjects = 0;
+
+    // Where this chunk's data starts in the whole file, filled in between the two passes
+    size_t vertexOffset = 0;
+    size_t uvOffset = 0;
+    size_t normalOffset = 0;
+    size_t cornerOffset = 0;
+
+    bool bHasInvalidIndex = false;
+};
+
+// A face corner resolved to 0-based indices, -1 for a missing uv or normal
+struct ObjectFileCornerKey
+{
+    int vertex, uv, normal;
+
+    bool operator==(const ObjectFileCornerKey& other) const
+    {
+        return vertex == other.vertex && uv == other.uv && normal == other.normal;
+    }
+
+    size_t Hash() const
+    {
+        uint64_t hash = static_cast<uint32_t>(vertex) * 0x9E3779B97F4A7C15ull;
+        hash ^= static_cast<uint32_t>(uv) * 0xC2B2AE3D27D4EB4Full;
+        hash ^= static_cast<uint32_t>(normal) * 0x165667B19E3779F9ull;
+        return static_cast<size_t>(hash ^ (hash >> 29));
+    }
+};
+
+inline bool IsObjectFileKeyword(const char* keyword, size_t length, const char* expected)
+{
+    return strlen(expected) == length && memcmp(keyword, expected, length) == 0;
+}
+
+// Store an index from a face corner so it can be resolved after all chunks are parsed
+inline int ChunkRelativeObjectFileIndex(int index, size_t localCount, unsigned char relativeFlag, unsigned char& relativeMask)
+{
+    if (index >= 0) return index;
+    relativeMask |= relativeFlag;
+    return static_cast<int>(localCount) + index;
+}
+
+// Turn a stored corner index into a 0-based index into the whole file
+// Returns -1 if the index is missing and -2 if it is out of range
+inline long long ResolveObjectFileIndex(int index, bool bRelative, size_t chunkOffset, size_t count)
+{
+    if (!bRelative && index == 0) return -1;
+    long long resolved = bRelative ? static_cast<long long>(chunkOffset) + index : index - 1;
+    return (resolved >= 0 && resolved < static_cast<long long>(count)) ? resolved : -2;
+}
+
+// First pass, parse one range of lines without looking at any other chunk
+// Per line logging is only done when the whole file is a single chunk, so the output stays in order
+inline void ParseObjectFileChunk(ObjectFileChunk& chunk, bool bLog)
+{
+    ObjectFileScanner scanner(chunk.begin, chunk.end);
+    const char* keyword;
+    size_t length;
+    const char* text;
+    size_t textLength;
+
+    for (; !scanner.AtEnd(); scanner.NextLine())
+    {
+        if (!scanner.ReadKeyword(keyword, length)) continue;
+
+        if (IsObjectFileKeyword(keyword, length, "v")) {
+            // Vertex, optionally followed by a vertex color
+            ObjectFileChunk::TempVertex v{ 0.f, 0.f, 0.f, 0.f, 0.f, 0.f };
+            scanner.ReadFloat(v.x);
+            scanner.ReadFloat(v.y);
+            scanner.ReadFloat(v.z);
+            if (scanner.ReadFloat(v.r))
+            {
+                scanner.ReadFloat(v.g);
+                scanner.ReadFloat(v.b);
+            }
+            chunk.vertex_vector.push_back(v);
+        }
+        else if (IsObjectFileKeyword(keyword, length, "vt")) {
+            // Vertex Texture (UV)
+            ObjectFileChunk::TempUV uv{ 0.f, 0.f };
+            scanner.ReadFloat(uv.u);
+            scanner.ReadFloat(uv.v);
+            chunk.uv_vector.push_back(uv);
+        }
+        else if (IsObjectFileKeyword(keyword, length, "vn")) {
+            // Normal data
+            ObjectFileChunk::TempNormal normal{ 0.f, 0.f, 0.f };
+            scanner.ReadFloat(normal.x);
+            scanner.ReadFloat(normal.y);
+            scanner.ReadFloat(normal.z);
+            chunk.normal_vector.push_back(normal);
+        }
+        else if (IsObjectFileKeyword(keyword, length, "f")) {
+            // Go over each point in the face, fanning out from the first corner
+            ObjectFileChunk::Corner first{}, previous{};
+            int nCorners = 0;
+            int vertexIndex, uvIndex, normalIndex;
+            while (scanner.ReadFaceCorner(vertexIndex, uvIndex, normalIndex))
+            {
+                ObjectFileChunk::Corner corner{};
+                corner.vertex = ChunkRelativeObjectFileIndex(vertexIndex, chunk.vertex_vector.size(), ObjectFileChunk::kRelativeVertex, corner.relativeMask);
+                corner.uv = ChunkRelativeObjectFileIndex(uvIndex, chunk.uv_vector.size(), ObjectFileChunk::kRelativeUV, corner.relativeMask);
+                corner.normal = ChunkRelativeObjectFileIndex(normalIndex, chunk.normal_vector.size(), ObjectFileChunk::kRelativeNormal, corner.relativeMask);
+
+                if (nCorners == 0) first = corner;
+                else if (nCorners >= 2)
+                {
+                    chunk.corners.push_back(first);
+                    chunk.corners.push_back(previous);
+                    chunk.corners.push_back(corner);
+                }
+                previous = corner;
+                nCorners++;
+            }
+            chunk.nFaces++;
+        }
+        else if (!bLog) {
+            // Everything below only produces log output
+            if (IsObjectFileKeyword(keyword, length, "o")) chunk.nObjects++;
+        }
+        else if (keyword[0] == '#') {
+            scanner.RestOfLine(text, textLength);
+            std::cout.write(text, textLength) << std::endl;
+        }
+        else if (IsObjectFileKeyword(keyword, length, "o")) {
+            scanner.RestOfLine(text, textLength);
+            std::cout << "Object ";
+            std::cout.write(text, textLength) << std::endl;
+            chunk.nObjects++;
+        }
+        else if (IsObjectFileKeyword(keyword, length, "s")) {
+            int shadeSmooth = 0;
+            scanner.ReadInt(shadeSmooth);
+            if (shadeSmooth == 1) {
+                std::cout << "Set smooth shading" << std::endl;
+            }
+            else {
+                std::cout << "Set flat shading" << std::endl;
+            }
+        }
+        else if (IsObjectFileKeyword(keyword, length, "usemtl")) {
+            scanner.RestOfLine(text, textLength);
+            std::cout << "Using material ";
+            std::cout.write(text, textLength) << std::endl;
+        }
+        else {
+            scanner.RestOfLine(text, textLength);
+            std::cout << "Unknown line ";
+            std::cout.write(keyword, length) << " ";
+            std::cout.write(text, textLength) << std::endl;
+        }
+    }
+}
+
+// Map the cooked mesh of fileName if it was made from the file as it is now with the same settings,
+// and fill in output the way ReadObjectFile would
+// The arrays are left in the mapping, so they can go to the GPU without a copy (see MeshRegistry::Load)
+inline bool OpenCookedObjectFile(const std::string& fileName, const ObjectFileReadSettings& settings, CookedMeshView& cooked, ObjectFileReturnInfo& output)
+{
+    uint64_t sourceSize = 0;
+    int64_t sourceModifiedTime = 0;
+    if (!settings.bUseCache || !MappedFile::GetFileInfo(fileName, sourceSize, sourceModifiedTime)) return false;
+    uint32_t cacheFlags = settings.bDeduplicate ? MeshCache::kFlagDeduplicated : 0;
+    if (!MeshCache::Open(MeshCache::CookedPath(fileName), fileName, sourceSize, sourceModifiedTime, cacheFlags, cooked)) return false;
+
+    output.bHasTextureData = (cooked.header->flags & MeshCache::kFlagHasTextureData) != 0;
+    output.bHasNormalData = (cooked.header->flags & MeshCache::kFlagHasNormalData) != 0;
+    output.nVertices = cooked.header->nSourceVertices;
+    output.nFaces = cooked.header->nFaces;
+    output.nObjects = cooked.header->nObjects;
+    output.nCorners = cooked.header->nCorners;
+    output.nUniqueVertices = static_cast<int>(cooked.vertexCount);
+    output.bLoadedFromCache = true;
+    output.bSuccess = true;
+    if (!settings.bQuiet) std::cout << "Loaded " << fileName << " from cache with " << cooked.vertexCount << " verts and " << (cooked.indexCount / 3) << " tris." << std::endl;
+    return true;
+}
+
+// Memory maps the file and scans it in place
+// Large files are split at line boundaries and parsed on several threads, then the face
+// indices are resolved in a second pass. The result is the same for any number of threads.
+// Faces with more than three corners are split into a triangle fan
+// A cooked mesh is copied into vertices and indices, callers that only upload it can use OpenCookedObjectFile instead
+ObjectFileReturnInfo ReadObjectFile(std::string fileName, std::vector<Vertex>& vertices, std::vector<int>& indices, const ObjectFileReadSettings& settings = ObjectFileReadSettings())
+{
+    ObjectFileReturnInfo output;
+
+    // Reuse the cooked mesh if it was made from exactly this file with the same settings
+    {
+        CookedMeshView cooked;
+        if (OpenCookedObjectFile(fileName, settings, cooked, output))
+        {
+            int baseVertex = static_cast<int>(vertices.size());
+            vertices.insert(vertices.end(), cooked.vertices, cooked.vertices + cooked.vertexCount);
+            size_t baseIndex = indices.size();
+            indices.resize(baseIndex + cooked.indexCount);
+            for (size_t i = 0; i < cooked.indexCount; i++)
+                indices[baseIndex + i] = baseVertex + cooked.indices[i];
+            return output;
+        }
+    }
+
+    MappedFile file;
+    if (!file.Open(fileName))
+    {
+        std::cout << "Could not open file " << fileName << std::endl;
+        return output;
+    }
+    if (!settings.bQuiet) std::cout << "Reading file " << fileName << std::endl;
+
+    uint64_t sourceSize = 0;
+    int64_t sourceModifiedTime = 0;
+    uint32_t cacheFlags = settings.bDeduplicate ? MeshCache::kFlagDeduplicated : 0;
+    bool bCanCache = settings.bUseCache && MappedFile::GetFileInfo(fileName, sourceSize, sourceModifiedTime);
+
+    // Split the file into chunks that each end on a newline
+    size_t nThreads = settings.nThreads > 0 ? settings.nThreads : std::max(1u, std::thread::hardware_concurrency());
+    if (settings.jobs != nullptr) nThreads = settings.jobs->ThreadCount();
+    size_t minChunkSize = std::max<size_t>(1, settings.minChunkSize);
+    size_t nChunks = std::max<size_t>(1, std::min(nThreads, file.Size() / minChunkSize));
+
+    // Without the caller's threads the load gets its own, one per chunk, used for every pass below
+    std::unique_ptr<JobSystem> ownJobs;
+    if (settings.jobs == nullptr) ownJobs.reset(new JobSystem(static_cast<int>(nChunks)));
+    JobSystem& jobs = settings.jobs != nullptr ? *settings.jobs : *ownJobs;
+
+    std::vector<ObjectFileChunk> chunks(nChunks);
+    const char* fileEnd = file.Data() + file.Size();
+    const char* chunkBegin = file.Data();
+    for (size_t i = 0; i < nChunks; i++)
+    {
+        const char* chunkEnd = (i + 1 == nChunks) ? fileEnd : file.Data() + file.Size() * (i + 1) / nChunks;
+        if (chunkEnd < chunkBegin) chunkEnd = chunkBegin;
+        ObjectFileScanner boundary(chunkEnd, fileEnd);
+        if (chunkEnd > file.Data() && chunkEnd < fileEnd && chunkEnd[-1] != '\n') boundary.NextLine();
+        chunks[i].begin = chunkBegin;
+        chunks[i].end = boundary.cursor;
+        chunkBegin = boundary.cursor;
+    }
+
+    bool bLogLines = !settings.bQuiet && nChunks == 1;
+    jobs.RunTasks(nChunks, [&](size_t i) { ParseObjectFileChunk(chunks[i], bLogLines); });
+
+    // Work out where every chunk's data lands in the whole file
+    size_t nVertices = 0, nUVs = 0, nNormals = 0, nCorners = 0;
+    for (ObjectFileChunk& chunk : chunks)
+    {
+        chunk.vertexOffset = nVertices;
+        chunk.uvOffset = nUVs;
+        chunk.normalOffset = nNormals;
+        chunk.cornerOffset = nCorners;
+        nVertices += chunk.vertex_vector.size();
+        nUVs += chunk.uv_vector.size();
+        nNormals += chunk.normal_vector.size();
+        nCorners += chunk.corners.size();
+        output.nFaces += chunk.nFaces;
+        output.nObjects += chunk.nObjects;
+    }
+    output.bHasTextureData = nUVs > 0;
+    output.bHasNormalData = nNormals > 0;
+
+    // Gather the vertex data so faces can index across chunk borders
+    std::vector<ObjectFileChunk::TempVertex> vertex_vector(nVertices);
+    std::vector<ObjectFileChunk::TempUV> uv_vector(nUVs);
+    std::vector<ObjectFileChunk::TempNormal> normal_vector(nNormals);
+    jobs.RunTasks(nChunks, [&](size_t i)
+    {
+        const ObjectFileChunk& chunk = chunks[i];
+        std::copy(chunk.vertex_vector.begin(), chunk.vertex_vector.end(), vertex_vector.begin() + chunk.vertexOffset);
+        std::copy(chunk.uv_vector.begin(), chunk.uv_vector.end(), uv_vector.begin() + chunk.uvOffset);
+        std::copy(chunk.normal_vector.begin(), chunk.normal_vector.end(), normal_vector.begin() + chunk.normalOffset);
+    });
+
+    // Second pass, resolve every corner to 0-based indices into the whole file
+    std::vector<ObjectFileCornerKey> resolvedCorners(nCorners);
+    jobs.RunTasks(nChunks, [&](size_t i)
+    {
+        ObjectFileChunk& chunk = chunks[i];
+        for (size_t k = 0; k < chunk.corners.size(); k++)
+        {
+            const ObjectFileChunk::Corner& corner = chunk.corners[k];
+            long long resolvedVertex = ResolveObjectFileIndex(corner.vertex, (corner.relativeMask & ObjectFileChunk::kRelativeVertex) != 0, chunk.vertexOffset, nVertices);
+            long long resolvedUV = ResolveObjectFileIndex(corner.uv, (corner.relativeMask & ObjectFileChunk::kRelativeUV) != 0, chunk.uvOffset, nUVs);
+            long long resolvedNormal = ResolveObjectFileIndex(corner.normal, (corner.relativeMask & ObjectFileChunk::kRelativeNormal) != 0, chunk.normalOffset, nNormals);
+            if (resolvedVertex < 0 || resolvedUV == -2 || resolvedNormal == -2)
+            {
+                chunk.bHasInvalidIndex = true;
+                return;
+            }
+            resolvedCorners[chunk.cornerOffset + k] = ObjectFileCornerKey{ static_cast<int>(resolvedVertex), static_cast<int>(resolvedUV), static_cast<int>(resolvedNormal) };
+        }
+    });
+
+    for (const ObjectFileChunk& chunk : chunks)
+    {
+        if (chunk.bHasInvalidIndex)
+        {
+            std::cout << "Invalid face index in " << fileName << std::endl;
+            return output;
+        }
+    }
+
+    auto makeVertex = [&](const ObjectFileCornerKey& key)
+    {
+        const ObjectFileChunk::TempVertex& t = vertex_vector[key.vertex];
+        Vertex v{ t.x, t.y, t.z, t.r, t.g, t.b, 0.f, 0.f, 0.f, 0.f, 0.f };
+        if (key.uv >= 0)
+        {
+            const ObjectFileChunk::TempUV& uv = uv_vector[key.uv];
+            v.u = uv.u;
+            v.v = 1.f - uv.v;
+        }
+        if (key.normal >= 0)
+        {
+            const ObjectFileChunk::TempNormal& normal = normal_vector[key.normal];
+            v.nx = normal.x;
+            v.ny = normal.y;
+            v.nz = normal.z;
+        }
+        return v;
+    };
+
+    size_t baseVertex = vertices.size();
+    size_t baseIndex = indices.size();
+    indices.resize(baseIndex + nCorners);
+    if (settings.bDeduplicate)
+    {
+        // Give every distinct (position, uv, normal) combination one vertex, in order of first use
+        // This stays on one thread so the vertex order is the same for any number of parse threads
+        size_t tableSize = 16;
+        while (tableSize < nCorners * 2) tableSize *= 2;
+        std::vector<int> table(tableSize, -1);
+        std::vector<ObjectFileCornerKey> uniqueCorners;
+        uniqueCorners.reserve(std::min(nCorners, nVertices + nUVs + nNormals));
+
+        for (size_t k = 0; k < nCorners; k++)
+        {
+            const ObjectFileCornerKey& key = resolvedCorners[k];
+            size_t slot = key.Hash() & (tableSize - 1);
+            while (table[slot] >= 0 && !(uniqueCorners[table[slot]] == key))
+                slot = (slot + 1) & (tableSize - 1);
+            if (table[slot] < 0)
+            {
+                table[slot] = static_cast<int>(uniqueCorners.size());
+                uniqueCorners.push_back(key);
+            }
+            indices[baseIndex + k] = static_cast<int>(baseVertex) + table[slot];
+        }
+
+        vertices.resize(baseVertex + uniqueCorners.size());
+        jobs.RunTasks(nChunks, [&](size_t i)
+        {
+            size_t begin = uniqueCorners.size() * i / nChunks;
+            size_t end = uniqueCorners.size() * (i + 1) / nChunks;
+            for (size_t k = begin; k < end; k++)
+                vertices[baseVertex + k] = makeVertex(uniqueCorners[k]);
+        });
+    }
+    else
+    {
+        // Every corner gets its own vertex
+        vertices.resize(baseVertex + nCorners);
+        jobs.RunTasks(nChunks, [&](size_t i)
+        {
+            const ObjectFileChunk& chunk = chunks[i];
+            for (size_t k = chunk.cornerOffset; k < chunk.cornerOffset + chunk.corners.size(); k++)
+            {
+                vertices[baseVertex + k] = makeVertex(resolvedCorners[k]);
+                indices[baseIndex + k] = static_cast<int>(baseVertex + k);
+            }
+        });
+    }
+
+    // Files without normals get smooth ones here, so they are cooked along with everything else
+    if (!output.bHasNormalData)
+        MeshNormals::GenerateSmooth(vertices, indices.data() + baseIndex, nCorners, baseVertex, &jobs);
+
+    output.nVertices = nVertices;
+    output.nCorners = nCorners;
+    output.nUniqueVertices = vertices.size() - baseVertex;
+    output.bSuccess = true;
+
+    if (bCanCache)
+    {
+        CookedMeshHeader header{};
+        header.flags = cacheFlags
+            | (output.bHasTextureData ? MeshCache::kFlagHasTextureData : 0)
+            | (output.bHasNormalData ? MeshCache::kFlagHasNormalData : MeshCache::kFlagGeneratedNormals);
+        header.sourceSize = sourceSize;
+        header.sourceModifiedTime = sourceModifiedTime;
+        header.sourceHash = MeshCache::HashBytes(file.Data(), file.Size());
+        header.nSourceVertices = output.nVertices;
+        header.nFaces = output.nFaces;
+        header.nObjects = output.nObjects;
+        header.nCorners = output.nCorners;
+
+        // The cache stores indices relative to its own first vertex
+        std::vector<int> relativeIndices;
+        const int* cookedIndices = indices.data() + baseIndex;
+        if (baseVertex > 0)
+        {
+            relativeIndices.assign(indices.begin() + baseIndex, indices.end());
+            for (int& index : relativeIndices) index -= static_cast<int>(baseVertex);
+            cookedIndices = relativeIndices.data();
+        }
+        bool bCooked = MeshCache::Write(MeshCache::CookedPath(fileName), header, vertices.data() + baseVertex, vertices.size() - baseVertex, cookedIndices, nCorners);
+        if (!bCooked && !settings.bQuiet) std::cout << "Could not write mesh cache " << MeshCache::CookedPath(fileName) << std::endl;
+    }
+
+    if (!settings.bQuiet) std::cout << "Loaded " << fileName << " with " << (vertices.size() - baseVertex) << " verts and " << (nCorners / 3) << " tris." << std::endl;
+    return output;
+}
+
+// The original iostream based reader, kept as a reference for benchmarking the mapped reader
+ObjectFileReturnInfo ReadObjectFileLegacy(std::string fileName, std::vector<Vertex>& vertices, std::vector<int>& indices)
 {
     std::ifstream in;
     in.open(fileName);
@@ -114,7 +789,7 @@ ObjectFileReturnInfo ReadObjectFile(std::string fileName, std::vector<Vertex>& v
                 iss >> vertexIndex;
 
                 TempVertex t = vertex_vector[vertexIndex - 1];
-                Vertex v{ t.x, t.y, t.z, t.r, t.g, t.b, 0.f, 0.f };
+                Vertex v{ t.x, t.y, t.z, t.r, t.g, t.b, 0.f, 0.f, 0.f, 0.f, 0.f };
 
                 if (output.bHasTextureData)
                 {
@@ -0,0 +1,248 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <imgui/imgui.h>
+
+#include "TaskGraph.h"
+
+// Where each frame's time goes, as named sections timed on the main thread and the tasks of the task graphs
+// Keeps the last kHistory frames of every section for rolling averages and percentiles
+// and can record a run of frames as a Chrome trace (chrome://tracing or ui.perfetto.dev) to look at hitches offline
+class Profiler
+{
+public:
+	enum { kHistory = 240 };
+	typedef std::chrono::steady_clock Clock;
+
+	// Times the enclosing block as one section
+	class Scope
+	{
+	public:
+		Scope(Profiler& profiler, const char* name) : profiler(profiler), name(name), start(Clock::now())
+		{
+			profiler.openScopes++;
+		}
+		~Scope()
+		{
+			profiler.openScopes--;
+			profiler.Add(name, start, SecondsSince(start), false);
+		}
+
+	private:
+		Profiler& profiler;
+		const char* name;
+		Clock::time_point start;
+	};
+
+	Profiler() : origin(Clock::now()), frameStart(origin) {}
+
+	// Close the last frame and start timing the next one, call once at the top of the frame
+	void BeginFrame()
+	{
+		Clock::time_point now = Clock::now();
+		if (frameIndex > 0)
+		{
+			size_t slot = (frameIndex - 1) % kHistory;
+			frameHistory[slot] = static_cast<float>(std::chrono::duration<double>(now - frameStart).count() * 1000.0);
+			for (Section& section : sections)
+			{
+				section.history[slot] = static_cast<float>(section.frameSeconds * 1000.0);
+				section.frameSeconds = 0.0;
+			}
+			if (IsCapturing())
+			{
+				AddEvent("frame", 0, frameStart, now);
+				if (--captureFramesLeft == 0) WriteTrace();
+			}
+		}
+		frameStart = now;
+		frameIndex++;
+	}
+
+	// Time measured elsewhere, the GPU for example, counted in this frame's statistics only
+	void Add(const std::string& name, double seconds)
+	{
+		FindSection(name).frameSeconds += seconds;
+	}
+
+	// Time that started at start on the CPU, also recorded while capturing a trace
+	// bOwnTrack puts it on a row of its own in the trace, for work that is not nested in the main thread's sections
+	void Add(const std::string& name, Clock::time_point start, double seconds, bool bOwnTrack)
+	{
+		Section& section = FindSection(name);
+		section.frameSeconds += seconds;
+		section.bOwnTrack = section.bOwnTrack || bOwnTrack;
+		if (IsCapturing())
+		{
+			int track = bOwnTrack ? 1 + static_cast<int>(&section - sections.data()) : 0;
+			AddEvent(name, track, start, start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds)));
+		}
+	}
+
+	// Every task of a graph after it ran, each on its own track since tasks overlap
+	void AddTasks(const TaskGraph& graph)
+	{
+		for (TaskId id = 0; id < graph.TaskCount(); id++)
+			Add(graph.Name(id), graph.Started(id), graph.Seconds(id), true);
+	}
+
+	// Record the next frames and write them to fileName as a Chrome trace when they are done
+	void StartCapture(int frames, const std::string& fileName)
+	{
+		traceEvents.clear();
+		captureFramesLeft = std::max(frames, 1);
+		traceFileName = fileName;
+	}
+
+	bool IsCapturing() const { return captureFramesLeft > 0; }
+
+	// Section averages and percentiles over the history, and a graph of the frame times
+	void DrawWindow()
+	{
+		ImGui::Begin("Profiler");
+
+		size_t nFrames = std::min<size_t>(frameIndex > 0 ? frameIndex - 1 : 0, kHistory);
+		Stats frame = ComputeStats(frameHistory, nFrames);
+		char overlay[64];
+		snprintf(overlay, sizeof(overlay), "avg %.2f ms, p99 %.2f ms, max %.2f ms", frame.average, frame.p99, frame.max);
+		int offset = static_cast<int>(nFrames < kHistory ? 0 : (frameIndex - 1) % kHistory);
+		ImGui::PlotLines("##frame times", frameHistory, static_cast<int>(nFrames), offset, overlay, 0.0f, std::max(frame.max, 1000.0f / 60.0f) * 1.2f, ImVec2(-1.0f, 80.0f));
+
+		if (ImGui::BeginTable("sections", 6, ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit))
+		{
+			const char* headers[] = { "Section (ms)", "avg", "p50", "p95", "p99", "max" };
+			for (const char* header : headers)
+				ImGui::TableSetupColumn(header);
+			ImGui::TableHeadersRow();
+			for (const Section& section : sections)
+			{
+				Stats stats = ComputeStats(section.history, nFrames);
+				ImGui::TableNextRow();
+				ImGui::TableNextColumn();
+				ImGui::Text("%*s%s", section.depth * 2, "", section.name.c_str());
+				float values[] = { stats.average, stats.p50, stats.p95, stats.p99, stats.max };
+				for (float value : values)
+				{
+					ImGui::TableNextColumn();
+					ImGui::Text("%.3f", value);
+				}
+			}
+			ImGui::EndTable();
+		}
+
+		if (IsCapturing()) ImGui::Text("Capturing trace, %d frames left", captureFramesLeft);
+		else if (ImGui::Button("Capture Chrome trace of the next 300 frames")) StartCapture(300, "profile_trace.json");
+		if (!lastTraceMessage.empty()) ImGui::TextUnformatted(lastTraceMessage.c_str());
+
+		ImGui::End();
+	}
+
+	static double SecondsSince(Clock::time_point start)
+	{
+		return std::chrono::duration<double>(Clock::now() - start).count();
+	}
+
+private:
+	struct Section
+	{
+		std::string name;
+		// How many sections were open when it was first seen, for indenting
+		int depth = 0;
+		bool bOwnTrack = false;
+		double frameSeconds = 0.0;
+		float history[kHistory] = {};
+	};
+
+	struct Stats
+	{
+		float average = 0.0f, p50 = 0.0f, p95 = 0.0f, p99 = 0.0f, max = 0.0f;
+	};
+
+	struct TraceEvent
+	{
+		std::string name;
+		int track;
+		double startMicroseconds, durationMicroseconds;
+	};
+
+	// There are only a couple of dozen sections, a linear search is as fast as anything
+	Section& FindSection(const std::string& name)
+	{
+		for (Section& section : sections)
+		{
+			if (section.name == name) return section;
+		}
+		sections.emplace_back();
+		sections.back().name = name;
+		sections.back().depth = openScopes;
+		return sections.back();
+	}
+
+	static Stats ComputeStats(const float* history, size_t count)
+	{
+		Stats stats;
+		if (count == 0) return stats;
+		std::vector<float> sorted(history, history + count);
+		std::sort(sorted.begin(), sorted.end());
+		double total = 0.0;
+		for (float value : sorted)
+			total += value;
+		stats.average = static_cast<float>(total / count);
+		stats.p50 = sorted[count / 2];
+		stats.p95 = sorted[std::min(count - 1, count * 95 / 100)];
+		stats.p99 = sorted[std::min(count - 1, count * 99 / 100)];
+		stats.max = sorted.back();
+		return stats;
+	}
+
+	void AddEvent(const std::string& name, int track, Clock::time_point start, Clock::time_point end)
+	{
+		double startMicroseconds = std::chrono::duration<double, std::micro>(start - origin).count();
+		double durationMicroseconds = std::chrono::duration<double, std::micro>(end - start).count();
+		traceEvents.push_back(TraceEvent{ name, track, startMicroseconds, durationMicroseconds });
+	}
+
+	// Complete ("X") events in the Chrome trace event format, with a name for every track
+	void WriteTrace()
+	{
+		std::ofstream out(traceFileName);
+		if (!out)
+		{
+			lastTraceMessage = "Could not write " + traceFileName;
+			return;
+		}
+		out << "{\"traceEvents\":[\n";
+		out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"main thread\"}}";
+		for (size_t i = 0; i < sections.size(); i++)
+		{
+			if (sections[i].bOwnTrack) out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << i + 1 << ",\"args\":{\"name\":\"task: " << sections[i].name << "\"}}";
+		}
+		char buffer[64];
+		for (const TraceEvent& event : traceEvents)
+		{
+			snprintf(buffer, sizeof(buffer), "\"ts\":%.3f,\"dur\":%.3f}", event.startMicroseconds, event.durationMicroseconds);
+			out << ",\n{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << event.track << "," << buffer;
+		}
+		out << "\n]}\n";
+		lastTraceMessage = "Saved " + std::to_string(traceEvents.size()) + " events to " + traceFileName;
+		traceEvents.clear();
+	}
+
+	std::vector<Section> sections;
+	float frameHistory[kHistory] = {};
+	size_t frameIndex = 0;
+	int openScopes = 0;
+
+	Clock::time_point origin;
+	Clock::time_point frameStart;
+
+	std::vector<TraceEvent> traceEvents;
+	int captureFramesLeft = 0;
+	std::string traceFileName;
+	std::string lastTraceMessage;
+};
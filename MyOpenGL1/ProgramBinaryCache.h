@@ -0,0 +1,186 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <glad/glad.h>
+
+#include "MeshCache.h"
+
+// Binary header of a cached program, followed by the driver's binary of it
+struct ProgramBinaryHeader
+{
+	char magic[4];
+	uint32_t version;
+	// Hash of the sources and the driver they were linked by
+	uint64_t key;
+	uint32_t format;
+	uint32_t length;
+};
+
+// Linked programs saved with glGetProgramBinary and loaded back with glProgramBinary, skipping compiling and linking
+// Stored in the working directory as shader_<key>.program, where the shader sources are
+// A driver update changes the key, and a binary the driver refuses anyway is compiled again by the caller
+// Needs GL 4.1 or GL_ARB_get_program_binary, the generated GL loader stops at 3.3 so the functions are loaded here
+class ProgramBinaryCache
+{
+public:
+	static const uint32_t kVersion = 1;
+
+	// Find the program binary functions, call once after the GL loader, false if the driver has no binary formats
+	static bool Load(GLADloadproc load)
+	{
+		Functions& functions = GetFunctions();
+		functions = Functions();
+
+		GLint major = 0, minor = 0;
+		glGetIntegerv(GL_MAJOR_VERSION, &major);
+		glGetIntegerv(GL_MINOR_VERSION, &minor);
+		bool bSupported = major > 4 || (major == 4 && minor >= 1);
+		GLint nExtensions = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &nExtensions);
+		for (GLint i = 0; i < nExtensions && !bSupported; i++)
+		{
+			const char* extension = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+			bSupported = extension && strcmp(extension, "GL_ARB_get_program_binary") == 0;
+		}
+		if (!bSupported) return false;
+
+		GLint nFormats = 0;
+		glGetIntegerv(kNumProgramBinaryFormats, &nFormats);
+		if (nFormats <= 0) return false;
+
+		functions.getProgramBinary = reinterpret_cast<GetProgramBinaryProc>(load("glGetProgramBinary"));
+		functions.programBinary = reinterpret_cast<ProgramBinaryProc>(load("glProgramBinary"));
+		functions.programParameteri = reinterpret_cast<ProgramParameteriProc>(load("glProgramParameteri"));
+		functions.bAvailable = functions.getProgramBinary && functions.programBinary && functions.programParameteri;
+
+		// The driver goes into the key, so binaries from another driver or version are never tried
+		const GLenum strings[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+		std::string driver;
+		for (GLenum name : strings)
+		{
+			const char* value = reinterpret_cast<const char*>(glGetString(name));
+			driver += value ? value : "";
+			driver += '\n';
+		}
+		functions.driverHash = MeshCache::HashBytes(driver.data(), driver.size());
+		return functions.bAvailable;
+	}
+
+	static bool IsAvailable()
+	{
+		return GetFunctions().bAvailable;
+	}
+
+	// Key of a program built from these sources, defines included, by the current driver
+	static uint64_t Key(const std::string& vertexSource, const std::string& fragmentSource)
+	{
+		const uint64_t kMultiplier = 0x9E3779B97F4A7C15ull;
+		uint64_t key = GetFunctions().driverHash;
+		key = (key ^ MeshCache::HashBytes(vertexSource.data(), vertexSource.size())) * kMultiplier;
+		key = (key ^ MeshCache::HashBytes(fragmentSource.data(), fragmentSource.size())) * kMultiplier;
+		return key ^ (key >> 29);
+	}
+
+	static std::string PathFor(uint64_t key)
+	{
+		char name[64];
+		snprintf(name, sizeof(name), "shader_%016llx.program", static_cast<unsigned long long>(key));
+		return name;
+	}
+
+	// Ask GL to keep a program's binary around, call before linking it
+	static void MarkRetrievable(GLuint program)
+	{
+		if (IsAvailable()) GetFunctions().programParameteri(program, kProgramBinaryRetrievableHint, GL_TRUE);
+	}
+
+	// Load the cached binary into program, false if there is none, it is damaged or the driver refuses it
+	// A refused program is left unlinked, the caller is expected to build it from source
+	static bool Read(uint64_t key, GLuint program)
+	{
+		if (!IsAvailable()) return false;
+		std::ifstream file(PathFor(key), std::ios::binary);
+		if (!file.is_open()) return false;
+
+		ProgramBinaryHeader header;
+		if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))) return false;
+		if (memcmp(header.magic, "PROG", 4) != 0 || header.version != kVersion || header.key != key || header.length == 0) return false;
+		std::vector<char> binary(header.length);
+		if (!file.read(binary.data(), binary.size())) return false;
+
+		GetFunctions().programBinary(program, header.format, binary.data(), static_cast<GLsizei>(binary.size()));
+		GLint success = 0;
+		glGetProgramiv(program, GL_LINK_STATUS, &success);
+		return success != 0;
+	}
+
+	// Save a linked program's binary, written to a temporary file first like MeshCache
+	static bool Write(uint64_t key, GLuint program)
+	{
+		if (!IsAvailable()) return false;
+		GLint length = 0;
+		glGetProgramiv(program, kProgramBinaryLength, &length);
+		if (length <= 0) return false;
+		std::vector<char> binary(length);
+		GLenum format = 0;
+		GetFunctions().getProgramBinary(program, length, &length, &format, binary.data());
+		if (length <= 0) return false;
+
+		ProgramBinaryHeader header;
+		memcpy(header.magic, "PROG", 4);
+		header.version = kVersion;
+		header.key = key;
+		header.format = format;
+		header.length = static_cast<uint32_t>(length);
+
+		std::string path = PathFor(key);
+		std::string temporaryPath = path + ".tmp";
+		std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+		if (!file.is_open()) return false;
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(binary.data(), length);
+		file.close();
+		bool bWritten = !file.fail();
+
+		if (bWritten)
+		{
+			std::remove(path.c_str());
+			bWritten = std::rename(temporaryPath.c_str(), path.c_str()) == 0;
+		}
+		if (!bWritten) std::remove(temporaryPath.c_str());
+		return bWritten;
+	}
+
+private:
+	// Not in the 3.3 headers
+	enum : GLenum
+	{
+		kProgramBinaryRetrievableHint = 0x8257,
+		kProgramBinaryLength = 0x8741,
+		kNumProgramBinaryFormats = 0x87FE,
+	};
+
+	typedef void (APIENTRYP GetProgramBinaryProc)(GLuint program, GLsizei bufSize, GLsizei* length, GLenum* binaryFormat, void* binary);
+	typedef void (APIENTRYP ProgramBinaryProc)(GLuint program, GLenum binaryFormat, const void* binary, GLsizei length);
+	typedef void (APIENTRYP ProgramParameteriProc)(GLuint program, GLenum pname, GLint value);
+
+	struct Functions
+	{
+		bool bAvailable = false;
+		uint64_t driverHash = 0;
+		GetProgramBinaryProc getProgramBinary = nullptr;
+		ProgramBinaryProc programBinary = nullptr;
+		ProgramParameteriProc programParameteri = nullptr;
+	};
+
+	static Functions& GetFunctions()
+	{
+		static Functions functions;
+		return functions;
+	}
+};
@@ -0,0 +1,147 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "GlStateCache.h"
+
+// One draw and the state it needs
+struct DrawItem
+{
+	GLuint program = 0;
+	GLuint texture = 0;
+	GLuint vertexArray = 0;
+	GLsizei indexCount = 0;
+	// Uniform locations in program, -1 for those it does not set
+	GLint matrixLocation = -1;
+	GLint snapLocation = -1;
+	int bSnapToGround = 0;
+	// Without an instanceBuffer matrices[0] goes in the matrix uniform, with one the instanceCount matrices are streamed to it
+	// They are read in Submit, so must stay where they are until then
+	const glm::mat4* matrices = nullptr;
+	GLuint instanceBuffer = 0;
+	size_t instanceCount = 1;
+};
+
+// The frame's draws, sorted so that draws sharing a program, then a texture, then a mesh are submitted together
+// and the state cache can skip what the previous draw already set
+// Each draw has a 64 bit key, most significant bits first: program, texture, mesh and depth, nearer first
+class RenderQueue
+{
+public:
+	enum { kProgramBits = 6, kTextureBits = 10, kMeshBits = 24, kDepthBits = 24 };
+
+	// Start a new frame of draws, depths up to maxDepth are told apart and farther ones sort as if they were at maxDepth
+	void Begin(float maxDepth)
+	{
+		items.clear();
+		keys.clear();
+		depthScale = maxDepth > 0.0f ? ((1u << kDepthBits) - 1) / maxDepth : 0.0f;
+	}
+
+	// meshOrder puts draws of the same mesh next to each other, depth is their distance from the camera
+	void Add(const DrawItem& item, uint32_t meshOrder, float depth)
+	{
+		uint64_t key = static_cast<uint64_t>(Slot(programs, item.program, kProgramBits));
+		key = (key << kTextureBits) | Slot(textures, item.texture, kTextureBits);
+		key = (key << kMeshBits) | std::min<uint32_t>(meshOrder, (1u << kMeshBits) - 1);
+		float quantizedDepth = std::min(std::max(depth * depthScale, 0.0f), static_cast<float>((1u << kDepthBits) - 1));
+		key = (key << kDepthBits) | static_cast<uint32_t>(quantizedDepth);
+		keys.push_back(key);
+		items.push_back(item);
+	}
+
+	size_t Count() const { return items.size(); }
+
+	// Least significant byte first radix sort of the keys, a byte every key shares costs only the counting
+	// Stable, draws with equal keys keep the order they were added in
+	void Sort()
+	{
+		size_t count = keys.size();
+		order.resize(count);
+		for (size_t i = 0; i < count; i++)
+			order[i] = static_cast<uint32_t>(i);
+		if (count < 2) return;
+		sortedKeys = keys;
+		scratchKeys.resize(count);
+		scratchOrder.resize(count);
+
+		for (int shift = 0; shift < 64; shift += 8)
+		{
+			size_t offsets[256] = {};
+			for (uint64_t key : sortedKeys)
+				offsets[(key >> shift) & 0xFF]++;
+			if (offsets[(sortedKeys[0] >> shift) & 0xFF] == count) continue;
+
+			size_t total = 0;
+			for (size_t& offset : offsets)
+			{
+				size_t bucketCount = offset;
+				offset = total;
+				total += bucketCount;
+			}
+			for (size_t i = 0; i < count; i++)
+			{
+				size_t destination = offsets[(sortedKeys[i] >> shift) & 0xFF]++;
+				scratchKeys[destination] = sortedKeys[i];
+				scratchOrder[destination] = order[i];
+			}
+			sortedKeys.swap(scratchKeys);
+			order.swap(scratchOrder);
+		}
+	}
+
+	// Issue the draws in sorted order, after Sort, returns the number of draw calls
+	int Submit(GlStateCache& state, GLenum mode) const
+	{
+		for (uint32_t index : order)
+		{
+			const DrawItem& item = items[index];
+			state.UseProgram(item.program);
+			state.BindTexture2D(item.texture);
+			state.BindVertexArray(item.vertexArray);
+			state.Uniform1i(item.snapLocation, item.bSnapToGround);
+			if (item.instanceBuffer == 0)
+			{
+				state.UniformMatrix4(item.matrixLocation, item.matrices[0]);
+				glDrawElements(mode, item.indexCount, GL_UNSIGNED_INT, 0);
+				state.CountIssued(1);
+				continue;
+			}
+
+			// Orphan last frame's storage so the driver does not have to wait for it
+			GLsizeiptr bytes = static_cast<GLsizeiptr>(item.instanceCount * sizeof(glm::mat4));
+			state.BindArrayBuffer(item.instanceBuffer);
+			glBufferData(GL_ARRAY_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+			glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, item.matrices);
+			glDrawElementsInstanced(mode, item.indexCount, GL_UNSIGNED_INT, 0, static_cast<GLsizei>(item.instanceCount));
+			state.CountIssued(3);
+		}
+		return static_cast<int>(order.size());
+	}
+
+private:
+	// Programs and textures get small numbers in the order they are first seen, GL names can be anything
+	// Past the bits of the key they share the last number, which only costs some redundant binds
+	static uint32_t Slot(std::vector<GLuint>& names, GLuint name, int bits)
+	{
+		std::vector<GLuint>::iterator found = std::find(names.begin(), names.end(), name);
+		if (found == names.end())
+		{
+			names.push_back(name);
+			found = names.end() - 1;
+		}
+		return std::min<uint32_t>(static_cast<uint32_t>(found - names.begin()), (1u << bits) - 1);
+	}
+
+	std::vector<DrawItem> items;
+	std::vector<uint64_t> keys;
+	float depthScale = 0.0f;
+	std::vector<GLuint> programs, textures;
+
+	std::vector<uint32_t> order, scratchOrder;
+	std::vector<uint64_t> sortedKeys, scratchKeys;
+};
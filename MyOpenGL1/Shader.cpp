@@ -1,88 +1,153 @@
 #include "Shader.h"
 
+#include <algorithm>
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include "ProgramBinaryCache.h"
+
 Shader::Shader(const char* vertexPath, const char* fragmentPath)
 {
-    // 1. retrieve the vertex/fragment source code from filePath
-    std::string vertexCode;
-    std::string fragmentCode;
-    std::ifstream vShaderFile;
-    std::ifstream fShaderFile;
-
-    // ensure ifstream objects can throw exceptions:
-    vShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-    fShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-    try
-    {
-        // open files
-        vShaderFile.open(vertexPath);
-        fShaderFile.open(fragmentPath);
-        std::stringstream vShaderStream, fShaderStream;
-        // read file's buffer contents into streams
-        vShaderStream << vShaderFile.rdbuf();
-        fShaderStream << fShaderFile.rdbuf();
-        // close file handlers
-        vShaderFile.close();
-        fShaderFile.close();
-        // convert stream into string
-        vertexCode = vShaderStream.str();
-        fragmentCode = fShaderStream.str();
-    }
-    catch (std::ifstream::failure e)
-    {
-        std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
-    }
-    const char* vShaderCode = vertexCode.c_str();
-    const char* fShaderCode = fragmentCode.c_str();
-   // std::cout << vShaderCode << std::endl;
-   // std::cout << fShaderCode << std::endl;
-
-	// 2. compile shaders
-// 2. compile shaders
-   // unsigned int vertex, fragment;
-    int success;
-    char infoLog[512];
-
-    // vertex Shader
-    vertex = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertex, 1, &vShaderCode, NULL);
-    glCompileShader(vertex);
-    // print compile errors if any
-    glGetShaderiv(vertex, GL_COMPILE_STATUS, &success);
-    if (!success)
-    {
-        glGetShaderInfoLog(vertex, 512, NULL, infoLog);
-        std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
-    };
-
-    unsigned int fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragmentShader, 1, &fShaderCode, NULL);
-    glCompileShader(fragmentShader);
-    // check for shader compile errors
-    glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &success);
-    if (!success)
-    {
-        glGetShaderInfoLog(fragmentShader, 512, NULL, infoLog);
-        std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
-    }
-    // link shaders
-    // 
-        // shader Program
-    ID = glCreateProgram();
-    glAttachShader(ID, vertex);
-    glAttachShader(ID, fragment);
-    glLinkProgram(ID);
-    // print linking errors if any
-    glGetProgramiv(ID, GL_LINK_STATUS, &success);
-    if (!success)
-    {
-        glGetProgramInfoLog(ID, 512, NULL, infoLog);
-        std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
-    }
-
-    // delete the shaders as they're linked into our program now and no longer necessary
-    glDeleteShader(vertex);
-    glDeleteShader(fragment);
+	// 1. retrieve the vertex/fragment source code from filePath
+	std::string vertexCode;
+	std::string fragmentCode;
+	std::ifstream vShaderFile;
+	std::ifstream fShaderFile;
+
+	// ensure ifstream objects can throw exceptions:
+	vShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+	fShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+	try
+	{
+		// open files
+		vShaderFile.open(vertexPath);
+		fShaderFile.open(fragmentPath);
+		std::stringstream vShaderStream, fShaderStream;
+		// read file's buffer contents into streams
+		vShaderStream << vShaderFile.rdbuf();
+		fShaderStream << fShaderFile.rdbuf();
+		// close file handlers
+		vShaderFile.close();
+		fShaderFile.close();
+		// convert stream into string
+		vertexCode = vShaderStream.str();
+		fragmentCode = fShaderStream.str();
+	}
+	catch (const std::ifstream::failure&)
+	{
+		std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+	}
+
+	// 2. compile and link shaders
+	Build(vertexCode, fragmentCode, false);
+}
+
+Shader Shader::FromSource(const std::string& vertexSource, const std::string& fragmentSource, bool bUseBinaryCache)
+{
+	Shader shader;
+	shader.Build(vertexSource, fragmentSource, bUseBinaryCache);
+	return shader;
+}
+
+unsigned int Shader::Compile(GLenum stage, const char* source, const char* stageName)
+{
+	unsigned int shader = glCreateShader(stage);
+	glShaderSource(shader, 1, &source, NULL);
+	glCompileShader(shader);
+	// print compile errors if any
+	int success;
+	char infoLog[512];
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+	if (!success)
+	{
+		glGetShaderInfoLog(shader, 512, NULL, infoLog);
+		std::cout << "ERROR::SHADER::" << stageName << "::COMPILATION_FAILED\n" << infoLog << std::endl;
+	}
+	return shader;
+}
+
+void Shader::Build(const std::string& vertexSource, const std::string& fragmentSource, bool bUseBinaryCache)
+{
+	bUseBinaryCache = bUseBinaryCache && ProgramBinaryCache::IsAvailable();
+	uint64_t cacheKey = bUseBinaryCache ? ProgramBinaryCache::Key(vertexSource, fragmentSource) : 0;
+	ID = glCreateProgram();
+	bLoadedFromCache = bUseBinaryCache && ProgramBinaryCache::Read(cacheKey, ID);
+	if (bLoadedFromCache)
+	{
+		Reflect();
+		return;
+	}
+	if (bUseBinaryCache)
+	{
+		// Start over from a program the refused binary has not touched
+		glDeleteProgram(ID);
+		ID = glCreateProgram();
+		ProgramBinaryCache::MarkRetrievable(ID);
+	}
+
+	unsigned int vertex = Compile(GL_VERTEX_SHADER, vertexSource.c_str(), "VERTEX");
+	unsigned int fragment = Compile(GL_FRAGMENT_SHADER, fragmentSource.c_str(), "FRAGMENT");
+
+	// shader Program
+	glAttachShader(ID, vertex);
+	glAttachShader(ID, fragment);
+	glLinkProgram(ID);
+	// print linking errors if any
+	int success;
+	char infoLog[512];
+	glGetProgramiv(ID, GL_LINK_STATUS, &success);
+	if (!success)
+	{
+		glGetProgramInfoLog(ID, 512, NULL, infoLog);
+		std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+	}
+
+	// delete the shaders as they're linked into our program now and no longer necessary
+	glDeleteShader(vertex);
+	glDeleteShader(fragment);
+
+	if (!success) return;
+	Reflect();
+	if (bUseBinaryCache && !ProgramBinaryCache::Write(cacheKey, ID))
+		std::cout << "Could not save the program binary to " << ProgramBinaryCache::PathFor(cacheKey) << std::endl;
+}
+
+void Shader::Reflect()
+{
+	uniforms.clear();
+	blocks.clear();
+
+	GLint nBlocks = 0, maxBlockNameLength = 0;
+	glGetProgramiv(ID, GL_ACTIVE_UNIFORM_BLOCKS, &nBlocks);
+	glGetProgramiv(ID, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &maxBlockNameLength);
+	std::vector<char> name(std::max(maxBlockNameLength, 1));
+	for (GLint index = 0; index < nBlocks; index++)
+	{
+		GLsizei length = 0;
+		glGetActiveUniformBlockName(ID, index, (GLsizei)name.size(), &length, name.data());
+		UniformBlock& block = blocks[std::string(name.data(), length)];
+		block.index = index;
+		glGetActiveUniformBlockiv(ID, index, GL_UNIFORM_BLOCK_DATA_SIZE, &block.dataSize);
+	}
 
+	GLint nUniforms = 0, maxNameLength = 0;
+	glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &nUniforms);
+	glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLength);
+	name.resize(std::max(maxNameLength, 1));
+	for (GLuint index = 0; index < (GLuint)nUniforms; index++)
+	{
+		GLsizei length = 0;
+		Uniform uniform;
+		glGetActiveUniform(ID, index, (GLsizei)name.size(), &length, &uniform.size, &uniform.type, name.data());
+		glGetActiveUniformsiv(ID, 1, &index, GL_UNIFORM_BLOCK_INDEX, &uniform.block);
+		glGetActiveUniformsiv(ID, 1, &index, GL_UNIFORM_OFFSET, &uniform.offset);
+		std::string uniformName(name.data(), length);
+		if (uniform.block < 0) uniform.location = glGetUniformLocation(ID, uniformName.c_str());
+		uniforms[uniformName] = uniform;
+		// Arrays are listed as name[0], they can be found without the brackets as well
+		if (uniformName.size() > 3 && uniformName.compare(uniformName.size() - 3, 3, "[0]") == 0)
+			uniforms[uniformName.substr(0, uniformName.size() - 3)] = uniform;
+	}
 }
 
 void Shader::use()
@@ -90,17 +155,61 @@ void Shader::use()
 	glUseProgram(ID);
 }
 
+GLint Shader::Location(const std::string& name) const
+{
+	const Uniform* uniform = FindUniform(name);
+	return uniform ? uniform->location : -1;
+}
+
+const Shader::Uniform* Shader::FindUniform(const std::string& name) const
+{
+	std::unordered_map<std::string, Uniform>::const_iterator found = uniforms.find(name);
+	return found == uniforms.end() ? nullptr : &found->second;
+}
+
+const Shader::UniformBlock* Shader::FindBlock(const std::string& name) const
+{
+	std::unordered_map<std::string, UniformBlock>::const_iterator found = blocks.find(name);
+	return found == blocks.end() ? nullptr : &found->second;
+}
+
+bool Shader::BindBlock(const std::string& name, GLuint bindingPoint)
+{
+	const UniformBlock* block = FindBlock(name);
+	if (!block) return false;
+	glUniformBlockBinding(ID, block->index, bindingPoint);
+	return true;
+}
+
 void Shader::setBool(const std::string& name, bool value) const
 {
-	glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+	glUniform1i(Location(name), (int)value);
 }
 
 void Shader::setInt(const std::string& name, int value) const
 {
-	glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+	glUniform1i(Location(name), value);
 }
 
 void Shader::setFloat(const std::string& name, float value) const
 {
-	glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+	glUniform1f(Location(name), value);
+}
+
+void Shader::setVec3(const std::string& name, const glm::vec3& value) const
+{
+	glUniform3fv(Location(name), 1, glm::value_ptr(value));
+}
+
+void Shader::setMat4(const std::string& name, const glm::mat4& value) const
+{
+	glUniformMatrix4fv(Location(name), 1, GL_FALSE, glm::value_ptr(value));
+}
+
+void Shader::Delete()
+{
+	glDeleteProgram(ID);
+	ID = 0;
+	uniforms.clear();
+	blocks.clear();
 }
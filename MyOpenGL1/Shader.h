@@ -6,20 +6,83 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <unordered_map>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// A linked shader program and the inputs it has
+// Right after linking every active uniform and uniform block is looked up once into hash tables,
+// so setting a uniform by name never has to ask GL where it is
+// Copies share the program, which lives until Delete is called
 class Shader
 {
 public:
-	// the program ID
-	unsigned int ID;
-	unsigned int vertex, fragment;
+	// What linking says about one active uniform
+	struct Uniform
+	{
+		// -1 for members of a uniform block, they are set through its buffer
+		GLint location = -1;
+		GLenum type = 0;
+		// Number of elements for arrays, 1 otherwise
+		GLint size = 0;
+		// Index of the block it is in and its byte offset there, -1 for plain uniforms
+		GLint block = -1;
+		GLint offset = -1;
+	};
+
+	struct UniformBlock
+	{
+		GLuint index = 0;
+		// Bytes the block takes, the buffer bound to it has to be at least this large
+		GLint dataSize = 0;
+	};
+
+	// the program ID, 0 for a Shader that was never built
+	unsigned int ID = 0;
 
+	Shader() {}
 	// constructor reads and builds the shader
 	Shader(const char* vertexPath, const char* fragmentPath);
+
+	// Build from sources already in memory, errors are printed but not fatal
+	// With bUseBinaryCache the program is loaded from the ProgramBinaryCache when these sources were linked before,
+	// and saved there when they were not
+	static Shader FromSource(const std::string& vertexSource, const std::string& fragmentSource, bool bUseBinaryCache = false);
+
+	// Whether the program came from the binary cache instead of being compiled
+	bool WasLoadedFromCache() const { return bLoadedFromCache; }
+
 	// use/activate the shader
 	void use();
-	// utility uniform functions
+
+	// Location of a plain uniform, -1 if the program has no such active uniform
+	GLint Location(const std::string& name) const;
+	// nullptr when the program has no such active uniform or block
+	const Uniform* FindUniform(const std::string& name) const;
+	const UniformBlock* FindBlock(const std::string& name) const;
+
+	// Read a block from the buffer bound to bindingPoint, false if the program has no such block
+	bool BindBlock(const std::string& name, GLuint bindingPoint);
+
+	// utility uniform functions, for the program in use
 	void setBool(const std::string& name, bool value) const;
 	void setInt(const std::string& name, int value) const;
 	void setFloat(const std::string& name, float value) const;
+	void setVec3(const std::string& name, const glm::vec3& value) const;
+	void setMat4(const std::string& name, const glm::mat4& value) const;
+
+	void Delete();
+
+private:
+	// 0 and the log printed if it does not compile
+	static unsigned int Compile(GLenum stage, const char* source, const char* stageName);
+	void Build(const std::string& vertexSource, const std::string& fragmentSource, bool bUseBinaryCache);
+	void Reflect();
+
+	bool bLoadedFromCache = false;
+
+	std::unordered_map<std::string, Uniform> uniforms;
+	std::unordered_map<std::string, UniformBlock> blocks;
 };
 #endif
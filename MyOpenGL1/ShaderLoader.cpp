@@ -1,15 +1,60 @@
 #include "ShaderLoader.h"
 
 std::string ShaderLoader::LoadShaderFromFile(const std::string& filePath) {
+	std::vector<std::string> includedFiles;
+	return LoadShaderFromFile(filePath, includedFiles);
+}
+
+std::string ShaderLoader::LoadShaderFromFile(const std::string& filePath, std::vector<std::string>& includedFiles) {
+	includedFiles.push_back(filePath);
+
 	std::ifstream shaderFile(filePath);
 	if (!shaderFile.is_open()) {
-		throw std::exception("Failed to open shader file!");
+		throw std::runtime_error("Failed to open shader file!");
 	}
+
+	size_t directoryEnd = filePath.find_last_of("/\\");
+	std::string directory = directoryEnd == std::string::npos ? "" : filePath.substr(0, directoryEnd + 1);
+
 	std::stringstream shaderStream;
-	shaderStream << shaderFile.rdbuf();
+	std::string line;
+	while (std::getline(shaderFile, line)) {
+		size_t directiveAt = line.find_first_not_of(" \t");
+		if (directiveAt == std::string::npos || line.compare(directiveAt, 8, "#include") != 0) {
+			shaderStream << line << "\n";
+			continue;
+		}
+
+		size_t nameStart = line.find('"', directiveAt);
+		size_t nameEnd = nameStart == std::string::npos ? std::string::npos : line.find('"', nameStart + 1);
+		if (nameEnd == std::string::npos) {
+			throw std::runtime_error("Malformed #include in shader file!");
+		}
+		std::string includePath = directory + line.substr(nameStart + 1, nameEnd - nameStart - 1);
+		if (std::find(includedFiles.begin(), includedFiles.end(), includePath) == includedFiles.end()) {
+			shaderStream << LoadShaderFromFile(includePath, includedFiles);
+		}
+	}
 	shaderFile.close();
 
 	std::cout << "Loaded shader file " << filePath << std::endl;
 
 	return shaderStream.str();
-}
\ No newline at end of file
+}
+
+std::string ShaderLoader::AddDefines(const std::string& source, const std::vector<std::string>& defines) {
+	std::string defineLines;
+	for (const std::string& define : defines) {
+		defineLines += "#define " + define + "\n";
+	}
+
+	// #version has to stay the first statement, so the defines go on the line after it
+	size_t insertAt = 0;
+	size_t versionAt = source.find("#version");
+	if (versionAt != std::string::npos) {
+		size_t lineEnd = source.find('\n', versionAt);
+		insertAt = lineEnd == std::string::npos ? source.size() : lineEnd + 1;
+		if (lineEnd == std::string::npos) defineLines = "\n" + defineLines;
+	}
+	return source.substr(0, insertAt) + defineLines + source.substr(insertAt);
+}
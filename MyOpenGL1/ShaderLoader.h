@@ -1,13 +1,25 @@
 #pragma once
 
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
 class ShaderLoader
 {
 public:
+	// #include "file" lines are replaced by the file, looked up next to the including file
 	static std::string LoadShaderFromFile(const std::string& filePath);
+
+	// Insert a #define line for every name right after the #version line, to build variants of one shader file
+	static std::string AddDefines(const std::string& source, const std::vector<std::string>& defines);
+
+private:
+	// Every file is pasted in once, later includes of the same file are dropped
+	static std::string LoadShaderFromFile(const std::string& filePath, std::vector<std::string>& includedFiles);
 };
 
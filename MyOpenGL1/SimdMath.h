@@ -0,0 +1,127 @@
+#pragma once
+#include <cmath>
+#include <cstddef>
+
+#include <emmintrin.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// Vectorized sin and cos using the Cephes single precision polynomials
+// The argument is reduced to [-pi/4, pi/4] in three steps, which keeps the error near float precision for |x| < 8192
+// SSE2 is always available on x64, the AVX2 path is used when the compiler targets it (/arch:AVX2 or -mavx2)
+class SimdMath
+{
+public:
+	static void SinCos4(__m128 x, __m128& sinOut, __m128& cosOut)
+	{
+		const __m128 signMask = _mm_castsi128_ps(_mm_set1_epi32(0x80000000));
+		__m128 sinSign = _mm_and_ps(x, signMask);
+		x = _mm_andnot_ps(signMask, x);
+
+		// Octant, rounded up to even so the remainder is centered on zero
+		__m128i octant = _mm_cvttps_epi32(_mm_mul_ps(x, _mm_set1_ps(kFourOverPi)));
+		octant = _mm_add_epi32(octant, _mm_set1_epi32(1));
+		octant = _mm_and_si128(octant, _mm_set1_epi32(~1));
+		__m128 octantFloat = _mm_cvtepi32_ps(octant);
+
+		// The sin and cos polynomials swap in octants 2, 3, 6 and 7, the signs flip every 4
+		__m128i swap = _mm_cmpeq_epi32(_mm_and_si128(octant, _mm_set1_epi32(2)), _mm_set1_epi32(2));
+		__m128 sinFlip = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(octant, _mm_set1_epi32(4)), 29));
+		__m128 cosFlip = _mm_castsi128_ps(_mm_slli_epi32(_mm_andnot_si128(_mm_sub_epi32(octant, _mm_set1_epi32(2)), _mm_set1_epi32(4)), 29));
+		sinSign = _mm_xor_ps(sinSign, sinFlip);
+
+		x = _mm_sub_ps(x, _mm_mul_ps(octantFloat, _mm_set1_ps(kPiOver4Part1)));
+		x = _mm_sub_ps(x, _mm_mul_ps(octantFloat, _mm_set1_ps(kPiOver4Part2)));
+		x = _mm_sub_ps(x, _mm_mul_ps(octantFloat, _mm_set1_ps(kPiOver4Part3)));
+		__m128 z = _mm_mul_ps(x, x);
+
+		__m128 cosPolynomial = _mm_set1_ps(kCos0);
+		cosPolynomial = _mm_add_ps(_mm_mul_ps(cosPolynomial, z), _mm_set1_ps(kCos1));
+		cosPolynomial = _mm_add_ps(_mm_mul_ps(cosPolynomial, z), _mm_set1_ps(kCos2));
+		cosPolynomial = _mm_mul_ps(_mm_mul_ps(cosPolynomial, z), z);
+		cosPolynomial = _mm_sub_ps(cosPolynomial, _mm_mul_ps(z, _mm_set1_ps(0.5f)));
+		cosPolynomial = _mm_add_ps(cosPolynomial, _mm_set1_ps(1.0f));
+
+		__m128 sinPolynomial = _mm_set1_ps(kSin0);
+		sinPolynomial = _mm_add_ps(_mm_mul_ps(sinPolynomial, z), _mm_set1_ps(kSin1));
+		sinPolynomial = _mm_add_ps(_mm_mul_ps(sinPolynomial, z), _mm_set1_ps(kSin2));
+		sinPolynomial = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(sinPolynomial, z), x), x);
+
+		__m128 swapMask = _mm_castsi128_ps(swap);
+		__m128 sinResult = _mm_or_ps(_mm_and_ps(swapMask, cosPolynomial), _mm_andnot_ps(swapMask, sinPolynomial));
+		__m128 cosResult = _mm_or_ps(_mm_and_ps(swapMask, sinPolynomial), _mm_andnot_ps(swapMask, cosPolynomial));
+		sinOut = _mm_xor_ps(sinResult, sinSign);
+		cosOut = _mm_xor_ps(cosResult, cosFlip);
+	}
+
+	static __m128 Sin4(__m128 x)
+	{
+		__m128 sinOut, cosOut;
+		SinCos4(x, sinOut, cosOut);
+		return sinOut;
+	}
+
+#if defined(__AVX2__)
+	static void SinCos8(__m256 x, __m256& sinOut, __m256& cosOut)
+	{
+		const __m256 signMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x80000000));
+		__m256 sinSign = _mm256_and_ps(x, signMask);
+		x = _mm256_andnot_ps(signMask, x);
+
+		__m256i octant = _mm256_cvttps_epi32(_mm256_mul_ps(x, _mm256_set1_ps(kFourOverPi)));
+		octant = _mm256_add_epi32(octant, _mm256_set1_epi32(1));
+		octant = _mm256_and_si256(octant, _mm256_set1_epi32(~1));
+		__m256 octantFloat = _mm256_cvtepi32_ps(octant);
+
+		__m256i swap = _mm256_cmpeq_epi32(_mm256_and_si256(octant, _mm256_set1_epi32(2)), _mm256_set1_epi32(2));
+		__m256 sinFlip = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(octant, _mm256_set1_epi32(4)), 29));
+		__m256 cosFlip = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_andnot_si256(_mm256_sub_epi32(octant, _mm256_set1_epi32(2)), _mm256_set1_epi32(4)), 29));
+		sinSign = _mm256_xor_ps(sinSign, sinFlip);
+
+		x = _mm256_sub_ps(x, _mm256_mul_ps(octantFloat, _mm256_set1_ps(kPiOver4Part1)));
+		x = _mm256_sub_ps(x, _mm256_mul_ps(octantFloat, _mm256_set1_ps(kPiOver4Part2)));
+		x = _mm256_sub_ps(x, _mm256_mul_ps(octantFloat, _mm256_set1_ps(kPiOver4Part3)));
+		__m256 z = _mm256_mul_ps(x, x);
+
+		__m256 cosPolynomial = _mm256_set1_ps(kCos0);
+		cosPolynomial = _mm256_add_ps(_mm256_mul_ps(cosPolynomial, z), _mm256_set1_ps(kCos1));
+		cosPolynomial = _mm256_add_ps(_mm256_mul_ps(cosPolynomial, z), _mm256_set1_ps(kCos2));
+		cosPolynomial = _mm256_mul_ps(_mm256_mul_ps(cosPolynomial, z), z);
+		cosPolynomial = _mm256_sub_ps(cosPolynomial, _mm256_mul_ps(z, _mm256_set1_ps(0.5f)));
+		cosPolynomial = _mm256_add_ps(cosPolynomial, _mm256_set1_ps(1.0f));
+
+		__m256 sinPolynomial = _mm256_set1_ps(kSin0);
+		sinPolynomial = _mm256_add_ps(_mm256_mul_ps(sinPolynomial, z), _mm256_set1_ps(kSin1));
+		sinPolynomial = _mm256_add_ps(_mm256_mul_ps(sinPolynomial, z), _mm256_set1_ps(kSin2));
+		sinPolynomial = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(sinPolynomial, z), x), x);
+
+		__m256 swapMask = _mm256_castsi256_ps(swap);
+		sinOut = _mm256_xor_ps(_mm256_blendv_ps(sinPolynomial, cosPolynomial, swapMask), sinSign);
+		cosOut = _mm256_xor_ps(_mm256_blendv_ps(cosPolynomial, sinPolynomial, swapMask), cosFlip);
+	}
+#endif
+
+	// Scalar version of the same approximation, for the leftovers of a batch
+	static void SinCos(float x, float& sinOut, float& cosOut)
+	{
+		__m128 sinVector, cosVector;
+		SinCos4(_mm_set_ss(x), sinVector, cosVector);
+		sinOut = _mm_cvtss_f32(sinVector);
+		cosOut = _mm_cvtss_f32(cosVector);
+	}
+
+private:
+	static constexpr float kFourOverPi = 1.27323954473516f;
+	// pi/4 split so each part times a small integer is exact in float
+	static constexpr float kPiOver4Part1 = 0.78515625f;
+	static constexpr float kPiOver4Part2 = 2.4187564849853515625e-4f;
+	static constexpr float kPiOver4Part3 = 3.77489497744594108e-8f;
+
+	static constexpr float kSin0 = -1.9515295891e-4f;
+	static constexpr float kSin1 = 8.3321608736e-3f;
+	static constexpr float kSin2 = -1.6666654611e-1f;
+	static constexpr float kCos0 = 2.443315711809948e-5f;
+	static constexpr float kCos1 = -1.388731625493765e-3f;
+	static constexpr float kCos2 = 4.166664568298827e-2f;
+};
@@ -0,0 +1,135 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Uniform grid over the XZ plane, only cells that contain something are stored
+// Entities are filed under the cell of their center, queries widen their search by the largest radius inserted
+// Ids index flat per-entity tables, so they should be dense (like EntityId)
+class SpatialHashGrid
+{
+public:
+	explicit SpatialHashGrid(float cellSize = 4.0f) : cellSize(cellSize), inverseCellSize(1.0f / cellSize) {}
+
+	void Insert(unsigned int id, float x, float z, float radius)
+	{
+		if (id >= cellOf.size())
+		{
+			cellOf.resize(id + 1, kNoCell);
+			slotOf.resize(id + 1, 0);
+		}
+		if (cellOf[id] != kNoCell) Remove(id);
+		maxRadius = std::max(maxRadius, radius);
+		AddToCell(id, FindOrAddCell(Key(CellCoord(x), CellCoord(z))));
+	}
+
+	// Call after an entity moved, only touches the grid when it crossed into another cell
+	void Move(unsigned int id, float x, float z)
+	{
+		if (!Contains(id)) return;
+		uint32_t cell = cellOf[id];
+		uint64_t key = Key(CellCoord(x), CellCoord(z));
+		if (cells[cell].key == key) return;
+		RemoveFromCell(id);
+		AddToCell(id, FindOrAddCell(key));
+	}
+
+	void Remove(unsigned int id)
+	{
+		if (!Contains(id)) return;
+		RemoveFromCell(id);
+		cellOf[id] = kNoCell;
+	}
+
+	bool Contains(unsigned int id) const { return id < cellOf.size() && cellOf[id] != kNoCell; }
+
+	// Collect every id that may lie within radius of (x, z), the caller does the exact test
+	void Query(float x, float z, float radius, std::vector<unsigned int>& out) const
+	{
+		float reach = radius + maxRadius;
+		int minX = CellCoord(x - reach), maxX = CellCoord(x + reach);
+		int minZ = CellCoord(z - reach), maxZ = CellCoord(z + reach);
+		for (int cellX = minX; cellX <= maxX; cellX++)
+		{
+			for (int cellZ = minZ; cellZ <= maxZ; cellZ++)
+			{
+				auto found = cellByKey.find(Key(cellX, cellZ));
+				if (found == cellByKey.end()) continue;
+				const std::vector<unsigned int>& ids = cells[found->second].ids;
+				out.insert(out.end(), ids.begin(), ids.end());
+			}
+		}
+	}
+
+	size_t CellCount() const { return cellByKey.size(); }
+	float CellSize() const { return cellSize; }
+
+private:
+	enum : uint32_t { kNoCell = ~0u };
+
+	struct Cell
+	{
+		uint64_t key;
+		std::vector<unsigned int> ids;
+	};
+
+	int CellCoord(float value) const { return static_cast<int>(std::floor(value * inverseCellSize)); }
+
+	static uint64_t Key(int cellX, int cellZ)
+	{
+		return (static_cast<uint64_t>(static_cast<uint32_t>(cellX)) << 32) | static_cast<uint32_t>(cellZ);
+	}
+
+	// Mixes the key so cells along one axis do not all land in neighbouring buckets
+	struct KeyHash
+	{
+		size_t operator()(uint64_t key) const
+		{
+			key ^= key >> 33;
+			key *= 0xFF51AFD7ED558CCDull;
+			key ^= key >> 33;
+			return static_cast<size_t>(key);
+		}
+	};
+
+	// Emptied cells are kept, entities tend to move back into them
+	uint32_t FindOrAddCell(uint64_t key)
+	{
+		auto found = cellByKey.find(key);
+		if (found != cellByKey.end()) return found->second;
+		uint32_t cell = static_cast<uint32_t>(cells.size());
+		cells.push_back(Cell{ key, {} });
+		cellByKey.emplace(key, cell);
+		return cell;
+	}
+
+	void AddToCell(unsigned int id, uint32_t cell)
+	{
+		cellOf[id] = cell;
+		slotOf[id] = static_cast<uint32_t>(cells[cell].ids.size());
+		cells[cell].ids.push_back(id);
+	}
+
+	// Swap with the last id in the cell so removal stays O(1)
+	void RemoveFromCell(unsigned int id)
+	{
+		std::vector<unsigned int>& ids = cells[cellOf[id]].ids;
+		unsigned int last = ids.back();
+		ids[slotOf[id]] = last;
+		slotOf[last] = slotOf[id];
+		ids.pop_back();
+	}
+
+	float cellSize;
+	float inverseCellSize;
+	float maxRadius = 0.0f;
+
+	std::vector<Cell> cells;
+	std::unordered_map<uint64_t, uint32_t, KeyHash> cellByKey;
+
+	// Per id: which cell it is in and where in that cell's list
+	std::vector<uint32_t> cellOf;
+	std::vector<uint32_t> slotOf;
+};
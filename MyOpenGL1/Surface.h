@@ -1,7 +1,9 @@
 #pragma once
+#include <algorithm>
 #include <cmath>
 #include <vector>
 
+#include "SimdMath.h"
 #include "Types.h"
 #include "Curve.h"
 
@@ -9,6 +11,7 @@ class Surface
 {
 public:
 	// Function to calculate height on the surface
+	// terrain.glsl has the same function for the GPU, keep the two in sync
 	static float GetGroundZAt2dCoord(float x, float y)
 	{
 		x /= 4;
@@ -16,6 +19,26 @@ public:
 		return sin(x) + (cos(y) / 2) + sin(y);
 	}
 
+	// The ground never goes higher or lower than this
+	static constexpr float kGroundZMaxHeight = 2.5f;
+
+	// Largest difference between GetGroundZAt2dCoords and GetGroundZAt2dCoord, for coordinates within +-32768
+	static constexpr float kGroundZMaxError = 1e-6f;
+
+	// Height for count coordinates at once, using polynomial sin and cos on 4 or 8 coordinates per step
+	// out may be the same array as x or y
+	static void GetGroundZAt2dCoords(const float* x, const float* y, float* out, size_t count)
+	{
+		GroundBatch<false>(x, y, out, nullptr, nullptr, nullptr, count);
+	}
+
+	// Height and unit normal for count coordinates at once
+	// The normal comes from the derivatives of the height function, which reuse the sin and cos the height needs anyway
+	static void GetGroundZAndNormalAt2dCoords(const float* x, const float* y, float* out, float* normalX, float* normalY, float* normalZ, size_t count)
+	{
+		GroundBatch<true>(x, y, out, normalX, normalY, normalZ, count);
+	}
+
 	static void GenerateFromCurve(Curve* curve, int subdivision, std::vector<Vertex>& vertices, std::vector<int>& indices)
 	{
 		float step_size = 1.0f / subdivision;
@@ -94,12 +117,97 @@ public:
 		}
 	}
 
-	static void GenerateSurface(float min_x, float max_x, float min_y, float max_y, int subdivision, std::vector<Vertex>& vertices, std::vector<int>& indices)
+	// Coordinate of grid line i out of subdivision, exact at both ends
+	static float GridCoordinate(float min, float max, size_t i, int subdivision)
+	{
+		if (i == static_cast<size_t>(subdivision)) return max;
+		return min + (max - min) * static_cast<float>(i) / static_cast<float>(subdivision);
+	}
+
+	// Place vertices on the ground, in batches so the heights can be computed together
+	static void SetGroundHeights(Vertex* vertices, size_t count)
+	{
+		const size_t kBatchSize = 256;
+		float x[kBatchSize], z[kBatchSize], heights[kBatchSize];
+		for (size_t start = 0; start < count; start += kBatchSize)
+		{
+			size_t batch = std::min(kBatchSize, count - start);
+			for (size_t i = 0; i < batch; i++)
+			{
+				x[i] = vertices[start + i].x;
+				z[i] = vertices[start + i].z;
+			}
+			GetGroundZAt2dCoords(x, z, heights, batch);
+			for (size_t i = 0; i < batch; i++)
+				vertices[start + i].y = heights[i];
+		}
+	}
+
+	// Grid of (subdivision + 1)^2 shared vertices covering [min_x, max_x] x [min_y, max_y], two triangles per cell
+	// Every vertex position comes from its integer grid coordinate, so rows never drift
+	// Normals are exact from the height function, so grids that share an edge also share its normals
+	// UVs alternate between the edges of the 0.7 to 0.9 texture region, mirroring the texture on every other cell
+	// bFlat leaves the grid at height zero, for terrain displaced in the vertex shader
+	static void GenerateSurface(float min_x, float max_x, float min_y, float max_y, int subdivision, std::vector<Vertex>& vertices, std::vector<int>& indices, bool bFlat = false)
+	{
+		size_t rowLength = static_cast<size_t>(subdivision) + 1;
+		size_t firstVertex = vertices.size();
+		size_t firstIndex = indices.size();
+		vertices.resize(firstVertex + rowLength * rowLength);
+		indices.resize(firstIndex + static_cast<size_t>(subdivision) * subdivision * 6);
+
+		std::vector<float> rowX(rowLength), rowY(rowLength), rowHeights(rowLength);
+		// Flat grids keep the normal pointing straight up
+		std::vector<float> rowNormalX(rowLength, 0.0f), rowNormalY(rowLength, 1.0f), rowNormalZ(rowLength, 0.0f);
+		for (size_t column = 0; column < rowLength; column++)
+			rowX[column] = GridCoordinate(min_x, max_x, column, subdivision);
+
+		for (size_t row = 0; row < rowLength; row++)
+		{
+			float y = GridCoordinate(min_y, max_y, row, subdivision);
+			if (!bFlat)
+			{
+				std::fill(rowY.begin(), rowY.end(), y);
+				GetGroundZAndNormalAt2dCoords(rowX.data(), rowY.data(), rowHeights.data(), rowNormalX.data(), rowNormalY.data(), rowNormalZ.data(), rowLength);
+			}
+
+			Vertex* v = &vertices[firstVertex + row * rowLength];
+			for (size_t column = 0; column < rowLength; column++, v++)
+			{
+				v->x = rowX[column];
+				v->y = rowHeights[column];
+				v->z = y;
+				v->u = (column & 1) ? 0.9f : 0.7f;
+				v->v = (row & 1) ? 0.9f : 0.7f;
+				v->r = 0.0f; v->g = 0.0f; v->b = 0.0f;
+				v->nx = rowNormalX[column]; v->ny = rowNormalY[column]; v->nz = rowNormalZ[column];
+			}
+		}
+
+		int* index = &indices[firstIndex];
+		for (size_t row = 0; row < static_cast<size_t>(subdivision); row++)
+		{
+			for (size_t column = 0; column < static_cast<size_t>(subdivision); column++)
+			{
+				int corner = static_cast<int>(firstVertex + row * rowLength + column);
+				int right = corner + 1;
+				int above = corner + static_cast<int>(rowLength);
+				int aboveRight = above + 1;
+				// Same winding as the old per-quad vertices
+				*index++ = corner; *index++ = above; *index++ = aboveRight;
+				*index++ = corner; *index++ = aboveRight; *index++ = right;
+			}
+		}
+	}
+
+	// Stream of unshared vertices with an identity index buffer, kept to compare against in benchmarks
+	static void GenerateSurfaceLegacy(float min_x, float max_x, float min_y, float max_y, int subdivision, std::vector<Vertex>& vertices, std::vector<int>& indices)
 	{
 		float range_x = max_x - min_x;
 		float range_y = max_y - min_y;
 		float step_x = range_x / subdivision;
 		float step_y = range_y / subdivision;
+		size_t firstVertex = vertices.size();
 
 		for (float yy = min_y; yy < max_y; yy += step_y)
 		{
@@ -108,7 +216,7 @@ public:
 				{
 					Vertex v;
 					v.x = xx;
-					v.y = GetGroundZAt2dCoord(xx, yy);
+					v.y = 0.0f;
 					v.z = yy;
 					v.u = 0.7f;
 					v.v = 0.9f;
@@ -119,7 +227,7 @@ public:
 				{
 					Vertex v;
 					v.x = xx;
-					v.y = GetGroundZAt2dCoord(xx, yy + step_y);
+					v.y = 0.0f;
 					v.z = yy + step_y;
 					v.u = 0.7f;
 					v.v = 0.7f;
@@ -130,7 +238,7 @@ public:
 				{
 					Vertex v;
 					v.x = xx + step_x;
-					v.y = GetGroundZAt2dCoord(xx + step_x, yy + step_y);
+					v.y = 0.0f;
 					v.z = yy + step_y;
 					v.u = 0.9f;
 					v.v = 0.9f;
@@ -141,7 +249,7 @@ public:
 				{
 					Vertex v;
 					v.x = xx;
-					v.y = GetGroundZAt2dCoord(xx, yy);
+					v.y = 0.0f;
 					v.z = yy;
 					v.u = 0.7f;
 					v.v = 0.7f;
@@ -152,7 +260,7 @@ public:
 				{
 					Vertex v;
 					v.x = xx + step_x;
-					v.y = GetGroundZAt2dCoord(xx + step_x, yy + step_y);
+					v.y = 0.0f;
 					v.z = yy + step_y;
 					v.u = 0.9f;
 					v.v = 0.9f;
@@ -163,7 +271,7 @@ public:
 				{
 					Vertex v;
 					v.x = xx + step_x;
-					v.y = GetGroundZAt2dCoord(xx + step_x, yy);
+					v.y = 0.0f;
 					v.z = yy;
 					v.u = 0.9f;
 					v.v = 0.7f;
@@ -173,7 +281,71 @@ public:
 				}
 			}
 		}
+		SetGroundHeights(vertices.data() + firstVertex, vertices.size() - firstVertex);
 	}
 
+private:
+	// Shared body of the batched ground functions, bWithNormals is known at compile time so the unused half drops out
+	// Height is sin(x/4) + cos(y/4)/2 + sin(y/4), its slopes are cos(x/4)/4 along x and (cos(y/4) - sin(y/4)/2)/4 along y
+	template <bool bWithNormals>
+	static void GroundBatch(const float* x, const float* y, float* out, float* normalX, float* normalY, float* normalZ, size_t count)
+	{
+		size_t i = 0;
+#if defined(__AVX2__)
+		const __m256 quarter8 = _mm256_set1_ps(0.25f);
+		const __m256 half8 = _mm256_set1_ps(0.5f);
+		const __m256 one8 = _mm256_set1_ps(1.0f);
+		for (; i + 8 <= count; i += 8)
+		{
+			__m256 sinX, cosX, sinY, cosY;
+			SimdMath::SinCos8(_mm256_mul_ps(_mm256_loadu_ps(x + i), quarter8), sinX, cosX);
+			SimdMath::SinCos8(_mm256_mul_ps(_mm256_loadu_ps(y + i), quarter8), sinY, cosY);
+			_mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_add_ps(sinX, _mm256_mul_ps(cosY, half8)), sinY));
+			if (bWithNormals)
+			{
+				__m256 slopeX = _mm256_mul_ps(cosX, quarter8);
+				__m256 slopeY = _mm256_mul_ps(_mm256_sub_ps(cosY, _mm256_mul_ps(sinY, half8)), quarter8);
+				__m256 inverseLength = _mm256_div_ps(one8, _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(slopeX, slopeX), _mm256_mul_ps(slopeY, slopeY)), one8)));
+				_mm256_storeu_ps(normalX + i, _mm256_sub_ps(_mm256_setzero_ps(), _mm256_mul_ps(slopeX, inverseLength)));
+				_mm256_storeu_ps(normalY + i, inverseLength);
+				_mm256_storeu_ps(normalZ + i, _mm256_sub_ps(_mm256_setzero_ps(), _mm256_mul_ps(slopeY, inverseLength)));
+			}
+		}
+#endif
+		const __m128 quarter = _mm_set1_ps(0.25f);
+		const __m128 half = _mm_set1_ps(0.5f);
+		const __m128 one = _mm_set1_ps(1.0f);
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128 sinX, cosX, sinY, cosY;
+			SimdMath::SinCos4(_mm_mul_ps(_mm_loadu_ps(x + i), quarter), sinX, cosX);
+			SimdMath::SinCos4(_mm_mul_ps(_mm_loadu_ps(y + i), quarter), sinY, cosY);
+			_mm_storeu_ps(out + i, _mm_add_ps(_mm_add_ps(sinX, _mm_mul_ps(cosY, half)), sinY));
+			if (bWithNormals)
+			{
+				__m128 slopeX = _mm_mul_ps(cosX, quarter);
+				__m128 slopeY = _mm_mul_ps(_mm_sub_ps(cosY, _mm_mul_ps(sinY, half)), quarter);
+				__m128 inverseLength = _mm_div_ps(one, _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(slopeX, slopeX), _mm_mul_ps(slopeY, slopeY)), one)));
+				_mm_storeu_ps(normalX + i, _mm_sub_ps(_mm_setzero_ps(), _mm_mul_ps(slopeX, inverseLength)));
+				_mm_storeu_ps(normalY + i, inverseLength);
+				_mm_storeu_ps(normalZ + i, _mm_sub_ps(_mm_setzero_ps(), _mm_mul_ps(slopeY, inverseLength)));
+			}
+		}
+		for (; i < count; i++)
+		{
+			float sinX, cosX, sinY, cosY;
+			SimdMath::SinCos(x[i] * 0.25f, sinX, cosX);
+			SimdMath::SinCos(y[i] * 0.25f, sinY, cosY);
+			out[i] = sinX + cosY * 0.5f + sinY;
+			if (bWithNormals)
+			{
+				float slopeX = cosX * 0.25f;
+				float slopeY = (cosY - sinY * 0.5f) * 0.25f;
+				float inverseLength = 1.0f / sqrtf(slopeX * slopeX + slopeY * slopeY + 1.0f);
+				normalX[i] = -slopeX * inverseLength;
+				normalY[i] = inverseLength;
+				normalZ[i] = -slopeY * inverseLength;
+			}
+		}
+	}
 };
-
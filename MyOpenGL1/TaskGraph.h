@@ -0,0 +1,111 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "JobSystem.h"
+
+typedef size_t TaskId;
+
+// Work for one frame as named tasks with explicit dependencies, built once and run every frame
+// A task starts as soon as everything it depends on has finished, parallel for tasks are split into ranges over the JobSystem
+class TaskGraph
+{
+public:
+	TaskGraph() = default;
+	TaskGraph(const TaskGraph&) = delete;
+	TaskGraph& operator=(const TaskGraph&) = delete;
+
+	// Task that runs once, dependencies must already be in the graph
+	TaskId Add(const std::string& name, const std::function<void()>& run, const std::vector<TaskId>& dependencies = {})
+	{
+		return AddParallelFor(name, [] { return size_t(1); }, 1, [run](size_t, size_t) { run(); }, dependencies);
+	}
+
+	// Task that calls body over [0, count()) in ranges of grain
+	// count is asked when the task starts, so it can depend on what earlier tasks did
+	TaskId AddParallelFor(const std::string& name, const std::function<size_t()>& count, size_t grain, const JobSystem::RangeFunction& body, const std::vector<TaskId>& dependencies = {})
+	{
+		TaskId id = tasks.size();
+		tasks.emplace_back(new Task());
+		Task& task = *tasks.back();
+		task.name = name;
+		task.count = count;
+		task.grain = grain;
+		task.body = body;
+		task.nDependencies = dependencies.size();
+		task.onDone = [this, id] { Finish(id); };
+		task.counter.onDone = &task.onDone;
+		for (TaskId dependency : dependencies)
+			tasks[dependency]->successors.push_back(id);
+		return id;
+	}
+
+	// Run every task once and return when all of them are done, the calling thread helps
+	void Run(JobSystem& jobs)
+	{
+		if (tasks.empty()) return;
+		this->jobs = &jobs;
+		unfinished.remaining.store(tasks.size());
+		for (std::unique_ptr<Task>& task : tasks)
+			task->pendingDependencies.store(task->nDependencies);
+		for (TaskId id = 0; id < tasks.size(); id++)
+		{
+			if (tasks[id]->nDependencies == 0) Start(id);
+		}
+		jobs.Wait(unfinished);
+	}
+
+	size_t TaskCount() const { return tasks.size(); }
+	const std::string& Name(TaskId id) const { return tasks[id]->name; }
+	// Seconds from when the task could start to when its last range finished in the last Run
+	// Includes time its ranges spent queued behind other work, so it is what the task added to the frame
+	double Seconds(TaskId id) const { return tasks[id]->seconds; }
+	std::chrono::steady_clock::time_point Started(TaskId id) const { return tasks[id]->started; }
+
+private:
+	struct Task
+	{
+		std::string name;
+		std::function<size_t()> count;
+		size_t grain = 1;
+		JobSystem::RangeFunction body;
+		std::vector<TaskId> successors;
+		size_t nDependencies = 0;
+
+		std::atomic<size_t> pendingDependencies{ 0 };
+		JobSystem::Counter counter;
+		std::function<void()> onDone;
+		std::chrono::steady_clock::time_point started;
+		double seconds = 0.0;
+	};
+
+	void Start(TaskId id)
+	{
+		Task& task = *tasks[id];
+		task.started = std::chrono::steady_clock::now();
+		size_t count = task.count();
+		if (count == 0) Finish(id);
+		else jobs->Dispatch(count, task.grain, task.body, task.counter);
+	}
+
+	void Finish(TaskId id)
+	{
+		Task& task = *tasks[id];
+		task.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - task.started).count();
+		for (TaskId successor : task.successors)
+		{
+			if (tasks[successor]->pendingDependencies.fetch_sub(1) == 1) Start(successor);
+		}
+		// Last, Run returns as soon as this reaches zero
+		unfinished.remaining.fetch_sub(1);
+	}
+
+	std::vector<std::unique_ptr<Task>> tasks;
+	JobSystem* jobs = nullptr;
+	JobSystem::Counter unfinished;
+};
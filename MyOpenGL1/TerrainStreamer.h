@@ -0,0 +1,366 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "MeshRegistry.h"
+#include "Surface.h"
+#include "Types.h"
+
+// Square piece of terrain, chunk (x, z) covers [x, x + 1] * ChunkSize on both axes
+struct TerrainChunk
+{
+	int x = 0, z = 0;
+	// Level of detail of the uploaded mesh, -1 while nothing has arrived yet
+	int lod = -1;
+	// Level of detail being generated on a worker, -1 when nothing is in flight
+	int pendingLod = -1;
+	MeshHandle mesh = InvalidMeshHandle;
+};
+
+// Tuning for the TerrainStreamer
+struct TerrainStreamerSettings
+{
+	float chunkSize = 16.0f;
+	// Chunks are kept within this many chunks of the player, on both axes
+	int viewRadius = 7;
+	// Cells per side of a chunk at the highest detail, halved for every level of detail
+	int maxSubdivision = 32;
+	int nLods = 4;
+	// Rings of chunks per level of detail
+	int lodRingWidth = 2;
+	// Finished chunks handed to the GPU per frame, keeps uploads from piling up in one frame
+	int maxUploadsPerFrame = 4;
+	// Benchmarks run without an OpenGL context
+	bool bUploadToGpu = true;
+	// 0 uses every core but the main thread's
+	int nThreads = 0;
+	// Every chunk draws the same flat grid for its detail level and the vertex shader displaces it
+	// Nothing is generated per chunk, so no workers are started
+	bool bDisplaceOnGpu = false;
+};
+
+// Keeps the terrain around the player loaded, generating chunks on worker threads and evicting them when far away
+// Nearby chunks get more detail, skirts hanging down from every chunk edge hide the cracks between different detail levels
+class TerrainStreamer
+{
+public:
+	TerrainStreamer(MeshRegistry& meshes, const TerrainStreamerSettings& settings = TerrainStreamerSettings()) : meshes(meshes), settings(settings)
+	{
+		if (settings.bDisplaceOnGpu)
+		{
+			for (int lod = 0; lod < settings.nLods; lod++)
+				gridMeshes.push_back(CreateGridMesh(SubdivisionForLod(lod)));
+			return;
+		}
+
+		int nThreads = settings.nThreads;
+		if (nThreads <= 0) nThreads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()) - 1);
+		for (int i = 0; i < nThreads; i++)
+			workers.emplace_back(&TerrainStreamer::WorkerLoop, this);
+	}
+
+	// Meshes stay in the registry, it frees their buffers with everything else
+	~TerrainStreamer()
+	{
+		{
+			std::lock_guard<std::mutex> lock(jobMutex);
+			bStopping = true;
+		}
+		jobAvailable.notify_all();
+		for (std::thread& worker : workers)
+			worker.join();
+	}
+
+	TerrainStreamer(const TerrainStreamer&) = delete;
+	TerrainStreamer& operator=(const TerrainStreamer&) = delete;
+
+	// Call once per frame from the thread that owns the OpenGL context
+	void Update(const glm::vec3& playerPosition)
+	{
+		int playerChunkX = ChunkCoord(playerPosition.x);
+		int playerChunkZ = ChunkCoord(playerPosition.z);
+
+		EvictFarChunks(playerChunkX, playerChunkZ);
+		RequestChunks(playerChunkX, playerChunkZ);
+		UploadFinishedChunks();
+	}
+
+	const std::unordered_map<uint64_t, TerrainChunk>& Chunks() const { return chunks; }
+
+	bool DisplacesOnGpu() const { return settings.bDisplaceOnGpu; }
+	// Flat grid shared by every chunk at a level of detail, spans [0, ChunkSize()] and is moved into place per chunk
+	MeshHandle GridMesh(int lod) const { return gridMeshes[lod]; }
+	float ChunkSize() const { return settings.chunkSize; }
+
+	size_t LoadedCount() const { return nLoaded; }
+	size_t PendingCount() const { return nPending; }
+	int UploadsLastFrame() const { return uploadsLastFrame; }
+
+	// Subdivision used at a level of detail, never below one cell
+	int SubdivisionForLod(int lod) const { return std::max(1, settings.maxSubdivision >> lod); }
+
+	// Build the mesh for one chunk, safe to call from any thread
+	static void GenerateChunk(int chunkX, int chunkZ, float chunkSize, int subdivision, std::vector<Vertex>& vertices, std::vector<int>& indices)
+	{
+		float minX = chunkX * chunkSize, maxX = (chunkX + 1) * chunkSize;
+		float minZ = chunkZ * chunkSize, maxZ = (chunkZ + 1) * chunkSize;
+		// Normals come from the height function, so they match across chunk edges whatever the detail level
+		Surface::GenerateSurface(minX, maxX, minZ, maxZ, subdivision, vertices, indices);
+		AddSkirts(subdivision, chunkSize / subdivision, vertices, indices);
+	}
+
+private:
+	struct Job
+	{
+		int x, z, lod;
+	};
+
+	struct Result
+	{
+		int x, z, lod;
+		std::vector<Vertex> vertices;
+		std::vector<int> indices;
+	};
+
+	static uint64_t Key(int chunkX, int chunkZ)
+	{
+		return (static_cast<uint64_t>(static_cast<uint32_t>(chunkX)) << 32) | static_cast<uint32_t>(chunkZ);
+	}
+
+	MeshHandle CreateGridMesh(int subdivision)
+	{
+		MeshHandle handle = meshes.Create("terrain grid " + std::to_string(subdivision));
+		Mesh& mesh = meshes.Get(handle);
+		Surface::GenerateSurface(0.0f, settings.chunkSize, 0.0f, settings.chunkSize, subdivision, mesh.vertices, mesh.indices, true);
+		AddSkirts(subdivision, settings.chunkSize / subdivision, mesh.vertices, mesh.indices);
+		// The vertex shader computes the real normals
+		mesh.bHasNormals = true;
+		if (settings.bUploadToGpu) meshes.Upload(mesh);
+		return handle;
+	}
+
+	int ChunkCoord(float value) const { return static_cast<int>(std::floor(value / settings.chunkSize)); }
+
+	int LodForDistance(int distance) const { return std::min(settings.nLods - 1, distance / settings.lodRingWidth); }
+
+	// Hang a strip of triangles below every edge of the grid made by Surface::GenerateSurface
+	// A neighbour with less detail leaves gaps along the shared edge, the skirt fills them from below
+	static void AddSkirts(int subdivision, float cellSize, std::vector<Vertex>& vertices, std::vector<int>& indices)
+	{
+		int rowLength = subdivision + 1;
+		float depth = cellSize + 0.1f;
+
+		// Walk each edge so the skirt faces outwards
+		int corners[4] = { 0, subdivision, rowLength * rowLength - 1, rowLength * subdivision };
+		int steps[4] = { 1, rowLength, -1, -rowLength };
+		for (int edge = 0; edge < 4; edge++)
+		{
+			int topStart = corners[edge];
+			int bottomStart = static_cast<int>(vertices.size());
+			for (int i = 0; i <= subdivision; i++)
+			{
+				Vertex bottom = vertices[topStart + i * steps[edge]];
+				bottom.y -= depth;
+				vertices.push_back(bottom);
+			}
+			for (int i = 0; i < subdivision; i++)
+			{
+				int top = topStart + i * steps[edge];
+				int topNext = top + steps[edge];
+				int bottomIndex = bottomStart + i;
+				indices.push_back(top); indices.push_back(topNext); indices.push_back(bottomIndex + 1);
+				indices.push_back(top); indices.push_back(bottomIndex + 1); indices.push_back(bottomIndex);
+			}
+		}
+	}
+
+	void EvictFarChunks(int playerChunkX, int playerChunkZ)
+	{
+		// One ring of slack, so walking back and forth over a chunk edge does not reload anything
+		int keepRadius = settings.viewRadius + 1;
+		bool bEvictedPending = false;
+		for (auto it = chunks.begin(); it != chunks.end();)
+		{
+			TerrainChunk& chunk = it->second;
+			int distance = std::max(std::abs(chunk.x - playerChunkX), std::abs(chunk.z - playerChunkZ));
+			if (distance <= keepRadius)
+			{
+				++it;
+				continue;
+			}
+			if (chunk.mesh != InvalidMeshHandle) meshes.Release(chunk.mesh);
+			if (chunk.lod >= 0) nLoaded--;
+			if (chunk.pendingLod >= 0)
+			{
+				nPending--;
+				bEvictedPending = true;
+			}
+			// Results for chunks that are gone are thrown away when they arrive
+			it = chunks.erase(it);
+		}
+		if (!bEvictedPending) return;
+
+		std::lock_guard<std::mutex> lock(jobMutex);
+		RemoveStaleJobs();
+	}
+
+	// Queued jobs for chunks that are gone, or that want another detail level by now, would only be thrown away
+	// Main thread only since it reads chunks, jobMutex must be held
+	void RemoveStaleJobs()
+	{
+		jobs.erase(std::remove_if(jobs.begin(), jobs.end(), [this](const Job& job)
+		{
+			auto found = chunks.find(Key(job.x, job.z));
+			return found == chunks.end() || found->second.pendingLod != job.lod;
+		}), jobs.end());
+	}
+
+	// Queue every missing chunk, and every chunk with the wrong detail, nearest first
+	void RequestChunks(int playerChunkX, int playerChunkZ)
+	{
+		newJobs.clear();
+		bool bSuperseded = false;
+		for (int radius = 0; radius <= settings.viewRadius; radius++)
+		{
+			for (int offsetZ = -radius; offsetZ <= radius; offsetZ++)
+			{
+				for (int offsetX = -radius; offsetX <= radius; offsetX++)
+				{
+					if (std::max(std::abs(offsetX), std::abs(offsetZ)) != radius) continue;
+
+					int chunkX = playerChunkX + offsetX, chunkZ = playerChunkZ + offsetZ;
+					int lod = LodForDistance(radius);
+					TerrainChunk& chunk = chunks[Key(chunkX, chunkZ)];
+					chunk.x = chunkX;
+					chunk.z = chunkZ;
+					if (chunk.pendingLod == lod) continue;
+					if (chunk.lod == lod)
+					{
+						// Back to the detail it already shows, the job for the other one is no longer wanted
+						if (chunk.pendingLod >= 0)
+						{
+							nPending--;
+							chunk.pendingLod = -1;
+							bSuperseded = true;
+						}
+						continue;
+					}
+
+					if (settings.bDisplaceOnGpu)
+					{
+						if (chunk.lod < 0) nLoaded++;
+						chunk.lod = lod;
+						continue;
+					}
+
+					if (chunk.pendingLod < 0) nPending++;
+					else bSuperseded = true;
+					chunk.pendingLod = lod;
+					newJobs.push_back(Job{ chunkX, chunkZ, lod });
+				}
+			}
+		}
+		if (newJobs.empty() && !bSuperseded) return;
+
+		{
+			std::lock_guard<std::mutex> lock(jobMutex);
+			// A chunk that now wants another detail level still has its old job queued
+			if (bSuperseded) RemoveStaleJobs();
+			// Older requests are for places the player has already left behind, new ones go first
+			jobs.insert(jobs.begin(), newJobs.begin(), newJobs.end());
+		}
+		jobAvailable.notify_all();
+	}
+
+	void UploadFinishedChunks()
+	{
+		uploadsLastFrame = 0;
+		while (uploadsLastFrame < settings.maxUploadsPerFrame)
+		{
+			Result result;
+			{
+				std::lock_guard<std::mutex> lock(resultMutex);
+				if (results.empty()) break;
+				result = std::move(results.front());
+				results.pop_front();
+			}
+
+			auto found = chunks.find(Key(result.x, result.z));
+			if (found == chunks.end()) continue;
+			TerrainChunk& chunk = found->second;
+			// A newer request for a different detail level is still on its way
+			if (chunk.pendingLod != result.lod) continue;
+
+			MeshHandle handle = meshes.Create("terrain chunk " + std::to_string(result.x) + ", " + std::to_string(result.z));
+			Mesh& mesh = meshes.Get(handle);
+			mesh.vertices.swap(result.vertices);
+			mesh.indices.swap(result.indices);
+			mesh.bHasNormals = true;
+			if (settings.bUploadToGpu) meshes.Upload(mesh, false);
+
+			if (chunk.mesh != InvalidMeshHandle) meshes.Release(chunk.mesh);
+			else nLoaded++;
+			chunk.mesh = handle;
+			chunk.lod = result.lod;
+			chunk.pendingLod = -1;
+			nPending--;
+			uploadsLastFrame++;
+		}
+	}
+
+	void WorkerLoop()
+	{
+		for (;;)
+		{
+			Job job;
+			{
+				std::unique_lock<std::mutex> lock(jobMutex);
+				jobAvailable.wait(lock, [this] { return bStopping || !jobs.empty(); });
+				if (bStopping) return;
+				job = jobs.front();
+				jobs.pop_front();
+			}
+
+			Result result;
+			result.x = job.x;
+			result.z = job.z;
+			result.lod = job.lod;
+			GenerateChunk(job.x, job.z, settings.chunkSize, SubdivisionForLod(job.lod), result.vertices, result.indices);
+
+			std::lock_guard<std::mutex> lock(resultMutex);
+			results.push_back(std::move(result));
+		}
+	}
+
+	MeshRegistry& meshes;
+	TerrainStreamerSettings settings;
+
+	// Only touched by the main thread
+	std::unordered_map<uint64_t, TerrainChunk> chunks;
+	std::vector<Job> newJobs;
+	std::vector<MeshHandle> gridMeshes;
+	size_t nLoaded = 0;
+	size_t nPending = 0;
+	int uploadsLastFrame = 0;
+
+	std::mutex jobMutex;
+	std::condition_variable jobAvailable;
+	std::deque<Job> jobs;
+	bool bStopping = false;
+
+	std::mutex resultMutex;
+	std::deque<Result> results;
+
+	std::vector<std::thread> workers;
+};
@@ -1,4 +1,8 @@
 ﻿#pragma once
+#include <memory>
+#include <string>
+#include <vector>
+
 #include "glm/geometric.hpp"
 #include "glm/vec3.hpp"
 
@@ -30,13 +34,47 @@ struct WorldCollision
     float x1, x2, y1, y2, z1, z2;
 };
 
-// An instance of an object
-struct Entity
+// Index of a mesh in the MeshRegistry
+typedef unsigned int MeshHandle;
+const MeshHandle InvalidMeshHandle = ~0u;
+
+// Geometry shared by every entity that draws it
+struct CookedMeshView;
+
+struct Mesh
 {
+    std::string name;
     std::vector<Vertex> vertices;
     std::vector<int> indices;
+    // A mesh loaded from the cooked cache keeps its arrays in the mapped file until it is uploaded,
+    // vertices and indices stay empty (see MeshRegistry::Load)
+    std::shared_ptr<const CookedMeshView> cooked;
+
+    unsigned int EBO = 0, VBO = 0, VAO = 0;
+    // Indices in the element buffer, set when uploaded
+    size_t indexCount = 0;
+    // Per-instance model matrices for instanced draws, refilled every frame
+    unsigned int instanceVBO = 0;
+    bool bIsUploaded = false;
+    // Normals are already filled in, otherwise uploading generates smooth normals (see MeshNormals)
+    bool bHasNormals = false;
+
+    // Box around the vertices in the mesh's own space and the sphere around its center that holds them all
+    // Worked out when the mesh is loaded, or when it is uploaded for generated meshes
+    glm::vec3 boundsMin = glm::vec3(0.0f), boundsMax = glm::vec3(0.0f);
+    glm::vec3 boundsCenter = glm::vec3(0.0f);
+    float boundsRadius = 0.0f;
+    bool bHasBounds = false;
+
+    // Number of entities (and other owners) holding this mesh
+    int referenceCount = 0;
+};
+
+// Description of an object, copied into the EntityStore when the entity is created
+struct Entity
+{
+    MeshHandle mesh = InvalidMeshHandle;
     Transformation transformation;
-    Transformation previousTransformation;
 
     BoxCollisionDef collision;
     bool bHasBoxCollision = false;
@@ -46,45 +84,13 @@ struct Entity
 
     // Size of the radius collider
     float RadiusCollisionSize = 0.0f;
-    // Does this entity block the player using the radius collider?
+    // Does this entity block dynamic entities using the radius collider?
     bool bHasRadiusCollision = false;
-    // Does this entity trigger the OnTrigger function when the player collides with the radius collider?
+    // Does this entity trigger EntityStore::OnTrigger when a dynamic entity collides with the radius collider?
     bool bHasRadiusTrigger = false;
-    void OnTrigger() {};
-
-    unsigned int EBO, VBO, VAO;
-
-    // Calculate vertex normals for all triangles in this entity's mesh
-    // NOTE: Assumes separate triangles, 3 indices per triangle
-    void GenerateNormals()
-    {
-	    for (int i = 0; i < indices.size(); i+=3)
-	    {
-            Vertex* P = &vertices[indices[i]];
-            Vertex* Q = &vertices[indices[i + 1]];
-            Vertex* R = &vertices[indices[i + 2]];
-            glm::vec3 A = glm::vec3(P->x, P->y, P->z);
-            glm::vec3 B = glm::vec3(Q->x, Q->y, Q->z);
-            glm::vec3 C = glm::vec3(R->x, R->y, R->z);
-            glm::vec3 normal = glm::normalize(glm::cross(B - A, C - A));
-            P->nx = normal.x; P->ny = normal.y; P->nz = normal.z;
-            Q->nx = normal.x; Q->ny = normal.y; Q->nz = normal.z;
-            R->nx = normal.x; R->ny = normal.y; R->nz = normal.z;
-	    }
-    }
-
-    // Get the absolute collision values for this entity
-    WorldCollision GetWorldCollision() const
-    {
-        WorldCollision worldCollision;
-        worldCollision.x1 = transformation.x + collision.x_relative * transformation.scale_x;
-        worldCollision.x2 = worldCollision.x1 + collision.x_size * transformation.scale_x;
-        worldCollision.y1 = transformation.y + collision.y_relative * transformation.scale_y;
-        worldCollision.y2 = worldCollision.y1 + collision.y_size * transformation.scale_y;
-        worldCollision.z1 = transformation.z + collision.z_relative * transformation.scale_z;
-        worldCollision.z2 = worldCollision.z1 + collision.z_size * transformation.scale_z;
-        return worldCollision;
-    }
+
+    // Does this entity move, and get pushed out of other colliders by the CollisionSystem?
+    bool bIsDynamic = false;
 
     Entity() = default;
 };
\ No newline at end of file
@@ -0,0 +1,36 @@
+#pragma once
+#include <glad/glad.h>
+
+// GPU copy of a T read by uniform blocks, T laid out by the std140 rules the same as the block
+// Programs read it once their block is bound to the same binding point, see Shader::BindBlock
+// Needs a current GL context from construction until DeleteBuffer, which has to be called before the context goes
+template <typename T>
+class UniformBuffer
+{
+public:
+	explicit UniformBuffer(GLuint bindingPoint)
+	{
+		glGenBuffers(1, &buffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(T), nullptr, GL_DYNAMIC_DRAW);
+		glBindBufferBase(GL_UNIFORM_BUFFER, bindingPoint, buffer);
+	}
+
+	// Replace the contents, draws issued before keep what they read
+	void Update(const T& data)
+	{
+		glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(T), &data);
+	}
+
+	void DeleteBuffer()
+	{
+		glDeleteBuffers(1, &buffer);
+	}
+
+	UniformBuffer(const UniformBuffer&) = delete;
+	UniformBuffer& operator=(const UniformBuffer&) = delete;
+
+private:
+	GLuint buffer = 0;
+};
@@ -0,0 +1,397 @@
+#pragma once
+#include <cmath>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Bvh.h"
+#include "CollisionSystem.h"
+#include "Curve.h"
+#include "CurveBatch.h"
+#include "EntityStore.h"
+#include "Frustum.h"
+#include "MeshRegistry.h"
+#include "Surface.h"
+#include "TaskGraph.h"
+#include "Types.h"
+
+//#define _SHOW_VISUAL_CURVES
+
+// Everything that moves: the birds on their paths, the player and the collisions between them
+// and bounding volume trees over all entities, to find them by where they are
+// Only fills the registry and the store, nothing here needs a window or a GL context
+class World
+{
+public:
+	struct Bird
+	{
+		std::unique_ptr<Curve> path;
+		EntityId entity = InvalidEntityId;
+		// Distance travelled along the path
+		float progress = 0.0f;
+		bool reverse = false;
+		// Units per second, the arc length table keeps it the same along the whole path
+		float speed = 8.0f;
+		EntityId visualCurve = InvalidEntityId;
+	};
+
+	// Movement the player asks for, in units per second, applied every tick
+	glm::vec3 playerVelocity = glm::vec3(0.0f);
+
+	World(MeshRegistry& meshes, EntityStore& entities, float tickLength) : meshes(meshes), entities(entities), tickLength(tickLength)
+	{
+		BuildTickTasks();
+	}
+
+	World(const World&) = delete;
+	World& operator=(const World&) = delete;
+
+	// Birds, trees and the player, numStressTrees extra trees to test rendering many instances
+	void Populate(int numStressTrees)
+	{
+		// Make birds
+		int numBirds = 10;
+		for (int i = 0; i < numBirds; i++)
+		{
+			Bird bird;
+			Entity birdEntity;
+			birdEntity.mesh = meshes.Load("bird.obj");
+			birdEntity.bIsDynamic = true;
+			birdEntity.RadiusCollisionSize = 0.3f;
+			birdEntity.bHasRadiusCollision = true;
+			AddPath(bird, 30.0f);
+			bird.progress = bird.path->getLength() / numBirds * i;
+			//birdEntity.transformation.yaw = randomRange(0.0, 360.0);
+
+			AddVisualCurve(bird, "bird curve");
+			bird.entity = entities.Create(birdEntity);
+			birds.push_back(std::move(bird));
+		}
+
+		{
+			Bird bird;
+			Entity evilmanEntity;
+			evilmanEntity.mesh = meshes.Load("evilman.obj");
+			evilmanEntity.bIsDynamic = true;
+			evilmanEntity.RadiusCollisionSize = 0.5f;
+			evilmanEntity.bHasRadiusCollision = true;
+			bird.progress = 0.0f;
+			bird.speed = 1.0f;
+			AddPath(bird, 20.0f);
+
+			evilman = entities.Create(evilmanEntity);
+			bird.entity = evilman;
+			AddVisualCurve(bird, "evilman curve");
+			birds.push_back(std::move(bird));
+		}
+		birdT.resize(birds.size());
+		birdX.resize(birds.size());
+		birdZ.resize(birds.size());
+
+		{
+			float min_x = -20.0f;
+			float min_y = -20.0f;
+			float max_x = 20.0f;
+			float max_y = 20.0f;
+			int numTrees = 50;
+
+			entities.Reserve(entities.Count() + numTrees + numStressTrees);
+			for (int i = 0; i < numTrees; i++)
+			{
+				Entity tree;
+				tree.mesh = meshes.Load("tree.obj");
+				tree.transformation.x = randomRange(min_x, max_x);
+				tree.transformation.z = randomRange(min_y, max_y);
+				tree.RadiusCollisionSize = 0.5f;
+				tree.bHasRadiusCollision = true;
+				entities.Create(tree);
+			}
+
+			// Stress scene, spread out at roughly one tree per 32 square units
+			float stressHalfSize = sqrtf(32.0f * numStressTrees) * 0.5f;
+			for (int i = 0; i < numStressTrees; i++)
+			{
+				Entity tree;
+				tree.mesh = meshes.Load("tree.obj");
+				tree.transformation.x = randomRange(-stressHalfSize, stressHalfSize);
+				tree.transformation.z = randomRange(-stressHalfSize, stressHalfSize);
+				tree.RadiusCollisionSize = 0.5f;
+				tree.bHasRadiusCollision = true;
+				entities.Create(tree);
+			}
+		}
+
+		{
+			Entity playerEntity;
+			playerEntity.mesh = meshes.Load("player.obj");
+			playerEntity.RadiusCollisionSize = 0.5f;
+			playerEntity.bHasRadiusCollision = true;
+			playerEntity.bIsDynamic = true;
+			player = entities.Create(playerEntity);
+		}
+
+		BuildTrees();
+	}
+
+	// Bounds trees over every entity in the store, one for the entities that never move and one for the dynamic ones
+	// The dynamic tree is refitted every tick, build again after entities are added
+	void BuildTrees()
+	{
+		staticIds.clear();
+		dynamicIds.clear();
+		for (EntityId id = 0; id < entities.Count(); id++)
+			(entities.HasFlag(id, EntityStore::kFlagDynamic) ? dynamicIds : staticIds).push_back(id);
+
+		ComputeBounds(staticIds, 1.0f, boundsMin, boundsMax);
+		staticTree.Build(boundsMin.data(), boundsMax.data(), staticIds.size());
+		ComputeMovingBounds();
+		dynamicTree.Build(boundsMin.data(), boundsMax.data(), dynamicIds.size());
+	}
+
+	// Append every entity that may be inside the frustum to out
+	void QueryFrustum(const Frustum& frustum, std::vector<EntityId>& out) const
+	{
+		// The trees give their item numbers, turned into the entities they stand for in place
+		size_t first = out.size();
+		staticTree.QueryFrustum(frustum, out);
+		for (size_t i = first; i < out.size(); i++)
+			out[i] = staticIds[out[i]];
+		first = out.size();
+		dynamicTree.QueryFrustum(frustum, out);
+		for (size_t i = first; i < out.size(); i++)
+			out[i] = dynamicIds[out[i]];
+	}
+
+	// Append every entity whose bounds overlap the sphere to out
+	void QuerySphere(const glm::vec3& center, float radius, std::vector<EntityId>& out) const
+	{
+		size_t first = out.size();
+		staticTree.QuerySphere(center, radius, out);
+		for (size_t i = first; i < out.size(); i++)
+			out[i] = staticIds[out[i]];
+		first = out.size();
+		dynamicTree.QuerySphere(center, radius, out);
+		for (size_t i = first; i < out.size(); i++)
+			out[i] = dynamicIds[out[i]];
+	}
+
+	// Nearest entity whose bounds the ray enters within maxDistance, for picking and line of sight
+	// ignore is never hit, for rays cast from inside an entity such as the player
+	bool Raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, EntityId& hitEntity, float& hitDistance, EntityId ignore = InvalidEntityId) const
+	{
+		Bvh::RayHit hit;
+		bool bHit = false;
+		if (staticTree.Raycast(origin, direction, maxDistance, hit, [&](uint32_t item) { return staticIds[item] == ignore; }))
+		{
+			bHit = true;
+			hitEntity = staticIds[hit.item];
+			maxDistance = hitDistance = hit.distance;
+		}
+		if (dynamicTree.Raycast(origin, direction, maxDistance, hit, [&](uint32_t item) { return dynamicIds[item] == ignore; }))
+		{
+			bHit = true;
+			hitEntity = dynamicIds[hit.item];
+			hitDistance = hit.distance;
+		}
+		return bHit;
+	}
+
+	// Advance everything by one tick, spread over the job system
+	void Tick(JobSystem& jobs) { tickTasks.Run(jobs); }
+
+	float TickLength() const { return tickLength; }
+	EntityId Player() const { return player; }
+	EntityId Evilman() const { return evilman; }
+	const CollisionSystem& Collisions() const { return collisions; }
+	// The stages of a tick, with how long each took in the last one
+	const TaskGraph& TickTasks() const { return tickTasks; }
+
+private:
+	// Random cubic path inside [-extent, extent] on both axes, added to the batch as well
+	void AddPath(Bird& bird, float extent)
+	{
+		int numPoints = 4;
+		std::vector<glm::vec2> points;
+		for (int i = 0; i < numPoints; i++)
+		{
+			float point_x = randomRange(-extent, extent);
+			float point_y = randomRange(-extent, extent);
+			points.push_back(glm::vec2(point_x, point_y));
+		}
+		bird.path.reset(new Curve(points));
+		birdPaths.Add(points);
+	}
+
+	void AddVisualCurve(Bird& bird, const std::string& name)
+	{
+#ifdef _SHOW_VISUAL_CURVES
+		Entity visualCurve;
+		visualCurve.mesh = meshes.Create(name);
+		Surface::GenerateFromCurve(bird.path.get(), 50, meshes.Get(visualCurve.mesh).vertices, meshes.Get(visualCurve.mesh).indices);
+		visualCurve.bIsAffectedByTerrain = false;
+		bird.visualCurve = entities.Create(visualCurve);
+#else
+		(void)bird;
+		(void)name;
+#endif
+	}
+
+	// World space box around the bounding sphere of every entity in ids, drawn at blend between the last two ticks
+	// Matrices are worked out a run at a time so a large level does not need them all at once
+	void ComputeBounds(const std::vector<EntityId>& ids, float blend, std::vector<glm::vec3>& outMin, std::vector<glm::vec3>& outMax)
+	{
+		const size_t kRunLength = 1024;
+		outMin.resize(ids.size());
+		outMax.resize(ids.size());
+		boundsMatrices.resize(std::min(kRunLength, ids.size()));
+		for (size_t runStart = 0; runStart < ids.size(); runStart += kRunLength)
+		{
+			size_t runCount = std::min(kRunLength, ids.size() - runStart);
+			entities.ComputeMatrices(boundsMatrices.data(), ids.data() + runStart, runCount, true, blend);
+			for (size_t run = 0; run < runCount; run++)
+			{
+				Mesh& mesh = meshes.Get(entities.mesh[ids[runStart + run]]);
+				// Generated meshes only get their bounds when uploaded, which has not happened yet when the trees are first built
+				if (!mesh.bHasBounds) MeshRegistry::ComputeBounds(mesh);
+				glm::vec3 center = glm::vec3(boundsMatrices[run] * glm::vec4(mesh.boundsCenter, 1.0f));
+				outMin[runStart + run] = center - glm::vec3(mesh.boundsRadius);
+				outMax[runStart + run] = center + glm::vec3(mesh.boundsRadius);
+			}
+		}
+	}
+
+	// Bounds of the dynamic entities covering both of the last two ticks, so they hold wherever in between they are drawn
+	void ComputeMovingBounds()
+	{
+		ComputeBounds(dynamicIds, 0.0f, previousBoundsMin, previousBoundsMax);
+		ComputeBounds(dynamicIds, 1.0f, boundsMin, boundsMax);
+		for (size_t i = 0; i < dynamicIds.size(); i++)
+		{
+			boundsMin[i] = glm::min(boundsMin[i], previousBoundsMin[i]);
+			boundsMax[i] = glm::max(boundsMax[i], previousBoundsMax[i]);
+		}
+	}
+
+	// Every stage is split into ranges, the dependencies keep each stage after the ones whose results it reads
+	void BuildTickTasks()
+	{
+		TaskId storePrevious = tickTasks.Add("store previous transforms", [this] { entities.StorePreviousTransforms(); });
+		TaskId movePlayer = tickTasks.Add("move player", [this]
+		{
+			entities.x[player] += playerVelocity.x * tickLength;
+			entities.z[player] += playerVelocity.z * tickLength;
+		}, { storePrevious });
+
+		// Top down 2D collisions, every dynamic entity against everything else
+		TaskId collisionSetup = tickTasks.Add("collision setup", [this] { collisions.BeginUpdate(entities); }, { movePlayer });
+		TaskId broadPhase = tickTasks.AddParallelFor("broad-phase", [this] { return collisions.TaskCount(); }, 1, [this](size_t begin, size_t end)
+		{
+			for (size_t task = begin; task < end; task++)
+				collisions.FindContacts(entities, task);
+		}, { collisionSetup });
+		TaskId resolveCollisions = tickTasks.Add("resolve collisions", [this] { collisions.EndUpdate(entities); }, { broadPhase });
+
+		// Move birds, every bird only touches its own entity
+		TaskId updateAgents = tickTasks.AddParallelFor("update agents", [this] { return birds.size(); }, CurveBatch::kBlockSize * 64, [this](size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; i++)
+			{
+				Bird& bird = birds[i];
+
+				if (bird.reverse)
+					bird.progress -= tickLength * bird.speed;
+				if (!bird.reverse)
+					bird.progress += tickLength * bird.speed;
+
+				// Ping pong path behavior
+				if (bird.progress > bird.path->getLength())
+					bird.reverse = true;
+				if (bird.progress < 0.0f)
+					bird.reverse = false;
+
+				birdT[i] = bird.path->getParameterAtDistance(bird.progress);
+			}
+
+			birdPaths.Evaluate(begin, end - begin, birdT.data(), birdX.data(), birdZ.data());
+
+			for (size_t i = begin; i < end; i++)
+			{
+				// Put bird on its new point, so it covers the same distance every tick
+				EntityId id = birds[i].entity;
+				glm::vec2 newPoint(birdX[i], birdZ[i]);
+				glm::vec2 difference = newPoint - glm::vec2(entities.x[id], entities.z[id]);
+				entities.x[id] = newPoint.x;
+				entities.z[id] = newPoint.y;
+
+				// Rotate bird to face direction, keep the old heading on the tick it turns around at a path end
+				if (glm::dot(difference, difference) <= 0.0f)
+					continue;
+				float angle = atan2(difference.y, difference.x);
+				entities.yaw[id] = naive_lerp(entities.yaw[id], glm::radians(glm::degrees(-angle) - 90.0f), tickLength * 5.0f);
+			}
+		}, { resolveCollisions });
+
+		// Update player visually
+		TaskId orientPlayer = tickTasks.Add("orient player", [this]
+		{
+			// Rotate player to match movement direction
+			glm::vec2 difference = glm::normalize(glm::vec2(entities.previousX[player], entities.previousZ[player]) - glm::vec2(entities.x[player], entities.z[player]));
+			if (glm::length(difference) > 0)
+			{
+				float angle = atan2(difference.y, difference.x);
+				entities.yaw[player] = naive_lerp_loop(entities.yaw[player], glm::radians(glm::degrees(-angle) + 90.0f), tickLength * 5.0f, glm::radians(360.0f));
+			}
+		}, { resolveCollisions });
+
+		tickTasks.Add("refit dynamic tree", [this]
+		{
+			ComputeMovingBounds();
+			dynamicTree.Refit(boundsMin.data(), boundsMax.data());
+		}, { updateAgents, orientPlayer });
+	}
+
+	static float naive_lerp(float a, float b, float t)
+	{
+		return a + t * (b - a);
+	}
+
+	static float naive_lerp_loop(float a, float b, float t, float limit)
+	{
+		if (a > limit) a -= limit;
+		if (a < 0.0) a += limit;
+		if (std::abs(a - b) > limit / 2.0f) b += limit;
+		return naive_lerp(a, b, t);
+	}
+
+	static float randomRange(float min, float max)
+	{
+		float range = max - min;
+		float modifier = RAND_MAX / range;
+		float result = rand() / modifier;
+		return min + result;
+	}
+
+	MeshRegistry& meshes;
+	EntityStore& entities;
+	float tickLength;
+
+	std::vector<Bird> birds;
+	// Every path is cubic, the batch evaluates all of them together each tick
+	CurveBatch birdPaths = CurveBatch(3);
+	std::vector<float> birdT, birdX, birdZ;
+
+	EntityId player = InvalidEntityId;
+	EntityId evilman = InvalidEntityId;
+
+	CollisionSystem collisions;
+	TaskGraph tickTasks;
+
+	// Tree items are indices into these
+	std::vector<EntityId> staticIds, dynamicIds;
+	Bvh staticTree, dynamicTree;
+	// Scratch for working out bounds
+	std::vector<glm::mat4> boundsMatrices;
+	std::vector<glm::vec3> boundsMin, boundsMax, previousBoundsMin, previousBoundsMax;
+};
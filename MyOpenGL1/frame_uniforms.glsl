@@ -0,0 +1,11 @@
+// Everything that is the same for every draw of a frame, written once per frame from FrameUniforms in main.cpp
+// std140 puts each vec3 on a 16 byte boundary, a float right after one fills the rest of its 16 bytes
+layout (std140) uniform FrameUniforms
+{
+	mat4 view;
+	mat4 projection;
+	vec3 viewPos;
+	float timePassed;
+	vec3 playerPos;
+	vec3 evilmanPos;
+};
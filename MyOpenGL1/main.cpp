@@ -8,6 +8,8 @@
 #include <iomanip>
 #include <vector>
 #include <cmath>
+#include <cstddef>
+#include <utility>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -23,13 +25,29 @@
 #include "Types.h" // Generic types used in the project
 #include "ObjectFileLoader.h" // Can load and prepare .obj files to be rendered
 #include "ShaderLoader.h" // Can load and prepare shader files  
+#include "Shader.h" // Linked programs and their uniforms
+#include "MeshRegistry.h" // Shared, reference counted meshes
+#include "EntityStore.h" // Structure of arrays storage for all entities
+#include "CollisionSystem.h" // Collisions between every moving entity and everything else
 #include "Level.h" // Handles loading level meshes
 #include "Surface.h" // Surface function and generation
+#include "TerrainStreamer.h" // Loads terrain chunks around the player in the background
 #include "Camera.h" // Handles camera controls and updates
 #include "Curve.h"
+#include "CurveBatch.h"
 #include "Helper.h"
-
-//#define _SHOW_VISUAL_CURVES
+#include "Benchmark.h" // Command line benchmarks
+#include "FixedTimestep.h" // Fixed rate simulation ticks
+#include "Frustum.h" // Skips entities the camera cannot see
+#include "InstanceBatches.h" // Entity matrices sorted into one array per draw
+#include "GpuTimer.h" // GPU time of the draws
+#include "JobSystem.h" // Worker threads with work stealing
+#include "Profiler.h" // Per section frame timings and Chrome traces
+#include "ProgramBinaryCache.h" // Linked shader programs saved between runs
+#include "RenderQueue.h" // Draws sorted by the state they need
+#include "TaskGraph.h" // Per frame tasks and their dependencies
+#include "UniformBuffer.h" // Per frame shader inputs in one buffer
+#include "World.h" // Birds, trees, the player and the simulation tick
 
 // If anything happens to your frame, this is called
 // resizing etc
@@ -49,6 +67,10 @@ float lastY = SCR_HEIGHT / 2.0f;
 bool firstMouse = true;
 
 float deltaTime = 0.0f;	// time between current frame and last frame
+const float SIMULATION_STEP = 1.0f / 60.0f;	// time simulated by every tick, whatever the frame rate
+
+// Movement the keys ask for, in units per second, applied to the player every simulation tick
+glm::vec3 playerVelocity = glm::vec3(0.0f);
 
 bool wasAnyInputPressed = false;
 bool IsKeyHeld(GLFWwindow* window, int key)
@@ -83,51 +105,158 @@ MovementInput processMovementInput(GLFWwindow* window)
     return movement;
 }
 
-float naive_lerp(float a, float b, float t)
-{
-    return a + t * (b - a);
-}
+int CurrentRenderMode = GL_TRIANGLES;
 
-float naive_lerp_loop(float a, float b, float t, float limit)
-{
-    if (a > limit) a -= limit;
-    if (a < 0.0) a += limit;
-    if (abs(a - b) > limit / 2.0f) b += limit;
-    return naive_lerp(a, b, t);
-}
+MeshRegistry meshes;
+EntityStore entities;
 
-inline float randomRange(float min, float max)
+// What the FrameUniforms block in frame_uniforms.glsl holds, by the std140 rules
+struct FrameUniforms
 {
-    float range = max - min;
-    float modifier = RAND_MAX / range;
-    float result = rand() / modifier;
-    return min + result;
-}
-
-int CurrentRenderMode = GL_TRIANGLES;
-
-Entity* player = new Entity();
+    enum { kBindingPoint = 0 };
+
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::vec3 viewPos;
+    float timePassed;
+    glm::vec3 playerPos;
+    float padding0;
+    glm::vec3 evilmanPos;
+    float padding1;
+
+    // Whether a program's block has the members where this struct has them, printing the first difference
+    static bool MatchesBlockIn(const Shader& shader)
+    {
+        const Shader::UniformBlock* block = shader.FindBlock("FrameUniforms");
+        if (!block) return false;
+        const std::pair<const char*, size_t> members[] = {
+            { "view", offsetof(FrameUniforms, view) }, { "projection", offsetof(FrameUniforms, projection) },
+            { "viewPos", offsetof(FrameUniforms, viewPos) }, { "timePassed", offsetof(FrameUniforms, timePassed) },
+            { "playerPos", offsetof(FrameUniforms, playerPos) }, { "evilmanPos", offsetof(FrameUniforms, evilmanPos) } };
+        for (const auto& member : members)
+        {
+            const Shader::Uniform* uniform = shader.FindUniform(member.first);
+            if (uniform && uniform->offset != (GLint)member.second)
+            {
+                std::cout << "FrameUniforms::" << member.first << " is at " << member.second << " but the shader reads it at " << uniform->offset << std::endl;
+                return false;
+            }
+        }
+        if (block->dataSize > (GLint)sizeof(FrameUniforms))
+        {
+            std::cout << "FrameUniforms is " << sizeof(FrameUniforms) << " bytes but the shader block is " << block->dataSize << std::endl;
+            return false;
+        }
+        return true;
+    }
+};
 
 int main(int argc, char** argv)
 {
-    player->RadiusCollisionSize = 0.5f;
+    // Startup is reported when the first frame is on screen
+    Profiler::Clock::time_point launchTime = Profiler::Clock::now();
+    bool bFirstFrame = true;
+
     // glfw: initialize and configure
     // ------------------------------
 
 #pragma region Program Input
     std::string levelFile = "level.data";
     std::string textureFileName = "texture.png";
+    // Runs the world without a window and prints JSON timings, first so nothing else ends up in the output
+    // --headless [ticks] [level file] [stress trees]
+    if (argc > 1 && std::string(argv[1]) == "--headless")
+    {
+        return Benchmark::Headless(argc > 3 ? argv[3] : levelFile, argc > 2 ? std::stoi(argv[2]) : 600, argc > 4 ? std::stoi(argv[4]) : 0);
+    }
+
     for (int i = 0; i < argc; i++)
     {
         std::cout << i << ": " << argv[i] << std::endl;
     }
 
+    // Benchmarks run without a window and exit afterwards
+    if (argc > 2 && std::string(argv[1]) == "--bench-obj")
+    {
+        Benchmark::ObjectFileLoading(argv[2], argc > 3 ? std::stoi(argv[3]) : 10);
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "--bench-collision")
+    {
+        Benchmark::CollisionQueries(argc > 2 ? std::stoi(argv[2]) : 100000);
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "--bench-agents")
+    {
+        Benchmark::AgentCollisions(argc > 2 ? std::stoi(argv[2]) : 10000, argc > 3 ? std::stoi(argv[3]) : 100);
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "--bench-simulation")
+    {
+        Benchmark::SimulationScaling(argc > 2 ? std::stoi(argv[2]) : 100000, argc > 3 ? std::stoi(argv[3]) : 60);
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "--bench-terrain")
+    {
+        Benchmark::TerrainHeights(argc > 2 ? std::stoi(argv[2]) : 1000000);
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "--bench-surface")
+    {
+        Benchmark::SurfaceGeneration(argc > 2 ? std::stoi(argv[2]) : 1024);
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "--bench-normals")
+    {
+        Benchmark::NormalGeneration(argc > 2 ? std::stoi(argv[2]) : 1024);
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "--bench-curves")
+    {
+        Benchmark::CurveEvaluation(argc > 2 ? std::stoi(argv[2]) : 100000, argc > 3 ? std::stoi(argv[3]) : 20);
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "--bench-culling")
+    {
+        Benchmark::FrustumCulling(argc > 2 ? std::stoi(argv[2]) : 1000000);
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "--bench-bvh")
+    {
+        Benchmark::BoundingVolumeQueries(argc > 2 ? std::stoi(argv[2]) : 1000000);
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "--bench-terrain-stream")
+    {
+        Benchmark::TerrainStreaming(argc > 2 ? std::stoi(argv[2]) : 1000);
+        return 0;
+    }
+
     // Select object and texture files, drag the object file onto the executable
-    if (argc > 1) textureFileName = argv[1];
-    if (argc > 2) levelFile = argv[2];
+    // --stress-trees <count> adds that many extra trees to test rendering many instances
+    // --gpu-terrain displaces the terrain and lifts entities onto it in the vertex shader instead of on the CPU
+    // --no-shader-cache compiles every shader from source instead of loading the programs linked on an earlier run
+    int numStressTrees = 0;
+    bool bGpuTerrain = false;
+    bool bShaderBinaryCache = true;
+    std::vector<std::string> positionalArguments;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string argument = argv[i];
+        if (argument == "--stress-trees" && i + 1 < argc)
+            numStressTrees = std::stoi(argv[++i]);
+        else if (argument == "--gpu-terrain")
+            bGpuTerrain = true;
+        else if (argument == "--no-shader-cache")
+            bShaderBinaryCache = false;
+        else
+            positionalArguments.push_back(argument);
+    }
+    if (positionalArguments.size() > 0) textureFileName = positionalArguments[0];
+    if (positionalArguments.size() > 1) levelFile = positionalArguments[1];
 #pragma endregion
 #pragma region Level Loading
-    Level level = Level(levelFile);
+    Level level = Level(levelFile, meshes, entities);
     camera.Position = glm::vec3(
         level.cameraPosition.x,
         level.cameraPosition.y,
@@ -168,6 +297,8 @@ int main(int argc, char** argv)
         std::cout << "Failed to initialize GLAD" << std::endl;
         return -1;
     }
+    if (bShaderBinaryCache && !ProgramBinaryCache::Load((GLADloadproc)glfwGetProcAddress))
+        std::cout << "The driver cannot save program binaries, shaders are compiled on every run" << std::endl;
 
 #pragma endregion
 
@@ -186,232 +317,76 @@ int main(int argc, char** argv)
 
 	#pragma region Shader Setup
 
+    // Compiling dominates startup on slow compilers, linked programs are reused from the binary cache when the sources are unchanged
+    Profiler::Clock::time_point shaderStart = Profiler::Clock::now();
     std::string vertexShaderSourceStr = ShaderLoader::LoadShaderFromFile("svert.glsl");
-    const char* vertexShaderSource = vertexShaderSourceStr.c_str();
     std::string fragmentShaderSourceStr = ShaderLoader::LoadShaderFromFile("sfrag.glsl");
-    const char* fragmentShaderSource = fragmentShaderSourceStr.c_str();
-
-    // build and compile our shader program
-    // ------------------------------------
-    // vertex shader
-    unsigned int vertexShader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertexShader, 1, &vertexShaderSource, NULL);
-    glCompileShader(vertexShader);
-    // check for shader compile errors
-    int success;
-    char infoLog[512];
-    glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &success);
-    if (!success)
-    {
-        glGetShaderInfoLog(vertexShader, 512, NULL, infoLog);
-        std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
-    }
-    // fragment shader
-    unsigned int fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragmentShader, 1, &fragmentShaderSource, NULL);
-    glCompileShader(fragmentShader);
-    // check for shader compile errors
-    glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &success);
-    if (!success)
-    {
-        glGetShaderInfoLog(fragmentShader, 512, NULL, infoLog);
-        std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
-    }
-    // link shaders
-    unsigned int shaderProgram = glCreateProgram();
-    glAttachShader(shaderProgram, vertexShader);
-    glAttachShader(shaderProgram, fragmentShader);
-    glLinkProgram(shaderProgram);
-    // check for linking errors
-    glGetProgramiv(shaderProgram, GL_LINK_STATUS, &success);
-    if (!success) {
-        glGetProgramInfoLog(shaderProgram, 512, NULL, infoLog);
-        std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
-    }
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
-
-    // set up shader variables
-    unsigned int timePassedLocation = glGetUniformLocation(shaderProgram, "timePassed");
-    unsigned int bUseTextureLoc = glGetUniformLocation(shaderProgram, "bUseTexture");
-    unsigned int viewLoc = glGetUniformLocation(shaderProgram, "view");
-    unsigned int viewPosLoc = glGetUniformLocation(shaderProgram, "viewPos");
-    unsigned int projectionLoc = glGetUniformLocation(shaderProgram, "projection");
-    unsigned int entityMatrixLoc = glGetUniformLocation(shaderProgram, "entityMatrix");
-    unsigned int playerPosLoc = glGetUniformLocation(shaderProgram, "playerPos");
-    unsigned int evilmanPosLoc = glGetUniformLocation(shaderProgram, "evilmanPos");
-
-#pragma endregion
-#pragma region Buffer Mesh Loading
-
-    CurrentRenderMode = GL_TRIANGLES;
 
-    struct Bird
+    // Same shader twice, the instanced variant reads its entity matrix from a vertex attribute
+    std::vector<std::string> defines;
+    if (bGpuTerrain) defines.push_back("GPU_TERRAIN");
+    Shader shader = Shader::FromSource(ShaderLoader::AddDefines(vertexShaderSourceStr, defines), fragmentShaderSourceStr, bShaderBinaryCache);
+    defines.push_back("INSTANCED");
+    Shader instancedShader = Shader::FromSource(ShaderLoader::AddDefines(vertexShaderSourceStr, defines), fragmentShaderSourceStr, bShaderBinaryCache);
+    // Third variant for the flat terrain grids, only needed when the GPU displaces them
+    Shader terrainShader;
+    if (bGpuTerrain)
     {
-        Curve* path;
-        Entity* entity;
-        float progress = 0.0f;
-        bool reverse = false;
-        float speed = 0.1f;
-        Entity* visualCurve;
-    };
-
-    // Make birds
-    std::vector<Bird*> birds;
-    {
-        int numBirds = 10;
-        for (int i = 0; i < numBirds; i++)
-        {
-            Bird* bird = new Bird();
-            bird->entity = new Entity();
-            {
-                ReadObjectFile("bird.obj", bird->entity->vertices, bird->entity->indices);
-                level.entities.push_back(bird->entity);
-            }
-            bird->progress = (1.0 / numBirds) * i;
-            bird->path = new Curve();
-            {
-                float min_x = -30.0f;
-                float min_y = -30.0f;
-                float max_x = 30.0f;
-                float max_y = 30.0f;
-                int numPoints = 4;
-                for (int i = 0; i < numPoints; i++)
-                {
-                    float point_x = randomRange(min_x, max_x);
-                    float point_y = randomRange(min_y, max_y);
-                    bird->path->points.push_back(glm::vec2(point_x, point_y));
-                }
-            }
-            //bird->entity->transformation.yaw = randomRange(0.0, 360.0);
-
-#ifdef _SHOW_VISUAL_CURVES
-            bird->visualCurve = new Entity();
-            Surface::GenerateFromCurve(bird->path, 50, bird->visualCurve->vertices, bird->visualCurve->indices);
-            bird->visualCurve->bIsAffectedByTerrain = false;
-            level.entities.push_back(bird->visualCurve);
-#endif
-
-            level.entities.push_back(bird->entity);
-            birds.push_back(bird);
-        }
+        defines.push_back("TERRAIN_GRID");
+        terrainShader = Shader::FromSource(ShaderLoader::AddDefines(vertexShaderSourceStr, defines), fragmentShaderSourceStr, bShaderBinaryCache);
     }
 
-    Entity* evilman = new Entity();
+    // Everything the same for every draw is in one uniform buffer, filled once per frame and read by all the programs
+    // What stays the same for the whole run is set once here
+    UniformBuffer<FrameUniforms> frameUniformBuffer(FrameUniforms::kBindingPoint);
+    for (Shader* program : { &shader, &instancedShader, &terrainShader })
     {
-        Bird* bird = new Bird();
-        bird->entity = evilman;
-        {
-            ReadObjectFile("evilman.obj", bird->entity->vertices, bird->entity->indices);
-            level.entities.push_back(bird->entity);
-            bird->progress = 0.0f;
-            bird->speed = 0.02f;
-
-            bird->path = new Curve();
-            {
-                float min_x = -20.0f;
-                float min_y = -20.0f;
-                float max_x = 20.0f;
-                float max_y = 20.0f;
-                int numPoints = 4;
-                for (int i = 0; i < numPoints; i++)
-                {
-                    float point_x = randomRange(min_x, max_x);
-                    float point_y = randomRange(min_y, max_y);
-                    bird->path->points.push_back(glm::vec2(point_x, point_y));
-                }
-            }
-        }
-        level.entities.push_back(bird->entity);
-
-#ifdef _SHOW_VISUAL_CURVES
-        bird->visualCurve = new Entity();
-        Surface::GenerateFromCurve(bird->path, 50, bird->visualCurve->vertices, bird->visualCurve->indices);
-        bird->visualCurve->bIsAffectedByTerrain = false;
-        level.entities.push_back(bird->visualCurve);
-#endif
-
-        birds.push_back(bird);
+        if (program->ID == 0) continue;
+        program->BindBlock("FrameUniforms", FrameUniforms::kBindingPoint);
+        if (!FrameUniforms::MatchesBlockIn(*program)) std::cout << "ERROR::SHADER::FRAME_UNIFORMS_LAYOUT_MISMATCH" << std::endl;
+        program->use();
+        program->setBool("bUseTexture", true);
     }
-    
-
-#pragma region +Surface Creation
+    glUseProgram(0);
 
-    Entity* surface = new Entity();
+    int nPrograms = 0, nCachedPrograms = 0;
+    for (const Shader* program : { &shader, &instancedShader, &terrainShader })
     {
-        float min_x = -20.0f;
-        float min_y = -20.0f;
-        float max_x = 20.0f;
-    	float max_y = 20.0f;
-        int subdivision = 40;
-        int numTrees = 50;
-
-        Surface::GenerateSurface(min_x, max_x, min_y, max_y, subdivision, surface->vertices, surface->indices);
-        level.entities.push_back(surface);
-
-        surface->bIsAffectedByTerrain = false;
-
-        std::vector<Vertex> treeVertices;
-        std::vector<int> treeIndices;
-        ReadObjectFile("tree.obj", treeVertices, treeIndices);
-
-        for (int i = 0; i < numTrees; i++)
-        {
-            float tree_x = randomRange(min_x, max_x);
-            float tree_y = randomRange(min_y, max_y);
-            Entity* tree = new Entity();
-            tree->vertices = treeVertices;
-            tree->indices = treeIndices;
-            tree->transformation.x = tree_x;
-            tree->transformation.z = tree_y;
-            tree->RadiusCollisionSize = 0.5f;
-            tree->bHasRadiusCollision = true;
-            level.entities.push_back(tree);
-        }
+        nPrograms += program->ID != 0;
+        nCachedPrograms += program->WasLoadedFromCache();
     }
+    std::cout << "Shaders ready in " << Profiler::SecondsSince(shaderStart) * 1000.0 << " ms, " << nCachedPrograms << " of " << nPrograms << " programs from the binary cache" << std::endl;
 
-#pragma endregion
-
-    ReadObjectFile("player.obj", player->vertices, player->indices);
-    level.entities.push_back(player);
-
-    std::cout << "Entities: " << level.entities.size() << std::endl;
-    for (int i = 0; i < level.entities.size(); i++)
+    // The uniforms set for every draw, looked up once here instead of by name for each draw
+    struct DrawProgram
     {
-        unsigned int VBO, VAO, EBO;
-        Entity* entity = level.entities[i];
-        entity->GenerateNormals();
-
-        glGenVertexArrays(1, &VAO);
-        glBindVertexArray(VAO);
-
-        glGenBuffers(1, &VBO);
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        glBufferData(GL_ARRAY_BUFFER, entity->vertices.size() * sizeof(Vertex), entity->vertices.data(), GL_STATIC_DRAW);
-
-        glGenBuffers(1, &EBO);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, entity->indices.size() * sizeof(int), entity->indices.data(), GL_STATIC_DRAW);
-
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(float), (void*)0);
-        glEnableVertexAttribArray(0);
-
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(float), (void*)(3 * sizeof(float)));
-        glEnableVertexAttribArray(1);
+        GLuint ID;
+        GLint matrixLocation;
+        GLint snapLocation;
+    };
+    auto makeDrawProgram = [](const Shader& program)
+    {
+        DrawProgram drawProgram = { program.ID, program.Location("entityMatrix"), program.Location("bSnapToGround") };
+        return drawProgram;
+    };
+    const DrawProgram shaderDraws = makeDrawProgram(shader);
+    const DrawProgram instancedShaderDraws = makeDrawProgram(instancedShader);
+    const DrawProgram terrainShaderDraws = makeDrawProgram(terrainShader);
 
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 11 * sizeof(float), (void*)(6 * sizeof(float)));
-        glEnableVertexAttribArray(2);
+#pragma endregion
+#pragma region Buffer Mesh Loading
 
-        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(float), (void*)(8 * sizeof(float)));
-        glEnableVertexAttribArray(3);
+    CurrentRenderMode = GL_TRIANGLES;
 
-        glBindVertexArray(0);
+    // Birds, trees and the player, and the tick that moves them
+    World world(meshes, entities, SIMULATION_STEP);
+    world.Populate(numStressTrees);
+    EntityId player = world.Player();
+    EntityId evilman = world.Evilman();
 
-        std::cout << i << ": " << VAO << std::endl;
-        entity->VAO = VAO;
-        entity->VBO = VBO;
-        entity->EBO = EBO;
-	}
+    // Every unique mesh gets one set of buffers, shared by all entities using it
+    std::cout << "Entities: " << entities.Count() << ", unique meshes: " << meshes.Count() << std::endl;
+    meshes.UploadAll();
 
     glEnable(GL_DEPTH_TEST);
     glDepthRange(0.0, 10000.0);
@@ -455,6 +430,83 @@ int main(int argc, char** argv)
     // uncomment this call to draw in wireframe polygons.
     //glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 
+    // World matrices for the current frame and the draw group of every visible entity, in the order of visibleIds
+    // The group is the MeshHandle and whether the entity snaps to the ground
+    std::vector<glm::mat4> entityMatrices;
+    std::vector<uint32_t> entityGroups;
+    // The same matrices sorted by group
+    InstanceBatches instances;
+    // Placement of every terrain chunk, grouped by level of detail, when the GPU displaces the terrain
+    std::vector<std::vector<glm::mat4>> terrainMatrices;
+
+    // The ground itself is streamed in chunks around the player instead of being one entity
+    TerrainStreamerSettings terrainSettings;
+    terrainSettings.bDisplaceOnGpu = bGpuTerrain;
+    TerrainStreamer terrain(meshes, terrainSettings);
+
+    // A simulation tick runs as many times per frame as the FixedTimestep says, the draw preparation once per frame
+    JobSystem jobs;
+    FixedTimestep timestep(SIMULATION_STEP);
+
+    // Entities whose bounds are entirely outside the camera's view are left out of the draws
+    // The world's bounds trees find the rest without looking at every entity
+    bool bFrustumCulling = true;
+    Frustum viewFrustum;
+    std::vector<EntityId> visibleIds;
+
+    TaskGraph drawTasks;
+    {
+        TaskId cull = drawTasks.Add("cull", [&]
+        {
+            visibleIds.clear();
+            if (bFrustumCulling) world.QueryFrustum(viewFrustum, visibleIds);
+            else
+            {
+                for (EntityId id = 0; id < entities.Count(); id++)
+                    visibleIds.push_back(id);
+            }
+            entityMatrices.resize(visibleIds.size());
+            entityGroups.resize(visibleIds.size());
+            instances.Begin(visibleIds.size(), meshes.HandleCount() * 2);
+        });
+
+        // Entities are drawn part of the way between the last two ticks, so motion is smooth at any frame rate
+        // With GPU terrain the matrices leave out the ground height, so entities that snap get their own group
+        TaskId buildMatrices = drawTasks.AddParallelFor("build matrices", [&] { return visibleIds.size(); }, 1024, [&](size_t begin, size_t end)
+        {
+            entities.ComputeMatrices(entityMatrices.data() + begin, visibleIds.data() + begin, end - begin, !bGpuTerrain, timestep.Blend());
+            for (size_t i = begin; i < end; i++)
+            {
+                EntityId id = visibleIds[i];
+                uint32_t group = entities.mesh[id] * 2;
+                if (bGpuTerrain && entities.HasFlag(id, EntityStore::kFlagAffectedByTerrain)) group++;
+                entityGroups[i] = group;
+            }
+        }, { cull });
+
+        TaskId countInstances = drawTasks.AddParallelFor("count instances", [&] { return instances.TaskCount(); }, 1, [&](size_t begin, size_t end)
+        {
+            for (size_t task = begin; task < end; task++)
+                instances.Count(task, entityGroups.data());
+        }, { buildMatrices });
+        TaskId instanceOffsets = drawTasks.Add("instance offsets", [&] { instances.ComputeOffsets(); }, { countInstances });
+        drawTasks.AddParallelFor("build instance buffers", [&] { return instances.TaskCount(); }, 1, [&](size_t begin, size_t end)
+        {
+            for (size_t task = begin; task < end; task++)
+                instances.Scatter(task, entityGroups.data(), entityMatrices.data());
+        }, { instanceOffsets });
+    }
+
+    // Timings of every part of the frame, the GPU's share arrives a few frames late
+    Profiler profiler;
+    GpuTimer gpuDrawTimer;
+    double gpuDrawSeconds = 0.0;
+
+    // Every draw of a frame goes through the queue, which issues only the state changes the draws really need
+    RenderQueue renderQueue;
+    GlStateCache glState;
+    const glm::mat4 identity = glm::mat4(1.0f);
+
     // render loop
     // -----------
     double previousFrameTime = glfwGetTime();
@@ -464,23 +516,51 @@ int main(int argc, char** argv)
         deltaTime = currentFrameTime - previousFrameTime;
 		previousFrameTime = currentFrameTime;
 
+        profiler.BeginFrame();
+        // Keeps the last value when no new measurement has finished
+        gpuDrawTimer.Poll(gpuDrawSeconds);
+        profiler.Add("gpu draw", gpuDrawSeconds);
+
         ImGui_ImplOpenGL3_NewFrame();
         ImGui_ImplGlfw_NewFrame();
         ImGui::NewFrame();
 		
         // input
         // -----
-        bool bIsCameraControlsInUse = processInput(window, deltaTime);
+        bool bIsCameraControlsInUse;
+        {
+            Profiler::Scope scope(profiler, "input");
+            bIsCameraControlsInUse = processInput(window, deltaTime);
+        }
+
+        // Collisions and agents, at a fixed rate
+        world.playerVelocity = playerVelocity;
+        int ticks = timestep.Advance(deltaTime);
+        {
+            Profiler::Scope scope(profiler, "simulation");
+            for (int tick = 0; tick < ticks; tick++)
+            {
+                world.Tick(jobs);
+                profiler.AddTasks(world.TickTasks());
+            }
+        }
+        float blend = timestep.Blend();
 
-        // Move camera to player
+        // Move camera to player, where the player is drawn
         if (!bIsCameraControlsInUse) {
             glm::vec3 newCameraOffset = camera.Front * -5.0f;
-            glm::vec3 playerPos = player->transformation.Position();
+            glm::vec3 playerPos = entities.InterpolatedPosition(player, blend);
             newCameraOffset.y += 1.0f;
 
             camera.Position = playerPos + newCameraOffset;
-            camera.Position.y += Surface::GetGroundZAt2dCoord(playerPos.x, playerPos.z);
-            camera.Position.y = std::max(Surface::GetGroundZAt2dCoord(camera.Position.x, camera.Position.z) + 0.1f, camera.Position.y);
+
+            // Ground under the player and under the camera
+            float groundX[2] = { playerPos.x, camera.Position.x };
+            float groundZ[2] = { playerPos.z, camera.Position.z };
+            float groundHeight[2];
+            Surface::GetGroundZAt2dCoords(groundX, groundZ, groundHeight, 2);
+            camera.Position.y += groundHeight[0];
+            camera.Position.y = std::max(groundHeight[1] + 0.1f, camera.Position.y);
         }
 
         // render
@@ -488,135 +568,138 @@ int main(int argc, char** argv)
         glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT);
         glClear(GL_DEPTH_BUFFER_BIT);
-        
-		// Update shader variables
-		glUniform1f(timePassedLocation, (float) currentFrameTime);
-
-        glBindTexture(GL_TEXTURE_2D, texture);
-
-        glUniform1i(bUseTextureLoc, 1);
 
         glm::mat4 view = camera.GetViewMatrix();
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-
-        glUniform3fv(viewPosLoc, 1, &camera.Position[0]);
-
         glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-        glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
 
         //camera.updateCameraVectors();
 
-        // Do collision checks
-		{
-            // Top down 2D collisions (radius)
-            glm::vec2 currentPosition = glm::vec2(player->transformation.x, player->transformation.z);
-            for (int i = 0; i < level.entities.size(); i++)
-            {
-                Entity* entity = level.entities[i];
-                if (!entity->bHasRadiusCollision && !entity->bHasRadiusTrigger) continue;
-
-                glm::vec2 difference = currentPosition - glm::vec2(entity->transformation.x, entity->transformation.z);
-                float distance = glm::length(difference);
-                float contactDistance = (player->RadiusCollisionSize + entity->RadiusCollisionSize);
-                if (distance < contactDistance)
-                {
-                    if (entity->bHasRadiusTrigger)
-                    {
-                        entity->OnTrigger();
-                    }
-                    if (entity->bHasRadiusCollision)
-                    {
-	                    // We are colliding with something!
-	                    // Move the player away from the object
-	                    glm::vec2 newPosition = glm::vec2(entity->transformation.x, entity->transformation.z) + glm::normalize(difference) * contactDistance;
-	                    player->transformation.x = newPosition.x;
-	                    player->transformation.z = newPosition.y;
-	                    currentPosition = glm::vec2(player->transformation.x, player->transformation.z);
-                    }
-                }
-            }
-		}
-
-        // Move birds
-		{
-            for (int i = 0; i < birds.size(); i++)
-            {
-                Bird* bird = birds[i];
-
-                if (bird->reverse)
-					bird->progress -= deltaTime * bird->speed;
-                if (!bird->reverse)
-                    bird->progress += deltaTime * bird->speed;
-
-                // Ping pong path behavior
-                if (bird->progress > 1.0f)
-                    bird->reverse = true;
-                if (bird->progress < 0.0f)
-                    bird->reverse = false;
+        // Everything the draws need, spread over the job system
+        viewFrustum = Frustum::FromMatrix(projection * view);
+        {
+            Profiler::Scope scope(profiler, "draw preparation");
+            drawTasks.Run(jobs);
+            profiler.AddTasks(drawTasks);
+        }
 
-                //bird->progress = std::min(std::max(bird->progress, 0.0f), 1.0f);
+        glm::vec3 playerPosition = entities.InterpolatedPosition(player, blend);
+        glm::vec3 evilmanPosition = entities.InterpolatedPosition(evilman, blend);
 
-                // Move bird towards new point
-                glm::vec2 newPoint = bird->path->getBezierPoint(bird->progress);
-                bird->entity->transformation.x = naive_lerp(bird->entity->transformation.x, newPoint.x, deltaTime);
-                bird->entity->transformation.z = naive_lerp(bird->entity->transformation.z, newPoint.y, deltaTime);
+        {
+            Profiler::Scope scope(profiler, "terrain streaming");
+            terrain.Update(playerPosition);
+        }
 
-                // Rotate bird to face direction
-                glm::vec2 difference = glm::normalize(newPoint - glm::vec2(bird->entity->transformation.x, bird->entity->transformation.z));
-                float angle = atan2(difference.y, difference.x);
-                bird->entity->transformation.yaw = naive_lerp(bird->entity->transformation.yaw, glm::radians(glm::degrees(-angle) - 90.0f), deltaTime * 5.0);
+        // From here to the end of the draws, on the CPU and on the GPU
+        Profiler::Clock::time_point drawStart = Profiler::Clock::now();
+        gpuDrawTimer.Begin();
+
+        // Terrain streaming uploads meshes with their own binds, so the first bind of each kind this frame is issued
+        glState.Invalidate();
+        glState.ResetCounters();
+
+        // Update shader variables, all the programs read them from the same buffer
+        FrameUniforms frameUniforms = {};
+        frameUniforms.view = view;
+        frameUniforms.projection = projection;
+        frameUniforms.viewPos = camera.Position;
+        frameUniforms.timePassed = (float) currentFrameTime;
+        frameUniforms.playerPos = playerPosition;
+        frameUniforms.evilmanPos = evilmanPosition;
+        frameUniformBuffer.Update(frameUniforms);
+        glState.CountIssued(2);
+
+        // A draw of count matrices with one of the programs, instanced ones stream the matrices to the mesh's instance buffer
+        // Draws that snap to the ground sort after the others, so the uniform saying so changes at most once per program
+        renderQueue.Begin(100.0f);
+        auto addDraw = [&](const DrawProgram& program, MeshHandle handle, int bSnapToGround, const glm::mat4* matrices, size_t count, bool bInstanced, float depth)
+        {
+            const Mesh& mesh = meshes.Get(handle);
+            DrawItem item;
+            item.program = program.ID;
+            item.texture = texture;
+            item.vertexArray = mesh.VAO;
+            item.indexCount = (GLsizei)mesh.indexCount;
+            item.snapLocation = program.snapLocation;
+            item.bSnapToGround = bSnapToGround;
+            item.matrices = matrices;
+            item.instanceCount = count;
+            if (bInstanced) item.instanceBuffer = mesh.instanceVBO;
+            else item.matrixLocation = program.matrixLocation;
+            renderQueue.Add(item, ((uint32_t)bSnapToGround << (RenderQueue::kMeshBits - 1)) | handle, depth);
+        };
+
+        // Meshes used once are drawn with the matrix uniform, everything else with one instanced draw per mesh
+        for (size_t group = 0; group < instances.GroupCount(); group++)
+        {
+            size_t count = instances.InstanceCount(group);
+            if (count == 0) continue;
+            MeshHandle handle = static_cast<MeshHandle>(group / 2);
+            const glm::mat4* matrices = instances.Matrices(group);
+            if (count == 1) addDraw(shaderDraws, handle, (int)(group & 1), matrices, 1, false, glm::distance(glm::vec3(matrices[0][3]), camera.Position));
+            else addDraw(instancedShaderDraws, handle, (int)(group & 1), matrices, count, true, 0.0f);
+        }
 
-                
+        if (terrain.DisplacesOnGpu())
+        {
+            // One instanced draw of the shared flat grid per level of detail
+            terrainMatrices.resize(terrainSettings.nLods);
+            for (std::vector<glm::mat4>& matrices : terrainMatrices)
+                matrices.clear();
+            for (const auto& entry : terrain.Chunks())
+            {
+                const TerrainChunk& chunk = entry.second;
+                if (chunk.lod < 0) continue;
+                glm::vec3 origin = glm::vec3(chunk.x * terrain.ChunkSize(), 0.0f, chunk.z * terrain.ChunkSize());
+                terrainMatrices[chunk.lod].push_back(glm::translate(glm::mat4(1.0f), origin));
             }
-
-		}
-
-        // Update player visually
-		{
-            // Rotate player to match movement direction
-            glm::vec2 difference = glm::normalize(glm::vec2(player->previousTransformation.x, player->previousTransformation.z) - glm::vec2(player->transformation.x, player->transformation.z));
-            if (glm::length(difference) > 0)
+            for (int lod = 0; lod < terrainSettings.nLods; lod++)
             {
-				float angle = atan2(difference.y, difference.x);
-	            player->transformation.yaw = naive_lerp_loop(player->transformation.yaw, glm::radians(glm::degrees(-angle) + 90.0f), deltaTime * 5.0, glm::radians(360.0));
+                if (!terrainMatrices[lod].empty()) addDraw(terrainShaderDraws, terrain.GridMesh(lod), 0, terrainMatrices[lod].data(), terrainMatrices[lod].size(), true, 0.0f);
             }
-		}
-
-        glm::vec3 playerPosition = glm::vec3(player->transformation.x, player->transformation.y, player->transformation.z);
-        glUniform3fv(playerPosLoc, 1, &playerPosition[0]);
-
-        glm::vec3 evilmanPosition = glm::vec3(evilman->transformation.x, evilman->transformation.y, evilman->transformation.z);
-        glUniform3fv(evilmanPosLoc, 1, &evilmanPosition[0]);
-
-        player->previousTransformation = player->transformation;
-
-        for (int i = 0; i < level.entities.size(); i++)
+        }
+        else
         {
-            Entity* entity = level.entities[i];
-            // draw our first triangle
-            glUseProgram(shaderProgram);
-
-            glBindVertexArray(i + 1);
-            // Calculate the entity matrix
-            glm::mat4 entityMatrix = glm::mat4(1.0f); // make sure to initialize matrix to identity matrix first
-            glm::vec3 translation = glm::vec3(entity->transformation.x, entity->transformation.y, entity->transformation.z);
-
-            // Account for surface displacement if the entity is configured to do so
-            if (entity->bIsAffectedByTerrain)
-				translation.y += Surface::GetGroundZAt2dCoord(translation.x, translation.z);
-
-            entityMatrix = glm::translate(entityMatrix, translation);
-            entityMatrix = glm::rotate(entityMatrix, entity->transformation.pitch, glm::vec3(1.0f, 0.0f, 0.0f));
-            entityMatrix = glm::rotate(entityMatrix, entity->transformation.yaw, glm::vec3(0.0f, 1.0f, 0.0f));
-            entityMatrix = glm::rotate(entityMatrix, entity->transformation.roll, glm::vec3(0.0f, 0.0f, 1.0f));
-
-        	//std::cout << "TRANSFORM " << entity->transformation.x << ", " << entity->transformation.y << ", " << entity->transformation.z << std::endl;
-
-            glUniformMatrix4fv(entityMatrixLoc, 1, GL_FALSE, glm::value_ptr(entityMatrix));
+            // Terrain chunks are already in world space
+            for (const auto& entry : terrain.Chunks())
+            {
+                const TerrainChunk& chunk = entry.second;
+                if (chunk.mesh == InvalidMeshHandle) continue;
+                glm::vec3 center = glm::vec3((chunk.x + 0.5f) * terrain.ChunkSize(), camera.Position.y, (chunk.z + 0.5f) * terrain.ChunkSize());
+                addDraw(shaderDraws, chunk.mesh, 0, &identity, 1, false, glm::distance(center, camera.Position));
+            }
+        }
 
-            glDrawElements(CurrentRenderMode, entity->indices.size(), GL_UNSIGNED_INT, 0);
-            glBindVertexArray(0); 
+        renderQueue.Sort();
+        int drawCalls = renderQueue.Submit(glState, CurrentRenderMode);
+        glState.BindVertexArray(0);
+        gpuDrawTimer.End();
+        profiler.Add("draw submission", drawStart, Profiler::SecondsSince(drawStart), false);
+
+        Profiler::Clock::time_point imguiStart = Profiler::Clock::now();
+        ImGui::Begin("Stats");
+        ImGui::Text("Entities: %d", (int)entities.Count());
+        ImGui::Text("Entity storage: %.1f KB", entities.BytesUsed() / 1024.0f);
+        ImGui::Text("Unique meshes: %d", (int)meshes.Count());
+        ImGui::Text("Draw calls: %d", drawCalls);
+        ImGui::Text("GL calls: %d issued, %d skipped as redundant", glState.Issued(), glState.Skipped());
+        ImGui::Checkbox("Frustum culling", &bFrustumCulling);
+        ImGui::Text("Entities drawn: %d, culled: %d", (int)instances.TotalInstanceCount(), (int)(entities.Count() - instances.TotalInstanceCount()));
+        {
+            // What is straight ahead of the camera, through the world's bounds trees, past the player it may be inside of
+            EntityId lookedAt;
+            float lookedAtDistance;
+            if (world.Raycast(camera.Position, camera.Front, 100.0f, lookedAt, lookedAtDistance, world.Player()))
+                ImGui::Text("Looking at entity %d (%s), %.1f units away", (int)lookedAt, meshes.Get(entities.mesh[lookedAt]).name.c_str(), lookedAtDistance);
+            else
+                ImGui::Text("Looking at nothing");
         }
+        ImGui::Text("Collision pairs tested: %d, contacts: %d", (int)world.Collisions().PairsTested(), (int)world.Collisions().Contacts().size());
+        ImGui::Text("Terrain chunks: %d loaded, %d generating, %d uploaded this frame", (int)terrain.LoadedCount(), (int)terrain.PendingCount(), terrain.UploadsLastFrame());
+        ImGui::Text("Frame time: %.2f ms", deltaTime * 1000.0f);
+        ImGui::Text("Simulation: %d ticks this frame at %.0f Hz, drawn %.2f of the way from the previous tick", timestep.TicksLastFrame(), 1.0f / SIMULATION_STEP, blend);
+        ImGui::End();
+        profiler.DrawWindow();
 
         /*ImGui::SeparatorText("Use [W A S D] to Move");
         ImGui::SeparatorText("Hold [Left Shift] to sprint");
@@ -625,21 +708,33 @@ int main(int argc, char** argv)
 
         ImGui::Render();
         ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        profiler.Add("imgui", imguiStart, Profiler::SecondsSince(imguiStart), false);
 
         // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
         // -------------------------------------------------------------------------------
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        {
+            Profiler::Scope scope(profiler, "swap");
+            glfwSwapBuffers(window);
+        }
+        if (bFirstFrame)
+        {
+            std::cout << "First frame after " << Profiler::SecondsSince(launchTime) * 1000.0 << " ms" << std::endl;
+            bFirstFrame = false;
+        }
+        {
+            Profiler::Scope scope(profiler, "events");
+            glfwPollEvents();
+        }
     }
 
     // optional: de-allocate all resources once they've outlived their purpose:
     // ------------------------------------------------------------------------
-    for (Entity* entity : level.entities)
-    {
-        glDeleteVertexArrays(1, &entity->VAO);
-        glDeleteBuffers(1, &entity->VBO);
-    }
-    glDeleteProgram(shaderProgram);
+    meshes.DeleteAllBuffers();
+    gpuDrawTimer.DeleteQueries();
+    frameUniformBuffer.DeleteBuffer();
+    shader.Delete();
+    instancedShader.Delete();
+    terrainShader.Delete();
 
     // glfw: terminate, clearing all previously allocated GLFW resources.
     // ------------------------------------------------------------------
@@ -687,17 +782,18 @@ bool processInput(GLFWwindow* window, float deltaTime)
         if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
             playerInput.x += 1.0f;
 
-        glm::vec3 playerImpulse =
+        playerVelocity =
             ((camera.Front * playerInput.y) +
                 (camera.Right * playerInput.x))
-            * playerSpeed * deltaTime;
-
-        player->transformation.x += playerImpulse.x;
-        player->transformation.z += playerImpulse.z;
+            * playerSpeed;
+    }
+    else
+    {
+        playerVelocity = glm::vec3(0.0f);
     }
 
 
-    //std::cout << "PLAYER TRANSFORM " << player->transformation.x << ", " << player->transformation.y << ", " << player->transformation.z << std::endl;
+    //std::cout << "PLAYER TRANSFORM " << entities.x[player] << ", " << entities.y[player] << ", " << entities.z[player] << std::endl;
 
     if (bUseCameraControls)
     {
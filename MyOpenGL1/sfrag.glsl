@@ -7,17 +7,16 @@ in vec3 Normal;
 
 uniform bool bUseTexture;
 uniform sampler2D texture_1;
-uniform vec3 viewPos;
-uniform vec3 playerPos;
-uniform vec3 evilmanPos;
+
+#include "frame_uniforms.glsl"
 
 float getFogFactor(float d)
 {
 	const float FogMax = 40.0;
 	const float FogMin = 10.0;
 
-	if (d >= FogMax) return 1;
-	if (d <= FogMin) return 0;
+	if (d >= FogMax) return 1.0;
+	if (d <= FogMin) return 0.0;
 
 	return 1.0 - (FogMax - d) / (FogMax - FogMin);
 }
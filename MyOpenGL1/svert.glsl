@@ -5,10 +5,21 @@ layout (location = 1) in vec3 aCol;
 layout (location = 2) in vec2 aUV;
 layout (location = 3) in vec3 aNormal;
 
-uniform float timePassed;
-uniform mat4 view;
-uniform mat4 projection;
+#include "frame_uniforms.glsl"
+
+#ifdef INSTANCED
+// One model matrix per instance, takes up locations 4 to 7
+layout (location = 4) in mat4 aInstanceMatrix;
+#define entityMatrix aInstanceMatrix
+#else
 uniform mat4 entityMatrix;
+#endif
+
+#ifdef GPU_TERRAIN
+#include "terrain.glsl"
+// Entities are lifted onto the ground here instead of in their matrices
+uniform bool bSnapToGround;
+#endif
 
 out vec3 color;
 out vec3 FragPos;
@@ -17,9 +28,18 @@ out vec3 Normal;
 
 void main()
 {
-	gl_Position = projection * view * entityMatrix * vec4(aPos, 1.0);
+	vec4 worldPos = entityMatrix * vec4(aPos, 1.0);
+	Normal = vec3(transpose(inverse(entityMatrix))) * aNormal;
+#if defined(TERRAIN_GRID)
+	// Flat grid, skirt vertices start below zero and stay that far below the ground
+	worldPos.y += GroundHeight(worldPos.xz);
+	Normal = GroundNormal(worldPos.xz);
+#elif defined(GPU_TERRAIN)
+	if (bSnapToGround) worldPos.y += GroundHeight(entityMatrix[3].xz);
+#endif
+
+	gl_Position = projection * view * worldPos;
 	color = aCol;
-	FragPos = vec3(entityMatrix * vec4(aPos, 1.0));
+	FragPos = vec3(worldPos);
 	texture_coord = vec2(aUV.x, aUV.y);
-	Normal = vec3(transpose(inverse(entityMatrix))) * aNormal;
 }
\ No newline at end of file
@@ -0,0 +1,17 @@
+// Terrain height function, the same as Surface::GetGroundZAt2dCoord on the CPU
+// Included by shaders that place things on the ground themselves
+
+float GroundHeight(vec2 xz)
+{
+	xz /= 4.0;
+	return sin(xz.x) + (cos(xz.y) / 2.0) + sin(xz.y);
+}
+
+// Normal from the derivatives of GroundHeight
+vec3 GroundNormal(vec2 xz)
+{
+	xz /= 4.0;
+	float slopeX = cos(xz.x) / 4.0;
+	float slopeZ = (cos(xz.y) - sin(xz.y) / 2.0) / 4.0;
+	return normalize(vec3(-slopeX, 1.0, -slopeZ));
+}